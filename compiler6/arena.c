@@ -0,0 +1,129 @@
+//
+// Arena (bump) Allocator Module
+// - an arena is a linked list of large blocks; an allocation
+//   just bumps the "used" count of the current block, and a
+//   new block is linked in at the head when it fills up
+// - nothing is freed individually; freeArena() walks the
+//   block list once, so teardown costs O(blocks), not O(allocs)
+//
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// all allocations are aligned to this many bytes
+#define ARENAALIGN 16
+
+// Create a new, empty arena
+// - blockSize is the size of each block; 0 means use the default
+// - no block is allocated until the first arenaAlloc()
+Arena* newArena(size_t blockSize)
+{
+   Arena* arena = (Arena*) malloc(sizeof(Arena));
+   if (!arena)
+      return NULL;
+   memset(arena, 0, sizeof(Arena));
+   arena->blockSize = blockSize ? blockSize : ARENABLOCKSIZE;
+   return arena;
+}
+
+// Link a new block of at least minSize usable bytes onto the arena
+static ArenaBlock* addArenaBlock(Arena* arena, size_t minSize)
+{
+   size_t size = arena->blockSize;
+   ArenaBlock* block;
+   if (minSize > size)
+      size = minSize;
+   block = (ArenaBlock*) malloc(sizeof(ArenaBlock) + size);
+   if (!block)
+      return NULL;
+   block->size = size;
+   block->used = 0;
+   block->next = arena->head;
+   arena->head = block;
+   arena->numBlocks++;
+   arena->bytesReserved += sizeof(ArenaBlock) + size;
+   if (arena->bytesReserved > arena->highWater)
+      arena->highWater = arena->bytesReserved;
+   return block;
+}
+
+// Allocate size bytes from the arena
+// - memory is NOT zeroed
+// - returns NULL only if a new block could not be malloc'd
+void* arenaAlloc(Arena* arena, size_t size)
+{
+   ArenaBlock* block = arena->head;
+   void* p;
+   size = (size + ARENAALIGN-1) & ~(size_t)(ARENAALIGN-1);
+   if (!block || block->size - block->used < size) {
+      block = addArenaBlock(arena, size);
+      if (!block)
+         return NULL;
+   }
+   p = block->data + block->used;
+   block->used += size;
+   arena->numAllocs++;
+   arena->bytesUsed += size;
+   return p;
+}
+
+// Copy a null-terminated string into the arena
+char* arenaStrdup(Arena* arena, const char* str)
+{
+   size_t len = strlen(str) + 1;
+   char* s = (char*) arenaAlloc(arena, len);
+   if (s)
+      memcpy(s, str, len);
+   return s;
+}
+
+// Remember the arena's current allocation point
+void arenaMark(Arena* arena, ArenaMark* mark)
+{
+   mark->block = arena->head;
+   mark->used = arena->head ? arena->head->used : 0;
+   mark->bytesUsed = arena->bytesUsed;
+}
+
+// Release everything allocated since mark
+// - blocks added since then are freed, and the block that was
+//   current at the mark is bumped back to where it was
+void arenaRelease(Arena* arena, ArenaMark* mark)
+{
+   ArenaBlock* block;
+   while (arena->head != mark->block) {
+      block = arena->head;
+      arena->head = block->next;
+      arena->numBlocks--;
+      arena->bytesReserved -= sizeof(ArenaBlock) + block->size;
+      free(block);
+   }
+   if (arena->head)
+      arena->head->used = mark->used;
+   arena->bytesUsed = mark->bytesUsed;
+}
+
+// Release every block and the arena itself
+// - all pointers handed out by this arena become invalid
+void freeArena(Arena* arena)
+{
+   ArenaBlock *cur, *next;
+   if (!arena)
+      return;
+   for (cur = arena->head; cur; cur = next) {
+      next = cur->next;
+      free(cur);
+   }
+   free(arena);
+}
+
+// Print allocation counts and the high-water mark for an arena
+void printArenaStats(Arena* arena, const char* name, FILE* out)
+{
+   if (!arena)
+      return;
+   fprintf(out, "%s arena: %zu allocs, %zu bytes used, %zu blocks, "
+                "%zu bytes reserved (high-water %zu)\n", name,
+           arena->numAllocs, arena->bytesUsed, arena->numBlocks,
+           arena->bytesReserved, arena->highWater);
+}
@@ -0,0 +1,54 @@
+//
+// Arena (bump) Allocator Interface
+// - memory is carved out of large contiguous blocks and is only
+//   ever released all at once: everything, with freeArena(), or
+//   everything allocated since a mark, with arenaRelease()
+// - used for data that lives for the whole compilation, like
+//   AST nodes and their strings
+//
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// default size of each arena block; requests bigger than this
+// get a block of their own
+#define ARENABLOCKSIZE (64*1024)
+
+typedef struct arenablock_s
+{
+   struct arenablock_s *next; // previously filled block
+   size_t size;               // usable bytes in data[]
+   size_t used;               // bytes handed out from data[]
+   char data[];
+} ArenaBlock;
+
+typedef struct
+{
+   ArenaBlock *head;      // current block (allocations come from here)
+   size_t blockSize;      // size for new blocks
+   size_t numAllocs;      // number of arenaAlloc() calls
+   size_t numBlocks;      // number of blocks currently held
+   size_t bytesUsed;      // bytes handed out (including alignment)
+   size_t bytesReserved;  // bytes malloc'd for blocks
+   size_t highWater;      // largest bytesReserved ever seen
+} Arena;
+
+// a point in an arena's allocations to release back to
+typedef struct
+{
+   ArenaBlock *block;     // head block at the mark, or NULL
+   size_t used;           // and its used bytes
+   size_t bytesUsed;
+} ArenaMark;
+
+Arena *newArena(size_t blockSize);
+void *arenaAlloc(Arena *arena, size_t size);
+char *arenaStrdup(Arena *arena, const char *str);
+void arenaMark(Arena *arena, ArenaMark *mark);
+void arenaRelease(Arena *arena, ArenaMark *mark);
+void freeArena(Arena *arena);
+void printArenaStats(Arena *arena, const char *name, FILE *out);
+
+#endif
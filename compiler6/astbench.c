@@ -0,0 +1,315 @@
+//
+// AST layout benchmark
+// - builds a synthetic program AST of NUMFUNCS functions of
+//   FUNCSTMTS statements, then compares the pointer AST with its
+//   flat copy (see flatast.h): bytes held, a whole-tree walk, and
+//   printing it; build with "make astbench"
+// - the statements cycle through assignments of small expression
+//   trees, while loops, if/else, and calls with two arguments
+// - the walks sum every node's type and ival, so neither can be
+//   optimized away and both must agree; the pointer walk and the
+//   flat tree walk visit the nodes in the same order, the flat scan
+//   just runs over the arrays
+// - the same walk is also done with the iterative visitor (see
+//   visit.h), to measure its cost against plain recursion, on the
+//   program and on a chain of DEEPNEST nested while loops
+// - for cache-miss numbers, run it under "perf stat -e
+//   cache-references,cache-misses ./astbench"; this needs hardware
+//   counters, which a VM without a PMU does not have (perf then
+//   reports the events as not supported)
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "astree.h"
+#include "flatast.h"
+#include "visit.h"
+#include "intern.h"
+#include "compiler.h"
+
+#define NUMFUNCS 2000
+#define FUNCSTMTS 200
+#define WALKREPS 20
+#define DEEPNEST 100000
+
+// normally set by the compiler driver (compiler.c), not linked here
+THREADLOCAL int optLevel = 0;
+THREADLOCAL int debug = 0;
+THREADLOCAL int codegenThreads = 1;
+THREADLOCAL SymbolTable* symbols = NULL;
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char* what, unsigned long nodes, double secs)
+{
+   printf("   %-18s %10lu nodes %8.1f ms %8.1f Mnodes/s\n", what, nodes,
+          secs*1e3, nodes / secs / 1e6);
+}
+
+static ASTNode* newNode(ASTNodeType type, int ival, char* str)
+{
+   ASTNode* node = newASTNode(type);
+   node->ival = ival;
+   node->strval = str;
+   return node;
+}
+
+static ASTNode* varRef(int n)
+{
+   ASTNode* node = newNode(AST_VARREF, n, internString(n ? "b" : "a"));
+   node->varKind = V_LOCAL;
+   return node;
+}
+
+// a + (b - k)
+static ASTNode* expr(int k)
+{
+   ASTNode* sub = newNode(AST_EXPRESSION, '-', NULL);
+   ASTNode* add = newNode(AST_EXPRESSION, '+', NULL);
+   sub->child[0] = varRef(1);
+   sub->child[1] = newNode(AST_CONSTANT, k, NULL);
+   add->child[0] = varRef(0);
+   add->child[1] = sub;
+   return add;
+}
+
+static ASTNode* assign(int k)
+{
+   ASTNode* node = newNode(AST_ASSIGNMENT, 0, internString("a"));
+   node->varKind = V_LOCAL;
+   node->child[0] = expr(k);
+   return node;
+}
+
+static ASTNode* cond(int k)
+{
+   ASTNode* node = newNode(AST_RELEXPR, '<', NULL);
+   node->child[0] = varRef(0);
+   node->child[1] = newNode(AST_CONSTANT, k, NULL);
+   return node;
+}
+
+static ASTNode* statement(int i)
+{
+   ASTNode* node;
+   switch (i % 4) {
+    case 0:
+       return assign(i);
+    case 1:
+       node = newNode(AST_WHILE, 0, NULL);
+       node->child[0] = cond(i);
+       node->child[1] = assign(i);
+       return node;
+    case 2:
+       node = newNode(AST_IFTHEN, 0, NULL);
+       node->child[0] = cond(i);
+       node->child[1] = assign(i);
+       node->child[2] = assign(-i);
+       return node;
+    default:
+       node = newNode(AST_FUNCALL, 0, internString("helper"));
+       node->child[0] = newNode(AST_ARGUMENT, 0, NULL);
+       node->child[0]->child[0] = expr(i);
+       node->child[0]->next = newNode(AST_ARGUMENT, 1, NULL);
+       node->child[0]->next->child[0] = varRef(1);
+       return node;
+   }
+}
+
+static ASTNode* buildProgram()
+{
+   char name[32];
+   ASTNode *prog, *func, **link, **stmt;
+   int f, i;
+   prog = newNode(AST_PROGRAM, 0, NULL);
+   link = &prog->child[1];
+   for (f=0; f < NUMFUNCS; f++) {
+      snprintf(name, sizeof(name), "func%d", f);
+      func = newNode(AST_FUNCTION, 0, internString(name));
+      func->child[1] = newNode(AST_VARDECL, 0, internString("a"));
+      func->child[1]->varKind = V_PARAM;
+      func->child[2] = newNode(AST_VARDECL, 1, internString("b"));
+      func->child[2]->varKind = V_LOCAL;
+      stmt = &func->child[0];
+      for (i=0; i < FUNCSTMTS; i++) {
+         *stmt = statement(i);
+         stmt = &(*stmt)->next;
+      }
+      *link = func;
+      link = &func->next;
+   }
+   prog->child[2] = statement(3);
+   return prog;
+}
+
+// Walk the pointer AST: every list, every child
+static long walkPointers(ASTNode* node, unsigned long* count)
+{
+   long sum = 0;
+   int k;
+   for (; node; node = node->next) {
+      sum += (int) node->type + node->ival;
+      (*count)++;
+      for (k=0; k < ASTNUMCHILDREN; k++)
+         if (node->child[k])
+            sum += walkPointers(node->child[k], count);
+   }
+   return sum;
+}
+
+typedef struct
+{
+   long sum;
+   unsigned long count;
+} WalkSum;
+
+// The pointer walk as a visitor: every child slot, in order
+static int sumVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   WalkSum* ws = (WalkSum*) arg;
+   (void) depth;
+   if (phase == 0) {
+      ws->sum += (int) node->type + node->ival;
+      ws->count++;
+   }
+   return phase < ASTNUMCHILDREN ? phase : VISITDONE;
+}
+
+// while (a < k) do { while ... } nested n deep
+static ASTNode* buildNest(int n)
+{
+   ASTNode *outer = NULL, *loop;
+   int i;
+   for (i=0; i < n; i++) {
+      loop = newNode(AST_WHILE, 0, NULL);
+      loop->child[0] = cond(i);
+      loop->child[1] = outer;
+      outer = loop;
+   }
+   return outer;
+}
+
+// Time the recursive and the visitor walk of tree
+static void compareWalks(const char* what, ASTNode* tree)
+{
+   char label[40];
+   WalkSum ws = {0, 0};
+   unsigned long n = 0;
+   long sum = 0;
+   double t;
+   int r;
+
+   t = now();
+   for (r=0; r < WALKREPS; r++)
+      sum += walkPointers(tree, &n);
+   snprintf(label, sizeof(label), "%s recursive", what);
+   report(label, n, now() - t);
+   t = now();
+   for (r=0; r < WALKREPS; r++)
+      visitAST(tree, 0, sumVisit, &ws);
+   snprintf(label, sizeof(label), "%s visitor", what);
+   report(label, ws.count, now() - t);
+   if (sum != ws.sum || n != ws.count)
+      printf("   ERROR: walks disagree (%ld/%lu, %ld/%lu)\n", sum, n, ws.sum, ws.count);
+}
+
+// The same walk over the flat AST, by child and sibling ids
+static long walkFlat(FlatAST* ast, NodeId id, unsigned long* count)
+{
+   long sum = 0;
+   int k;
+   for (; id != NONODE; id = flatNext(ast, id)) {
+      sum += (int) ast->type[id] + ast->ival[id];
+      (*count)++;
+      for (k=0; k < ASTNUMCHILDREN; k++)
+         if (ast->links[id] & LINKCHILD(k))
+            sum += walkFlat(ast, flatChild(ast, id, k), count);
+   }
+   return sum;
+}
+
+// Visit the flat AST in storage order, which is pre-order
+static long scanFlat(FlatAST* ast, unsigned long* count)
+{
+   long sum = 0;
+   uint32_t i;
+   for (i=0; i < ast->numNodes; i++)
+      sum += (int) ast->type[i] + ast->ival[i];
+   *count += ast->numNodes;
+   return sum;
+}
+
+int main(int argc, char** argv)
+{
+   const char* path = argc > 1 ? argv[1] : "/dev/null";
+   ASTNode *prog, *nest;
+   FlatAST* flat;
+   FILE* out;
+   unsigned long n1 = 0, n2 = 0, n3 = 0;
+   long s1 = 0, s2 = 0, s3 = 0, p1, p2;
+   double t, tbuild;
+   int r;
+
+   t = now();
+   prog = buildProgram();
+   tbuild = now() - t;
+   t = now();
+   flat = flattenAST(prog);
+   t = now() - t;
+   printf("%d statements in %d functions (built in %.1f ms, flattened in %.1f ms):\n",
+          NUMFUNCS*FUNCSTMTS, NUMFUNCS, tbuild*1e3, t*1e3);
+   printf("   pointer AST  %10u nodes %10zu bytes (%zu per node)\n", flat->numNodes,
+          flat->numNodes * sizeof(ASTNode), sizeof(ASTNode));
+   printf("   flat AST     %10u nodes %10zu bytes (%.1f per node, %u strings), %.2fx smaller\n",
+          flat->numNodes, flatASTBytes(flat), (double) flatASTBytes(flat) / flat->numNodes,
+          flat->numStrs, (double) (flat->numNodes * sizeof(ASTNode)) / flatASTBytes(flat));
+
+   t = now();
+   for (r=0; r < WALKREPS; r++)
+      s1 += walkPointers(prog, &n1);
+   report("pointer walk", n1, now() - t);
+   t = now();
+   for (r=0; r < WALKREPS; r++)
+      s2 += walkFlat(flat, 0, &n2);
+   report("flat tree walk", n2, now() - t);
+   t = now();
+   for (r=0; r < WALKREPS; r++)
+      s3 += scanFlat(flat, &n3);
+   report("flat scan", n3, now() - t);
+   if (s1 != s2 || s1 != s3 || n1 != n2 || n1 != n3)
+      printf("   ERROR: walks disagree (%ld/%lu, %ld/%lu, %ld/%lu)\n", s1, n1, s2, n2, s3, n3);
+
+   compareWalks("program", prog);
+   nest = buildNest(DEEPNEST);
+   compareWalks("nested", nest);
+
+   out = fopen(path, "w");
+   if (!out) {
+      fprintf(stderr, "astbench: cannot open %s\n", path);
+      return 1;
+   }
+   t = now();
+   printASTree(prog, 0, out);
+   fflush(out);
+   p1 = ftell(out);
+   report("printASTree", n1 / WALKREPS, now() - t);
+   rewind(out);
+   t = now();
+   printFlatAST(flat, 0, 0, out);
+   fflush(out);
+   p2 = ftell(out);
+   report("printFlatAST", n1 / WALKREPS, now() - t);
+   fclose(out);
+   if (p1 != p2)
+      printf("   ERROR: %ld bytes printed from the pointer AST, %ld from the flat AST\n", p1, p2);
+
+   freeFlatAST(flat);
+   freeAllASTNodes();
+   freeInternTable();
+   return 0;
+}
@@ -9,7 +9,9 @@
 #ifndef ASTREE_H
 #define ASTREE_H
 
+#include <stdio.h>     // for FILE in function prototypes
 #include "symtable.h"  // for DataType and VariableKind definition
+#include "output.h"    // for Output in genCodeFromASTree()
 
 // AST node types: basically we have a different type for every 
 // important program concept; these are ALMOST the same as our 
@@ -32,20 +34,25 @@ typedef enum {
 //                      type just uses the fields it needs to
 typedef struct astnode_s {
    ASTNodeType type; // type of this node
-   DataType valType; // type for any data or variable referenced by this node
-   VariableKind varKind; // if variable, kind (global, local, param, array)
+   unsigned char valType; // DataType of any data or variable referenced by this node
+   unsigned char varKind; // if variable, VariableKind (global, local, param, array)
+   unsigned char regNeed; // registers an expression needs, set by lowering (lower.c)
+   SymId sym;        // id of the variable or function named (see symtable.h)
    int ival;         // integer value if needed for this node type
-   char* strval;     // string value if needed for this node type
-   int strNeedsFreed; // tree freeing should also free the strval
+   char* strval;     // string value if needed (interned, see intern.h)
    struct astnode_s* next;  // pointer to next node in sibling sequence
    struct astnode_s* child[ASTNUMCHILDREN]; // pointers to children, if any
 } ASTNode;
 
 // Function Prototypes -- see C file for detailed descriptions
 ASTNode* newASTNode(ASTNodeType type);
-void freeASTree(ASTNode* tree);
+void freeAllASTNodes();
+void markASTNodes();
+void releaseASTNodes();
+void printASTStats(FILE *out);
 void printASTree(ASTNode* tree, int level, FILE *out);
-void genCodeFromASTree(ASTNode* tree, int count, FILE *out);
+int printASTNode(ASTNode* node, int phase, int level, FILE *out);
+void genCodeFromASTree(ASTNode* tree, Output *out);
 
 #endif
 
@@ -53,6 +60,10 @@ void genCodeFromASTree(ASTNode* tree, int count, FILE *out);
 //  - for anything that can be a sequence of things, the next field
 //    points to the next in its sequence (vardecls, funcdecls, statements,
 //    parameters, arguments)
+//  - every node that names a variable or function (vardecls, function
+//    defs, calls, assignments and varrefs) also has its symbol id in
+//    sym, bound by the parser; the phases after it use the id and
+//    keep strval only for printing
 //
 // AST_PROGRAM -- root node for whole program
 //                child[0] is global var decls
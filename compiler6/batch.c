@@ -0,0 +1,260 @@
+//
+// Parallel Batch Compilation
+// - see batch.h for the interface
+// - each worker queue is an array of job numbers with a head and a
+//   tail under its own mutex; the owner pops at the head (the large
+//   files) and thieves pop at the tail, so the two rarely contend
+// - no jobs are added once the workers start, so a worker that
+//   finds every queue empty is done
+//
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "input.h"
+#include "output.h"
+
+typedef struct
+{
+   char *path;
+   size_t size;    // file size, for the largest-first order
+   double ms;      // compile time
+   int stat;       // 0 if it compiled
+} BatchJob;
+
+typedef struct
+{
+   int *jobs;      // job numbers, largest file first
+   int head, tail; // jobs[head..tail-1] are left
+   pthread_mutex_t lock;
+} JobQueue;
+
+typedef struct
+{
+   BatchJob *jobs;
+   JobQueue *queues;
+   int numWorkers;
+   CompilerContext *opts;
+} BatchPool;
+
+typedef struct
+{
+   BatchPool *pool;
+   int self;       // this worker's queue
+   int numStolen;  // jobs taken from other queues
+} Worker;
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Read a manifest: one file name per line; blank lines and lines
+// starting with '#' are skipped
+// - returns 0, or -1 if the manifest cannot be read
+int readManifest(const char* path, char*** files, int* numFiles)
+{
+   char line[4096];
+   int len, max = 64;
+   FILE* f = fopen(path, "r");
+   if (!f)
+      return -1;
+   *files = (char**) malloc(max * sizeof(char*));
+   *numFiles = 0;
+   while (fgets(line, sizeof(line), f)) {
+      len = strlen(line);
+      while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' '))
+         line[--len] = '\0';
+      if (len == 0 || line[0] == '#')
+         continue;
+      if (*numFiles == max) {
+         max *= 2;
+         *files = (char**) realloc(*files, max * sizeof(char*));
+      }
+      (*files)[(*numFiles)++] = strdup(line);
+   }
+   fclose(f);
+   return 0;
+}
+
+// Compile one file into its .s file
+// - returns 0, or 1 if it could not be read, compiled or written
+static int compileFile(const char* path, CompilerContext* opts)
+{
+   CompilerContext ctx = *opts;
+   InputText in;
+   Output out;
+   FILE* f;
+   char outPath[4096];
+   size_t len = strlen(path);
+   int fd, stat;
+
+   if (len < 3 || strcmp(path + len - 2, ".j") != 0) {
+      fprintf(stderr, "Error: %s: input file must have a '.j' extension\n", path);
+      return 1;
+   }
+   if (mapInputFile(path, &in) < 0) {
+      f = fopen(path, "r");
+      if (!f || readInputFile(f, &in) < 0) {
+         fprintf(stderr, "Error: Unable to open input file '%s'\n", path);
+         if (f)
+            fclose(f);
+         return 1;
+      }
+      fclose(f);
+   }
+   snprintf(outPath, sizeof(outPath), "%.*s.s", (int)(len - 2), path);
+   fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0) {
+      fprintf(stderr, "Error: Unable to open output file '%s'\n", outPath);
+      freeInputText(&in);
+      return 1;
+   }
+   initOutput(&out, fd);
+   stat = compileInPlace(&ctx, in.data, in.size, &out) != 0;
+   if (flushOutput(&out) < 0) {
+      fprintf(stderr, "Error: Unable to write output file '%s'\n", outPath);
+      stat = 1;
+   }
+   freeOutput(&out);
+   close(fd);
+   freeInputText(&in);
+   return stat;
+}
+
+// Take the next job for worker self: its own largest, or else the
+// smallest left in another queue
+// - returns -1 when there is no work left anywhere
+static int nextJob(Worker* w)
+{
+   BatchPool* pool = w->pool;
+   int self = w->self;
+   JobQueue* q = &pool->queues[self];
+   int i, j = -1;
+   pthread_mutex_lock(&q->lock);
+   if (q->head < q->tail)
+      j = q->jobs[q->head++];
+   pthread_mutex_unlock(&q->lock);
+   for (i=1; j < 0 && i < pool->numWorkers; i++) {
+      q = &pool->queues[(self+i) % pool->numWorkers];
+      pthread_mutex_lock(&q->lock);
+      if (q->head < q->tail) {
+         j = q->jobs[--q->tail];
+         w->numStolen++;
+      }
+      pthread_mutex_unlock(&q->lock);
+   }
+   return j;
+}
+
+static void* runWorker(void* arg)
+{
+   Worker* w = (Worker*) arg;
+   BatchJob* job;
+   double t;
+   int j;
+   while ((j = nextJob(w)) >= 0) {
+      job = &w->pool->jobs[j];
+      t = now();
+      job->stat = compileFile(job->path, w->pool->opts);
+      job->ms = (now() - t) * 1e3;
+   }
+   return NULL;
+}
+
+// Order jobs by file size, largest first, then by input order
+static int bySizeDown(const void* a, const void* b)
+{
+   const BatchJob* ja = *(BatchJob* const*) a;
+   const BatchJob* jb = *(BatchJob* const*) b;
+   if (ja->size != jb->size)
+      return ja->size < jb->size ? 1 : -1;
+   return ja < jb ? -1 : ja > jb;
+}
+
+// Compile every file on numThreads workers, with the options in
+// opts; each file gets a copy of opts as its context
+// - returns the number of files that failed
+int compileBatch(char** files, int numFiles, int numThreads, CompilerContext* opts)
+{
+   BatchPool pool;
+   Worker* workers;
+   pthread_t* threads;
+   JobQueue* q;
+   struct stat st;
+   BatchJob** order;
+   int i, numFailed = 0, numStolen = 0;
+   double t, sumMs = 0;
+
+   if (numThreads < 1)
+      numThreads = 1;
+   if (numThreads > numFiles)
+      numThreads = numFiles > 0 ? numFiles : 1;
+   pool.jobs = (BatchJob*) calloc(numFiles+1, sizeof(BatchJob));
+   pool.queues = (JobQueue*) calloc(numThreads, sizeof(JobQueue));
+   pool.numWorkers = numThreads;
+   pool.opts = opts;
+   order = (BatchJob**) malloc((numFiles+1) * sizeof(BatchJob*));
+   for (i=0; i < numFiles; i++) {
+      pool.jobs[i].path = files[i];
+      pool.jobs[i].size = stat(files[i], &st) == 0 ? (size_t) st.st_size : 0;
+      order[i] = &pool.jobs[i];
+   }
+   qsort(order, numFiles, sizeof(BatchJob*), bySizeDown);
+
+   // deal the jobs out round robin, so every queue starts with
+   // some of the largest files
+   for (i=0; i < numThreads; i++) {
+      pool.queues[i].jobs = (int*) malloc((numFiles/numThreads + 1) * sizeof(int));
+      pthread_mutex_init(&pool.queues[i].lock, NULL);
+   }
+   for (i=0; i < numFiles; i++) {
+      q = &pool.queues[i % numThreads];
+      q->jobs[q->tail++] = order[i] - pool.jobs;
+   }
+
+   t = now();
+   workers = (Worker*) malloc(numThreads * sizeof(Worker));
+   threads = (pthread_t*) malloc(numThreads * sizeof(pthread_t));
+   for (i=0; i < numThreads; i++) {
+      workers[i].pool = &pool;
+      workers[i].self = i;
+      workers[i].numStolen = 0;
+   }
+   for (i=1; i < numThreads; i++)
+      pthread_create(&threads[i], NULL, runWorker, &workers[i]);
+   runWorker(&workers[0]);  // the main thread is worker 0
+   for (i=1; i < numThreads; i++)
+      pthread_join(threads[i], NULL);
+   t = now() - t;
+   for (i=0; i < numThreads; i++)
+      numStolen += workers[i].numStolen;
+
+   for (i=0; i < numFiles; i++) {
+      fprintf(stderr, "%9.2f ms %10lu bytes  %s%s\n", pool.jobs[i].ms,
+              (unsigned long) pool.jobs[i].size, pool.jobs[i].path,
+              pool.jobs[i].stat ? "  FAILED" : "");
+      sumMs += pool.jobs[i].ms;
+      numFailed += pool.jobs[i].stat;
+   }
+   fprintf(stderr, "batch: %d files (%d failed) in %.1f ms on %d threads, "
+           "%.1f ms of compiling (%.2fx), %d stolen\n", numFiles, numFailed,
+           t*1e3, numThreads, sumMs, t > 0 ? sumMs / (t*1e3) : 0.0, numStolen);
+
+   for (i=0; i < numThreads; i++) {
+      free(pool.queues[i].jobs);
+      pthread_mutex_destroy(&pool.queues[i].lock);
+   }
+   free(pool.queues);
+   free(pool.jobs);
+   free(order);
+   free(workers);
+   free(threads);
+   return numFailed;
+}
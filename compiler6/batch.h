@@ -0,0 +1,21 @@
+//
+// Parallel Batch Compilation Interface
+// - compiles many .j files in one process, each into its own .s,
+//   on a pool of worker threads (compileJ() is reentrant, see
+//   compiler.h)
+// - files are sorted largest first and dealt out round robin to
+//   per-worker queues; a worker takes the largest file left in its
+//   own queue, and when that is empty steals the smallest one left
+//   in another worker's queue
+// - the time of every file and a summary line are printed to
+//   stderr at the end, in input order
+//
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "compiler.h"
+
+int readManifest(const char *path, char ***files, int *numFiles);
+int compileBatch(char **files, int numFiles, int numThreads, CompilerContext *opts);
+
+#endif
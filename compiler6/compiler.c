@@ -0,0 +1,155 @@
+//
+// Compiler Driver
+// - see compiler.h for the interface
+// - the phases, in order: parse, inline (-O2), fold and find the
+//   live code (-O1), then emit the string pool and generate code
+// - when streaming, the functions are done during the parse (see
+//   the functions rule in parser.y), and after it only the program
+//   block is folded
+// - with a cache directory, function code is looked up in it and
+//   stored there (see fcache.h); the program block is always
+//   generated
+//
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+#include "astree.h"
+#include "intern.h"
+#include "passes.h"
+#include "fold.h"
+#include "peephole.h"
+#include "inline.h"
+#include "deadcode.h"
+#include "strpool.h"
+#include "trace.h"
+#include "funcgen.h"
+#include "fcache.h"
+
+THREADLOCAL int optLevel = 0;
+THREADLOCAL int debug = 0;
+THREADLOCAL int codegenThreads = 1;
+THREADLOCAL SymbolTable* symbols = NULL;
+
+// Set the default options and clear the parser state
+void initCompilerContext(CompilerContext* ctx)
+{
+   memset(ctx, 0, sizeof(*ctx));
+   ctx->inlineLimit = DEFAULTINLINELIMIT;
+   ctx->codegenThreads = 1;
+}
+
+// Give the library functions their ids (see compiler.h)
+static void declareLibrary(SymbolTable* table)
+{
+   functionId(table, internString("printStr"));
+   functionId(table, internString("printInt"));
+   functionId(table, internString("readInt"));
+}
+
+// Print the statistics of every phase
+static void printStats(FILE* out)
+{
+   fprintf(out, "symbols: %d ids, %u functions, %lu name lookups\n",
+           symbols->numIds-1, symbols->numFuncs, symbols->numLookups);
+   printASTStats(out);
+   printInternStats(out);
+   printInlineStats(out);
+   printFoldStats(out);
+   printDeadCodeStats(out);
+   printStringPoolStats(out);
+   printPassStats(out);
+   printLoopStats(out);
+   printPeepholeStats(out);
+   printFuncCacheStats(out);
+   dumpTrace(out);  // token events, in a -DSCANTRACE build
+}
+
+// Compile text that is in memory, or the file in if it is not NULL
+// - see parseText() for inPlace
+static int compileText(CompilerContext* ctx, char* text, size_t len, int inPlace,
+                       FILE* in, Output* out)
+{
+   int stat;
+
+   optLevel = ctx->optLevel;
+   debug = ctx->debug;
+   inlineLimit = ctx->inlineLimit;
+   codegenThreads = ctx->codegenThreads;
+   initFuncCache(ctx->cacheDir);
+   resetTrace();  // the events of earlier compiles on this thread
+   ctx->table = newSymbolTable();
+   symbols = ctx->table;
+   declareLibrary(ctx->table);
+   ctx->astRoot = NULL;
+   ctx->argCount = ctx->paramNum = 0;
+   ctx->tokenEnd = 0;
+   ctx->lastFunc = NULL;
+   ctx->streamOut = ctx->streaming && !ctx->printAST ? out : NULL;
+   if (ctx->streamOut) {
+      registerDefaultPasses();
+      emitStr(out, "\t.text\n\tj\tprogram\n");  // the program block comes last
+   }
+
+   stat = in ? parseFile(ctx, in) : parseText(ctx, text, len, inPlace);
+   if (stat == 0 && ctx->astRoot) {
+      if (ctx->printAST)
+         printASTree(ctx->astRoot, 0, stdout);
+      else if (out) {
+         if (ctx->streamOut) {
+            if (optLevel > 0)
+               foldConstants(ctx->astRoot);  // the functions are done already
+         } else {
+            if (optLevel > 1)
+               inlineFunctions(ctx->astRoot);
+            if (optLevel > 0) {
+               foldConstants(ctx->astRoot);
+               findLiveCode(ctx->astRoot, numPoolStrings());
+            }
+         }
+         emitStr(out, "\n\t.data\n");
+         emitStringPool(out, optLevel > 0);
+         genCodeFromASTree(ctx->astRoot, out);
+      }
+   }
+
+   if (debug)
+      printStats(stderr);
+   else
+      printFuncCacheStats(stderr);  // nothing without a cache
+   freeAllSymbols(ctx->table);
+   free(ctx->table);
+   ctx->table = symbols = NULL;
+   freeStringPool();
+   freeLiveCode();
+   freeAllASTNodes(); // releases whole AST arena, no tree walk
+   ctx->astRoot = ctx->lastFunc = NULL;
+   ctx->streamOut = NULL;
+   freeInternTable();
+   return stat;
+}
+
+// Compile len bytes of J source into out
+// - src is not changed and need not be NUL terminated; the scanner
+//   works on a copy of it
+// - if out is NULL the source is only parsed (and, with printAST,
+//   its AST printed)
+// - returns 0 on success, nonzero if the source had errors
+int compileJ(CompilerContext* ctx, const char* src, size_t len, Output* out)
+{
+   return compileText(ctx, (char*) src, len, 0, NULL, out);
+}
+
+// Like compileJ(), but the scanner works on text in place
+// - text must be writable and followed by two NUL bytes (see
+//   input.h); it is changed while it is scanned
+int compileInPlace(CompilerContext* ctx, char* text, size_t len, Output* out)
+{
+   return compileText(ctx, text, len, 1, NULL, out);
+}
+
+// Like compileJ(), but the source is read from a file as it is
+// scanned, a buffer at a time, instead of being in memory
+int compileStream(CompilerContext* ctx, FILE* in, Output* out)
+{
+   return compileText(ctx, NULL, 0, 0, in, out);
+}
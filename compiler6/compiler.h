@@ -0,0 +1,78 @@
+//
+// Compiler Interface
+// - compileJ() runs the whole compiler, parse to assembly, on one
+//   J source held in memory, so it can be used as a library
+// - the parser and scanner state of a compilation lives in its
+//   CompilerContext; the parser is a pure bison parser and the
+//   scanner a reentrant flex scanner, both handed the context
+// - the later phases keep their working state in module variables,
+//   as they always have, but those are THREADLOCAL: a compilation
+//   runs start to finish on the thread that called compileJ(), and
+//   everything it leaves behind is released before it returns, so
+//   any number of threads can compile at the same time
+// - with streaming set, each function is lowered, emitted, and its
+//   AST freed as soon as the parser reduces it, so only the globals,
+//   the string pool, and the program block are held until the end;
+//   the functions then come first in the output, behind a jump to
+//   the program, and there is no inlining or dead function removal
+//   (that needs the whole program); compileStream() reads its input
+//   through a small buffer, so memory does not grow with the input
+//
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stddef.h>
+#include "symtable.h"
+#include "output.h"
+
+#define THREADLOCAL _Thread_local
+
+struct astnode_s;
+
+typedef struct
+{
+   // options, set between initCompilerContext() and compileJ()
+   int optLevel;          // -O0, -O1, or -O2
+   int debug;             // -t: trace parser rules and IR, print stats
+   int inlineLimit;       // -finline-limit=N
+   int printAST;          // -d: print the AST instead of generating code
+   int codegenThreads;    // -fcodegen-threads=N: functions generated in parallel
+   int streaming;         // -fstream: generate each function as it is parsed
+   const char *cacheDir;  // -fcache-dir=DIR: reuse function code from DIR, or NULL
+   // parser and scanner state
+   SymbolTable *table;
+   struct astnode_s *astRoot;
+   int argCount;          // arguments seen in the current call
+   int paramNum;          // params and locals seen in the current function
+   unsigned int tokenEnd; // input offset after the last token (SCANTRACE)
+   struct astnode_s *lastFunc; // tail of the function list
+   SymId idMark;          // first id of the function being streamed
+   Output *streamOut;     // where streamed functions go, NULL if not streaming
+} CompilerContext;
+
+// the options of the compilation running on this thread, for the
+// phases that are not handed the context
+extern THREADLOCAL int optLevel;
+extern THREADLOCAL int debug;
+extern THREADLOCAL int codegenThreads;
+extern THREADLOCAL SymbolTable *symbols;  // ids of AST and IR symbols, see symtable.h
+
+// the library functions are the first functions in every symbol
+// table, so their ids are fixed
+#define LIBPRINTSTR 1
+#define LIBPRINTINT 2
+#define LIBREADINT  3
+
+#define MAXARGS 8  // params and args are passed in a0-a7 only
+
+void initCompilerContext(CompilerContext *ctx);
+int compileJ(CompilerContext *ctx, const char *src, size_t len, Output *out);
+int compileInPlace(CompilerContext *ctx, char *text, size_t len, Output *out);
+int compileStream(CompilerContext *ctx, FILE *in, Output *out);
+
+// in scanner.l: scan text or a file with a scanner of its own and
+// parse it
+int parseText(CompilerContext *ctx, char *text, size_t len, int inPlace);
+int parseFile(CompilerContext *ctx, FILE *in);
+
+#endif
@@ -0,0 +1,292 @@
+//
+// Value Numbering / Common Subexpression Elimination
+// - walks the dominator tree in preorder with a scoped hash table
+//   of the expressions computed so far; an instruction that
+//   recomputes an available expression is deleted (its temp is
+//   renamed to the earlier result) or becomes a mov
+// - the IR is not in SSA form, so an expression is only carried
+//   into dominated blocks when its operands and result are vregs
+//   that are assigned exactly once (temps, and params that are
+//   never assigned); anything involving other params/locals is
+//   only reused inside its own block, and is forgotten as soon as
+//   one of its vregs is written
+// - loads are also only reused inside a block, and every store or
+//   call forgets them; a store makes its value available to a
+//   later load of the same location
+// - this is what removes the repeated slli/la/add of array
+//   address computations and the reloading of globals
+//
+#include <stdlib.h>
+#include <string.h>
+#include "passes.h"
+#include "compiler.h"
+
+#define CSEHASHSIZE 256  // power of two
+
+typedef struct
+{
+   IROp op;
+   int src1, src2, imm;
+   SymId sym;
+   int result;   // vreg holding the value
+   int local;    // only valid in the block that added it
+   int valid;    // cleared when a write or a store kills it
+   int prev;     // previous entry in the same hash bucket, or -1
+   unsigned int bucket;
+} CSEEntry;
+
+// pass state for the function being processed
+static THREADLOCAL CSEEntry* entries;
+static THREADLOCAL int numEntries, maxEntries;
+static THREADLOCAL int buckets[CSEHASHSIZE];
+static THREADLOCAL int* repl;       // temp renamed to an earlier equal value
+static THREADLOCAL int* defCount;   // number of instructions writing each vreg
+static THREADLOCAL IRFunc* curFunc;
+static THREADLOCAL int changes;
+
+// True if v always holds the same value wherever it is read
+static int isStable(int v)
+{
+   if (v == NOVREG || v == ZEROVREG)
+      return 1;
+   if (v < curFunc->numParams)
+      return defCount[v] == 0;
+   return v >= curFunc->numVars && defCount[v] == 1;
+}
+
+static int isLoad(IROp op)
+{
+   return op == IR_LOAD || op == IR_LOADG;
+}
+
+// True for constants that are not worth keeping in a register
+// from one block to another
+static int isCheap(IROp op)
+{
+   return op == IR_LI || op == IR_LASTR;
+}
+
+// True for the instructions whose results are numbered
+static int isNumbered(IROp op)
+{
+   switch (op) {
+    case IR_LI: case IR_LA: case IR_LASTR: case IR_ADD: case IR_SUB:
+    case IR_ADDI: case IR_SLLI: case IR_LOADG: case IR_LOAD:
+       return 1;
+    default:
+       return 0;
+   }
+}
+
+static unsigned int hashKey(IROp op, int src1, int src2, int imm, SymId sym)
+{
+   unsigned long h = (unsigned long) op;
+   h = h*31 + (unsigned int) src1;
+   h = h*31 + (unsigned int) src2;
+   h = h*31 + (unsigned int) imm;
+   h = h*31 + (unsigned int) sym;
+   return (unsigned int) (h ^ (h >> 16)) & (CSEHASHSIZE-1);
+}
+
+// Find a valid entry for an expression, or -1
+static int lookupExpr(IROp op, int src1, int src2, int imm, SymId sym)
+{
+   int e = buckets[hashKey(op, src1, src2, imm, sym)];
+   for (; e >= 0; e = entries[e].prev)
+      if (entries[e].valid && entries[e].op == op && entries[e].src1 == src1 &&
+          entries[e].src2 == src2 && entries[e].imm == imm && entries[e].sym == sym)
+         return e;
+   return -1;
+}
+
+static void addExpr(IROp op, int src1, int src2, int imm, SymId sym,
+                    int result, int local)
+{
+   CSEEntry* e;
+   if (numEntries == maxEntries) {
+      maxEntries *= 2;
+      entries = (CSEEntry*) realloc(entries, maxEntries*sizeof(CSEEntry));
+   }
+   e = &entries[numEntries];
+   e->op = op; e->src1 = src1; e->src2 = src2; e->imm = imm; e->sym = sym;
+   e->result = result;
+   e->local = local;
+   e->valid = 1;
+   e->bucket = hashKey(op, src1, src2, imm, sym);
+   e->prev = buckets[e->bucket];
+   buckets[e->bucket] = numEntries++;
+}
+
+// Forget the entries added since mark (leaving a dominator subtree)
+static void popEntries(int mark)
+{
+   while (numEntries > mark) {
+      numEntries--;
+      buckets[entries[numEntries].bucket] = entries[numEntries].prev;
+   }
+}
+
+// Forget entries since mark that read or hold vreg v, or that are
+// loads if v is NOVREG (after a store or call)
+static void killEntries(int mark, int v)
+{
+   int e;
+   for (e=mark; e < numEntries; e++) {
+      if (v == NOVREG ? isLoad(entries[e].op) :
+          (entries[e].src1 == v || entries[e].src2 == v || entries[e].result == v))
+         entries[e].valid = 0;
+   }
+}
+
+static int renamed(int v)
+{
+   while (v >= 0 && repl[v] != NOVREG)
+      v = repl[v];
+   return v;
+}
+
+// Number the instructions of one block
+// - mark is where this block's entries start
+static void numberBlock(IRBlock* b, int mark)
+{
+   int j, e, a, c, local;
+   IRInstr* ins;
+
+   for (j=0; j < b->numInstrs; j++) {
+      ins = &b->instrs[j];
+      ins->src1 = renamed(ins->src1);
+      ins->src2 = renamed(ins->src2);
+      if (ins->op == IR_STORE || ins->op == IR_STOREG || ins->op == IR_CALL) {
+         killEntries(mark, NOVREG);
+         // a later load of the stored location gets the stored value
+         if (ins->op == IR_STOREG)
+            addExpr(IR_LOADG, NOVREG, NOVREG, 0, ins->sym, ins->src1, 1);
+         else if (ins->op == IR_STORE)
+            addExpr(IR_LOAD, ins->src2, NOVREG, ins->imm, NOSYMID, ins->src1, 1);
+         continue;
+      }
+      if (!isNumbered(ins->op)) {
+         if (ins->dst >= 0)
+            killEntries(mark, ins->dst);
+         continue;
+      }
+      a = ins->src1;
+      c = ins->src2;
+      if (ins->op == IR_ADD && a > c) {  // commutative: one order only
+         a = ins->src2;
+         c = ins->src1;
+      }
+      e = lookupExpr(ins->op, a, c, ins->imm, ins->sym);
+      if (e >= 0 && entries[e].result == ins->dst) {
+         removeIR(b, j--);  // recomputes the value dst already holds
+         changes++;
+         continue;
+      }
+      if (e >= 0 && ins->dst >= curFunc->numVars && defCount[ins->dst] == 1 &&
+          isStable(entries[e].result)) {
+         // single-assigned temp: read the earlier value instead
+         repl[ins->dst] = entries[e].result;
+         removeIR(b, j--);
+         changes++;
+         continue;
+      }
+      if (e >= 0 && !isCheap(ins->op)) {
+         // dst is a variable (or reassigned temp): copy the value
+         ins->op = IR_MOV;
+         ins->src1 = entries[e].result;
+         ins->src2 = NOVREG;
+         ins->sym = NOSYMID;
+         killEntries(mark, ins->dst);
+         changes++;
+         continue;
+      }
+      killEntries(mark, ins->dst);
+      local = isLoad(ins->op) || isCheap(ins->op) || !isStable(a) || !isStable(c) ||
+              !isStable(ins->dst);
+      // "v = v + 1" does not compute v's new value from the old
+      if (ins->dst != a && ins->dst != c)
+         addExpr(ins->op, a, c, ins->imm, ins->sym, ins->dst, local);
+   }
+   // block-local entries are not visible in dominated blocks
+   for (e=mark; e < numEntries; e++)
+      if (entries[e].local)
+         entries[e].valid = 0;
+}
+
+// Dominator-based value numbering pass
+// - returns the number of instructions removed or turned into movs
+int valueNumbering(IRFunc* func)
+{
+   int i, j, v, sp, numBlocks = func->numBlocks;
+   int *firstChild, *nextSibling, *stack, *marks;
+   IRBlock *b;
+
+   curFunc = func;
+   changes = 0;
+   buildCFG(func);
+   computeDominators(func);
+   repl = (int*) malloc((func->numVRegs+1)*sizeof(int));
+   defCount = (int*) calloc(func->numVRegs+1, sizeof(int));
+   for (v=0; v < func->numVRegs; v++)
+      repl[v] = NOVREG;
+   for (i=0; i < numBlocks; i++)
+      for (j=0; j < func->blocks[i]->numInstrs; j++)
+         if (func->blocks[i]->instrs[j].dst >= 0)
+            defCount[func->blocks[i]->instrs[j].dst]++;
+
+   // dominator tree as child/sibling lists
+   firstChild = (int*) malloc(numBlocks*sizeof(int));
+   nextSibling = (int*) malloc(numBlocks*sizeof(int));
+   stack = (int*) malloc(numBlocks*sizeof(int));
+   marks = (int*) malloc(numBlocks*sizeof(int));
+   for (i=0; i < numBlocks; i++)
+      firstChild[i] = nextSibling[i] = -1;
+   for (i=numBlocks-1; i > 0; i--) {
+      b = func->blocks[i];
+      if (b->idom && b->idom != b) {
+         nextSibling[i] = firstChild[b->idom->id];
+         firstChild[b->idom->id] = i;
+      }
+   }
+
+   maxEntries = 64;
+   entries = (CSEEntry*) malloc(maxEntries*sizeof(CSEEntry));
+   numEntries = 0;
+   for (i=0; i < CSEHASHSIZE; i++)
+      buckets[i] = -1;
+
+   // preorder walk; a block's entries stay until its subtree is done
+   sp = 0;
+   stack[sp++] = 0;
+   marks[0] = 0;
+   numberBlock(func->blocks[0], 0);
+   while (sp > 0) {
+      i = stack[sp-1];
+      if (firstChild[i] < 0) {
+         popEntries(marks[i]);
+         sp--;
+         continue;
+      }
+      j = firstChild[i];
+      firstChild[i] = nextSibling[j];  // consume the child
+      marks[j] = numEntries;
+      numberBlock(func->blocks[j], numEntries);
+      stack[sp++] = j;
+   }
+
+   // rename any use left in a block outside the walk
+   for (i=0; i < numBlocks; i++)
+      for (j=0; j < func->blocks[i]->numInstrs; j++) {
+         func->blocks[i]->instrs[j].src1 = renamed(func->blocks[i]->instrs[j].src1);
+         func->blocks[i]->instrs[j].src2 = renamed(func->blocks[i]->instrs[j].src2);
+      }
+   free(entries);
+   free(repl);
+   free(defCount);
+   free(firstChild);
+   free(nextSibling);
+   free(stack);
+   free(marks);
+   entries = NULL;
+   return changes;
+}
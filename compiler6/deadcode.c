@@ -0,0 +1,175 @@
+//
+// Dead Code and Data Elimination
+// - see deadcode.h for the interface
+// - the walk starts at the program block; every call to a function
+//   that is not live yet makes it live and queues its body, so each
+//   reachable body is walked once
+// - functions, library functions and globals all have symbol ids
+//   (see symtable.h), so the live set is a byte per id, and a
+//   called function's body is found through an array by id
+// - the program is walked with the visitor (see visit.h), so deep
+//   nesting does not use C stack
+// - run after inlining and folding, so calls and strings in folded
+//   away branches or inlined-only functions are not counted
+// - a string assigned to a param or local that is never read (an
+//   unused param of an inlined call, say) is not counted either:
+//   the deadstores pass removes every write to such a var, so the
+//   string is not referenced by the code
+//
+#include <stdlib.h>
+#include "deadcode.h"
+#include "compiler.h"
+#include "visit.h"
+
+static THREADLOCAL char* live = NULL;          // by symbol id
+static THREADLOCAL char* readVars = NULL;      // params and locals read, by id
+static THREADLOCAL int numLiveIds = 0;
+static THREADLOCAL ASTNode** funcById = NULL;  // function defs, during the walk
+static THREADLOCAL char* liveStrings = NULL;
+static THREADLOCAL int numLiveStrings = 0;
+static THREADLOCAL int analyzed = 0;
+
+static THREADLOCAL int numDeadFuncs = 0, numDeadGlobals = 0, numDeadStrings = 0;
+
+// Mark the params and locals that are read anywhere
+static int readVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   (void) depth;
+   (void) arg;
+   if (phase == 0 && node->type == AST_VARREF &&
+       (node->varKind == V_PARAM || node->varKind == V_LOCAL) && node->sym < numLiveIds)
+      readVars[node->sym] = 1;
+   return phase < ASTNUMCHILDREN ? phase : VISITDONE;
+}
+
+typedef struct
+{
+   ASTNode **work;       // live function bodies still to be walked
+   int numWork;
+   int deadDepth;        // depth of the dead store being walked, or -1
+} MarkState;
+
+// Mark everything a node refers to
+// - callees that become live are pushed on the work list
+// - in the value of a dead store strings are not marked; its
+//   value is an expression, so there are no calls in it
+static int markVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   MarkState* ms = (MarkState*) arg;
+   if (phase > 0)
+      return phase < ASTNUMCHILDREN ? phase : VISITDONE;
+   if (depth <= ms->deadDepth)
+      ms->deadDepth = -1;  // past the dead store
+   switch (node->type) {
+    case AST_FUNCALL:
+       if (!live[node->sym]) {
+          live[node->sym] = 1;
+          if (funcById[node->sym])  // not a library function
+             ms->work[ms->numWork++] = funcById[node->sym];
+       }
+       break;
+    case AST_ASSIGNMENT:
+       if ((node->varKind == V_PARAM || node->varKind == V_LOCAL) &&
+           node->sym < numLiveIds && !readVars[node->sym])
+          ms->deadDepth = depth;
+       // fall through
+    case AST_VARREF:
+       if (node->varKind == V_GLOBAL || node->varKind == V_GLARRAY)
+          live[node->sym] = 1;
+       break;
+    case AST_CONSTANT:
+       if (node->valType == T_STRING && node->ival >= 0 && node->ival < numLiveStrings &&
+           ms->deadDepth < 0)
+          liveStrings[node->ival] = 1;
+       break;
+    default:
+       break;
+   }
+   return 0;
+}
+
+// Find the live functions, globals and strings of a program
+// - numStrings is the number of string constants (.SC labels)
+void findLiveCode(ASTNode* program, int numStrings)
+{
+   ASTNode *f, *decl;
+   MarkState ms;
+   int i, numFuncs = 0;
+
+   if (!program)
+      return;
+   free(liveStrings);
+   free(live);
+   numLiveStrings = numStrings;
+   liveStrings = (char*) calloc(numStrings+1, 1);
+   numLiveIds = symbols->numIds;
+   live = (char*) calloc(numLiveIds, 1);
+   funcById = (ASTNode**) calloc(numLiveIds, sizeof(ASTNode*));
+   for (f = program->child[1]; f; f = f->next) {  // child 1 is functions
+      funcById[f->sym] = f;
+      numFuncs++;
+   }
+   ms.work = (ASTNode**) malloc((numFuncs+1)*sizeof(ASTNode*));
+   ms.numWork = 0;
+   ms.deadDepth = -1;
+   readVars = (char*) calloc(numLiveIds, 1);
+   visitAST(program, 0, readVisit, NULL);
+
+   visitAST(program->child[2], 0, markVisit, &ms); // child 2 is program
+   while (ms.numWork > 0) {
+      f = ms.work[--ms.numWork];
+      visitAST(f->child[0], 0, markVisit, &ms);  // child 0 is statements
+   }
+   free(ms.work);
+   free(funcById);
+   free(readVars);
+   funcById = NULL;
+   readVars = NULL;
+   analyzed = 1;
+
+   for (f = program->child[1]; f; f = f->next)
+      if (!live[f->sym])
+         numDeadFuncs++;
+   for (decl = program->child[0]; decl; decl = decl->next)  // child 0 is globals
+      if (!live[decl->sym])
+         numDeadGlobals++;
+   for (i=0; i < numStrings; i++)
+      if (!liveStrings[i])
+         numDeadStrings++;
+}
+
+// True if a function (user or library) is called from live code
+int isLiveFunction(SymId sym)
+{
+   return !analyzed || sym >= numLiveIds || live[sym];
+}
+
+// True if a global var or array is used by live code
+int isLiveGlobal(SymId sym)
+{
+   return !analyzed || sym >= numLiveIds || live[sym];
+}
+
+// True if string constant number num is used by live code
+int isLiveString(int num)
+{
+   return !analyzed || num >= numLiveStrings || liveStrings[num];
+}
+
+// Forget the analysis; everything counts as live again
+void freeLiveCode()
+{
+   free(live);
+   free(liveStrings);
+   live = NULL;
+   liveStrings = NULL;
+   numLiveIds = 0;
+   numLiveStrings = 0;
+   analyzed = 0;
+}
+
+void printDeadCodeStats(FILE *out)
+{
+   fprintf(out, "deadcode: %d functions, %d globals, %d strings removed\n",
+           numDeadFuncs, numDeadGlobals, numDeadStrings);
+}
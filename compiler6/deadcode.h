@@ -0,0 +1,23 @@
+//
+// Dead Code and Data Elimination Interface
+// - finds what the program can reach: the functions called from
+//   the program block (and from those functions, and so on), and
+//   the globals, string constants and library functions that the
+//   reachable code refers to
+// - code generation asks it what to emit; before findLiveCode()
+//   runs (at -O0) everything counts as live
+//
+#ifndef DEADCODE_H
+#define DEADCODE_H
+
+#include <stdio.h>
+#include "astree.h"
+
+void findLiveCode(ASTNode *program, int numStrings);
+int isLiveFunction(SymId sym);
+int isLiveGlobal(SymId sym);
+int isLiveString(int num);
+void freeLiveCode();
+void printDeadCodeStats(FILE *out);
+
+#endif
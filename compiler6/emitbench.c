@@ -0,0 +1,215 @@
+//
+// Assembly emitter benchmark
+// - times printing a synthetic 1M-statement program two ways: the
+//   old way, one fprintf() per instruction, and printMBuffer() into
+//   an Output buffer; build with "make emitbench"
+// - the program is NUMFUNCS functions of FUNCSTMTS statements each,
+//   every function is one machine code buffer as in the backend;
+//   the statements cycle through local arithmetic, calls, global
+//   loads/stores and loop tests
+// - both ways write to /dev/null (or to the file given as the
+//   first argument), so the time is formatting plus the writes
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "peephole.h"
+#include "regalloc.h"
+#include "output.h"
+#include "compiler.h"
+
+// normally set by the compiler driver (compiler.c), not linked here
+THREADLOCAL SymbolTable* symbols = NULL;
+
+#define NUMFUNCS 1000
+#define FUNCSTMTS 1000
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char* what, unsigned long bytes, double secs)
+{
+   printf("   %-12s %10lu bytes %8.1f ms %8.1f MB/s\n", what, bytes,
+          secs*1e3, bytes / secs / 1e6);
+}
+
+// Fill a buffer with one function of FUNCSTMTS statements
+static void buildFunc(MBuffer* buf, int f)
+{
+   int i;
+   buf->func = "func";
+   emitM(buf, M_LABEL, -1, -1, -1, 0)->sym = buf->func;
+   emitM(buf, M_ADDI, REG_SP, REG_SP, -1, -32);
+   emitM(buf, M_SW, -1, REG_RA, REG_SP, 0);
+   for (i=0; i < FUNCSTMTS; i++) {
+      switch (i % 4) {
+       case 0:  // x = x + k, x spilled
+          emitM(buf, M_LW, REG_T5, REG_FP, -1, 8 + 4*(i%5));
+          emitM(buf, M_ADDI, REG_T5, REG_T5, -1, i - 500);
+          emitM(buf, M_SW, -1, REG_T5, REG_FP, 8 + 4*(i%5));
+          break;
+       case 1:  // printInt(x)
+          emitM(buf, M_MV, REG_A0, 9, -1, 0);
+          emitM(buf, M_JAL, -1, -1, -1, 0)->sym = "printInt";
+          break;
+       case 2:  // g = g + y
+          emitM(buf, M_LWG, 5, -1, -1, 0)->sym = "g";
+          emitM(buf, M_ADD, 6, 5, 18, 0);
+          emitM(buf, M_SWG, -1, 6, -1, 0)->sym = "g";
+          break;
+       case 3:  // while (i < n)
+          emitM(buf, M_LABEL, -1, -1, -1, 0)->label = 100 + f*FUNCSTMTS + i;
+          emitM(buf, M_LI, 7, -1, -1, 100000 + i);
+          emitM(buf, M_BGE, -1, 7, 19, 0)->label = 100 + f*FUNCSTMTS + i;
+          break;
+      }
+   }
+   emitM(buf, M_LW, REG_RA, REG_SP, -1, 0);
+   emitM(buf, M_ADDI, REG_SP, REG_SP, -1, 32);
+   emitM(buf, M_RET, -1, -1, -1, 0);
+}
+
+static const char* branchNames[] = { "beq", "bne", "blt", "bgt", "bge", "ble" };
+
+// The old printMBuffer(), one fprintf() per instruction
+// - returns the number of bytes printed
+static unsigned long fprintfMBuffer(MBuffer* buf, FILE* out)
+{
+   int i;
+   unsigned long n = 0;
+   MInstr* m;
+   for (i=0; i < buf->numInstrs; i++) {
+      m = &buf->instrs[i];
+      switch (m->op) {
+       case M_LABEL:
+          if (m->sym)
+             n += fprintf(out, "\n%s:\n", m->sym);
+          else
+             n += fprintf(out, "\n.L%s_%d:\n", buf->func, m->label);
+          break;
+       case M_COMMENT:
+          n += fprintf(out, "# %s\n", m->sym);
+          break;
+       case M_LI:
+          n += fprintf(out, "\tli\t%s, %d\n", regName(m->rd), m->imm);
+          break;
+       case M_LA:
+          n += fprintf(out, "\tla\t%s, %s\n", regName(m->rd), m->sym);
+          break;
+       case M_LASTR:
+          n += fprintf(out, "\tla\t%s, .SC%d\n", regName(m->rd), m->imm);
+          break;
+       case M_MV:
+          n += fprintf(out, "\tmv\t%s, %s\n", regName(m->rd), regName(m->rs1));
+          break;
+       case M_ADD:
+       case M_SUB:
+          n += fprintf(out, "\t%s\t%s, %s, %s\n", m->op == M_ADD ? "add" : "sub",
+                       regName(m->rd), regName(m->rs1), regName(m->rs2));
+          break;
+       case M_ADDI:
+       case M_SLLI:
+          n += fprintf(out, "\t%s\t%s, %s, %d\n", m->op == M_ADDI ? "addi" : "slli",
+                       regName(m->rd), regName(m->rs1), m->imm);
+          break;
+       case M_LW:
+          n += fprintf(out, "\tlw\t%s, %d(%s)\n", regName(m->rd), m->imm, regName(m->rs1));
+          break;
+       case M_SW:
+          n += fprintf(out, "\tsw\t%s, %d(%s)\n", regName(m->rs1), m->imm, regName(m->rs2));
+          break;
+       case M_LWG:
+          n += fprintf(out, "\tlw\t%s, %s\n", regName(m->rd), m->sym);
+          break;
+       case M_SWG:
+          n += fprintf(out, "\tsw\t%s, %s, t6\n", regName(m->rs1), m->sym);
+          break;
+       case M_BEQ: case M_BNE: case M_BLT: case M_BGT: case M_BGE: case M_BLE:
+          n += fprintf(out, "\t%s\t%s, %s, .L%s_%d\n", branchNames[m->op-M_BEQ],
+                       regName(m->rs1), regName(m->rs2), buf->func, m->label);
+          break;
+       case M_B:
+          n += fprintf(out, "\tb\t.L%s_%d\n", buf->func, m->label);
+          break;
+       case M_JAL:
+          n += fprintf(out, "\tjal\t%s\n", m->sym);
+          break;
+       case M_TAIL:
+          n += fprintf(out, "\ttail\t%s\n", m->sym);
+          break;
+       case M_RET:
+          n += fprintf(out, "\tret\n");
+          break;
+       case M_ECALL:
+          n += fprintf(out, "\tecall\n");
+          break;
+       case M_DELETED:
+          break;
+      }
+   }
+   return n;
+}
+
+int main(int argc, char** argv)
+{
+   int f, fd;
+   const char* path = argc > 1 ? argv[1] : "/dev/null";
+   unsigned long n = 0;
+   double t, tbuild = 0, tfprintf = 0, toutput = 0;
+   MBuffer* bufs = (MBuffer*) malloc(NUMFUNCS * sizeof(MBuffer));
+   FILE* file;
+   Output out;
+
+   // build the code outside of the timed sections
+   t = now();
+   for (f=0; f < NUMFUNCS; f++) {
+      initMBuffer(&bufs[f]);
+      buildFunc(&bufs[f], f);
+   }
+   tbuild = now() - t;
+   printf("%d statements in %d functions (built in %.1f ms):\n",
+          NUMFUNCS*FUNCSTMTS, NUMFUNCS, tbuild*1e3);
+
+   file = fopen(path, "w");
+   if (!file) {
+      fprintf(stderr, "emitbench: cannot open %s\n", path);
+      return 1;
+   }
+   t = now();
+   for (f=0; f < NUMFUNCS; f++)
+      n += fprintfMBuffer(&bufs[f], file);
+   fclose(file);
+   tfprintf = now() - t;
+   report("fprintf", n, tfprintf);
+
+   fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0) {
+      fprintf(stderr, "emitbench: cannot open %s\n", path);
+      return 1;
+   }
+   t = now();
+   initOutput(&out, fd);
+   for (f=0; f < NUMFUNCS; f++)
+      printMBuffer(&bufs[f], &out);
+   flushOutput(&out);
+   close(fd);
+   toutput = now() - t;
+   report("Output", out.bytesWritten, toutput);
+   printf("   %d write() calls, %.2fx faster\n", out.numWrites, tfprintf / toutput);
+   if (out.bytesWritten != n)
+      printf("   ERROR: %lu bytes printed by fprintf, %lu by Output\n",
+             n, (unsigned long) out.bytesWritten);
+
+   freeOutput(&out);
+   for (f=0; f < NUMFUNCS; f++)
+      freeMBuffer(&bufs[f]);
+   free(bufs);
+   return 0;
+}
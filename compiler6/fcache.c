@@ -0,0 +1,271 @@
+//
+// Function Code Cache
+// - see fcache.h for the interface
+// - the key is a 64-bit FNV-1a hash; a cached function is the file
+//   DIR/<key>.s, 16 hex digits, holding exactly the text that
+//   generating the function appended to the output
+// - the AST is hashed with the visitor (see visit.h); every phase
+//   is mixed in as a marker, so an empty child slot and the shape
+//   of the lists are part of the key, not just the node sequence
+// - a string constant is hashed by its text and its index among
+//   the function's strings; the text is stored with the label
+//   numbers turned into those indices (".SC@k"), and turned back
+//   into this compile's numbers when it is loaded
+// - a file that cannot be read is a miss and one that cannot be
+//   written is dropped: the cache never makes a compile fail
+//
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fcache.h"
+#include "visit.h"
+#include "compiler.h"
+#include "output.h"
+
+#define FCACHEVERSION 3  // bump when the code generated for an AST changes
+#define FNVOFFSET 14695981039346656037ULL
+#define FNVPRIME 1099511628211ULL
+
+static THREADLOCAL const char* cacheDir = NULL;
+static THREADLOCAL unsigned long numHits, numMisses, numStores;
+
+// Use dir for the compilation on this thread, or no cache if NULL
+void initFuncCache(const char* dir)
+{
+   cacheDir = dir;
+   numHits = numMisses = numStores = 0;
+}
+
+int funcCacheOn()
+{
+   return cacheDir != NULL;
+}
+
+static uint64_t mixBytes(uint64_t h, const void* data, size_t n)
+{
+   const unsigned char* p = (const unsigned char*) data;
+   while (n--) {
+      h ^= *p++;
+      h *= FNVPRIME;
+   }
+   return h;
+}
+
+static uint64_t mixInt(uint64_t h, int v)
+{
+   return mixBytes(h, &v, sizeof(v));
+}
+
+// Index of string label n among the function's strings, adding
+// it if it is new
+static int strIndex(FuncKey* key, int n)
+{
+   int k;
+   for (k=0; k < key->numStrs; k++)
+      if (key->strLabels[k] == n)
+         return k;
+   if (key->numStrs == key->maxStrs) {
+      key->maxStrs = key->maxStrs ? 2*key->maxStrs : 8;
+      key->strLabels = (int*) realloc(key->strLabels, key->maxStrs * sizeof(int));
+   }
+   key->strLabels[key->numStrs] = n;
+   return key->numStrs++;
+}
+
+// Mix in a node when it is first visited, and a marker for every
+// phase, then walk every child slot in order
+// - the walk is stopped after the function node itself, so its
+//   siblings are not hashed
+static int hashVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   FuncKey* key = (FuncKey*) arg;
+   uint64_t* h = &key->hash;
+   SymInfo* info;
+   *h = mixInt(*h, phase);
+   if (phase == 0) {
+      *h = mixInt(*h, node->type);
+      *h = mixInt(*h, node->valType);
+      *h = mixInt(*h, node->varKind);
+      if (node->type == AST_CONSTANT && node->valType == T_STRING)
+         *h = mixInt(*h, strIndex(key, node->ival));
+      else
+         *h = mixInt(*h, node->ival);
+      if (node->strval)
+         *h = mixBytes(*h, node->strval, strlen(node->strval) + 1);
+      else
+         *h = mixInt(*h, -1);
+      if ((node->type == AST_VARREF || node->type == AST_ASSIGNMENT) &&
+          (node->varKind == V_GLOBAL || node->varKind == V_GLARRAY) &&
+          node->sym != NOSYMID) {
+         info = &symbols->info[node->sym];  // the global's declaration
+         *h = mixInt(*h, info->type);
+         *h = mixInt(*h, info->varKind);
+         *h = mixInt(*h, info->size);
+      }
+   }
+   if (phase < ASTNUMCHILDREN)
+      return phase;
+   return depth == 0 ? VISITSTOP : VISITDONE;
+}
+
+// Compute the cache key of a function, as it is about to be lowered
+void funcCacheKey(ASTNode* func, FuncKey* key)
+{
+   key->hash = FNVOFFSET;
+   key->strLabels = NULL;
+   key->numStrs = key->maxStrs = 0;
+   key->hash = mixInt(key->hash, FCACHEVERSION);
+   key->hash = mixInt(key->hash, optLevel);
+   key->hash = mixInt(key->hash, debug);  // -t adds comments to the code
+   visitAST(func, 0, hashVisit, key);
+}
+
+void freeFuncKey(FuncKey* key)
+{
+   free(key->strLabels);
+   key->strLabels = NULL;
+}
+
+static void keyPath(char* path, size_t size, const char* suffix, FuncKey* key)
+{
+   snprintf(path, size, "%s/%016llx%s", cacheDir, (unsigned long long) key->hash, suffix);
+}
+
+// Copy text into out, rewriting each string label ".SC<n>" as
+// ".SC@<index>" (toIndex), or the other way around
+// - returns 0, or -1 if a label is not one of the function's
+static int relabel(FuncKey* key, const char* text, size_t len, int toIndex, Output* out)
+{
+   const char *p = text, *end = text + len, *s = text;
+   int n, k;
+   for (;;) {
+      while (s+3 <= end && (s[0] != '.' || s[1] != 'S' || s[2] != 'C'))
+         s++;
+      if (s+3 > end)
+         break;
+      s += 3;
+      emitChars(out, p, s - p);
+      if (!toIndex) {
+         if (s == end || *s != '@')
+            return -1;
+         s++;
+      }
+      for (n = 0; s < end && *s >= '0' && *s <= '9'; s++)
+         n = 10*n + (*s - '0');
+      if (toIndex) {
+         for (k=0; k < key->numStrs && key->strLabels[k] != n; k++)
+            ;
+         if (k == key->numStrs)
+            return -1;
+         emitChar(out, '@');
+         emitInt(out, k);
+      } else {
+         if (n >= key->numStrs)
+            return -1;
+         emitInt(out, key->strLabels[n]);
+      }
+      p = s;
+   }
+   emitChars(out, p, end - p);
+   return 0;
+}
+
+// Read the cached code of a function
+// - returns a malloc'd copy of the text, with this compile's string
+//   labels, and its length in len, or NULL if it is not in the cache
+char* loadCachedFunc(FuncKey* key, size_t* len)
+{
+   char path[4096];
+   char* text;
+   Output labeled;
+   FILE* f;
+   long n;
+
+   keyPath(path, sizeof(path), ".s", key);
+   f = fopen(path, "rb");
+   if (!f) {
+      numMisses++;
+      return NULL;
+   }
+   text = NULL;
+   if (fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+      text = (char*) malloc(n ? n : 1);
+      if (text && fread(text, 1, n, f) != (size_t) n) {
+         free(text);
+         text = NULL;
+      }
+      *len = n;
+   }
+   fclose(f);
+   if (text && key->numStrs > 0) {
+      initOutput(&labeled, -1);  // kept in memory
+      if (relabel(key, text, *len, 0, &labeled) < 0)
+         freeOutput(&labeled);
+      free(text);
+      text = labeled.data;
+      *len = labeled.len;
+   }
+   if (text)
+      numHits++;
+   else
+      numMisses++;
+   return text;
+}
+
+// Put the code of a function in the cache
+// - it is written to a temporary file that is then renamed, so a
+//   reader sees either nothing or the whole text
+void storeCachedFunc(FuncKey* key, const char* text, size_t len)
+{
+   char tmp[4096], path[4096];
+   Output labeled;
+   ssize_t k;
+   int fd;
+
+   initOutput(&labeled, -1);
+   if (key->numStrs > 0) {
+      if (relabel(key, text, len, 1, &labeled) < 0) {
+         freeOutput(&labeled);
+         return;
+      }
+      text = labeled.data;
+      len = labeled.len;
+   }
+   if (mkdir(cacheDir, 0777) < 0 && errno != EEXIST) {
+      freeOutput(&labeled);
+      return;
+   }
+   keyPath(tmp, sizeof(tmp), ".XXXXXX", key);
+   fd = mkstemp(tmp);
+   if (fd < 0) {
+      freeOutput(&labeled);
+      return;
+   }
+   while (len > 0) {
+      k = write(fd, text, len);
+      if (k <= 0)
+         break;
+      text += k;
+      len -= k;
+   }
+   if (close(fd) < 0 || len > 0)
+      unlink(tmp);
+   else {
+      keyPath(path, sizeof(path), ".s", key);
+      if (rename(tmp, path) < 0)
+         unlink(tmp);
+      else
+         numStores++;
+   }
+   freeOutput(&labeled);
+}
+
+void printFuncCacheStats(FILE* out)
+{
+   if (!cacheDir)
+      return;
+   fprintf(out, "function cache: %lu hits, %lu misses, %lu stored (%s)\n",
+           numHits, numMisses, numStores, cacheDir);
+}
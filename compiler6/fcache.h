@@ -0,0 +1,43 @@
+//
+// Function Code Cache Interface
+// - with a cache directory set (-fcache-dir=DIR), the assembly of
+//   every function that is generated is stored in DIR under a
+//   64-bit key, and a later compile that finds the key there uses
+//   the stored text instead of lowering and optimizing the function
+// - the key hashes what the function's code depends on (see
+//   funcgen.h): its AST as it goes to code generation, after
+//   inlining and folding, so the bodies inlined into it count too;
+//   the -O level and -t; and the kind, type and size of every global it
+//   refers to, so changing a global's declaration invalidates the
+//   functions that use it
+// - string constants are keyed by their text only: their .SC label
+//   numbers are program-wide, so a string added to one function
+//   renumbers the strings of every later one; the cached text
+//   holds ".SC@k" for the function's k-th string instead, and the
+//   numbers of the compile that uses it are put back on loading
+// - the files are written to a temporary name and renamed, so
+//   compiles that share a directory never see half a file
+//
+#ifndef FCACHE_H
+#define FCACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "astree.h"
+
+typedef struct
+{
+   uint64_t hash;
+   int *strLabels;       // .SC numbers of the function's strings, in AST order
+   int numStrs, maxStrs;
+} FuncKey;
+
+void initFuncCache(const char *dir);
+int funcCacheOn();
+void funcCacheKey(ASTNode *func, FuncKey *key);
+void freeFuncKey(FuncKey *key);
+char *loadCachedFunc(FuncKey *key, size_t *len);
+void storeCachedFunc(FuncKey *key, const char *text, size_t len);
+void printFuncCacheStats(FILE *out);
+
+#endif
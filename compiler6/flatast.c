@@ -0,0 +1,250 @@
+//
+// Flat AST Module
+// - see flatast.h for the layout
+// - flattenAST() copies the pointer AST with the visitor (see
+//   visit.h), and printFlatAST() walks the flat AST with its own
+//   explicit stack, so neither uses C stack for deep nesting
+// - interned strings are unique pointers (see intern.h), so the
+//   string table is filled through a small pointer hash
+//
+#include <stdlib.h>
+#include <string.h>
+#include "flatast.h"
+#include "visit.h"
+
+typedef struct
+{
+   FlatAST *ast;
+   uint32_t *slots;      // string index + 1 by pointer hash, 0 if empty
+   uint32_t numSlots;
+   NodeId *open;         // node being copied, by depth
+   int maxOpen;
+} Flattener;
+
+typedef struct
+{
+   NodeId id;
+   int level;
+   int phase;
+} FlatFrame;             // printFlatAST() stack frame
+
+static unsigned int ptrHash(char* p)
+{
+   uintptr_t v = (uintptr_t) p;
+   return (unsigned int) ((v >> 4) ^ (v >> 16));
+}
+
+// Grow every node array to hold at least one more node
+static void growNodes(FlatAST* ast)
+{
+   uint32_t n = ast->maxNodes ? ast->maxNodes*2 : 1024;
+   ast->type = (uint8_t*) realloc(ast->type, n);
+   ast->valType = (uint8_t*) realloc(ast->valType, n);
+   ast->varKind = (uint8_t*) realloc(ast->varKind, n);
+   ast->links = (uint8_t*) realloc(ast->links, n);
+   ast->ival = (int32_t*) realloc(ast->ival, n * sizeof(int32_t));
+   ast->str = (uint32_t*) realloc(ast->str, n * sizeof(uint32_t));
+   ast->end = (NodeId*) realloc(ast->end, n * sizeof(NodeId));
+   ast->maxNodes = n;
+}
+
+static void growSlots(Flattener* fl)
+{
+   uint32_t i, h, n = fl->numSlots ? fl->numSlots*2 : 256;
+   uint32_t* slots = (uint32_t*) calloc(n, sizeof(uint32_t));
+   for (i=0; i < fl->numSlots; i++) {
+      if (!fl->slots[i])
+         continue;
+      h = ptrHash(fl->ast->strs[fl->slots[i]-1]) & (n-1);
+      while (slots[h])
+         h = (h+1) & (n-1);
+      slots[h] = fl->slots[i];
+   }
+   free(fl->slots);
+   fl->slots = slots;
+   fl->numSlots = n;
+}
+
+// Get the string table index of s, adding it if it is new
+static uint32_t strIndex(Flattener* fl, char* s)
+{
+   FlatAST* ast = fl->ast;
+   uint32_t h;
+   if (!s)
+      return 0;
+   if (2*(ast->numStrs+1) > fl->numSlots)
+      growSlots(fl);
+   h = ptrHash(s) & (fl->numSlots-1);
+   while (fl->slots[h]) {
+      if (ast->strs[fl->slots[h]-1] == s)
+         return fl->slots[h]-1;
+      h = (h+1) & (fl->numSlots-1);
+   }
+   if (ast->numStrs == ast->maxStrs) {
+      ast->maxStrs *= 2;
+      ast->strs = (char**) realloc(ast->strs, ast->maxStrs * sizeof(char*));
+   }
+   ast->strs[ast->numStrs] = s;
+   fl->slots[h] = ast->numStrs + 1;
+   return ast->numStrs++;
+}
+
+// Append a node when it is first visited, and fill in its child
+// links and subtree end as visitAST() walks its child slots
+// - open[depth] is the id of the node being copied at each depth,
+//   since a node's children are all copied before its end is known
+static int flattenVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   Flattener* fl = (Flattener*) arg;
+   FlatAST* ast = fl->ast;
+   NodeId id;
+   if (phase == 0) {
+      if (ast->numNodes == ast->maxNodes)
+         growNodes(ast);
+      if (depth == fl->maxOpen) {
+         fl->maxOpen = fl->maxOpen ? 2*fl->maxOpen : 64;
+         fl->open = (NodeId*) realloc(fl->open, fl->maxOpen * sizeof(NodeId));
+      }
+      id = ast->numNodes++;
+      fl->open[depth] = id;
+      ast->type[id] = (uint8_t) node->type;
+      ast->valType[id] = (uint8_t) node->valType;
+      ast->varKind[id] = (uint8_t) node->varKind;
+      ast->links[id] = node->next ? LINKNEXT : 0;
+      ast->ival[id] = node->ival;
+      ast->str[id] = strIndex(fl, node->strval);
+   }
+   id = fl->open[depth];
+   if (phase < ASTNUMCHILDREN) {
+      if (node->child[phase])
+         ast->links[id] |= LINKCHILD(phase);
+      return phase;
+   }
+   ast->end[id] = ast->numNodes;
+   return VISITDONE;
+}
+
+// Make a flat copy of the AST (list) at root
+// - root is not changed; the copy shares its interned strings
+FlatAST* flattenAST(ASTNode* root)
+{
+   Flattener fl;
+   FlatAST* ast = (FlatAST*) calloc(1, sizeof(FlatAST));
+   ast->maxStrs = 64;
+   ast->strs = (char**) malloc(ast->maxStrs * sizeof(char*));
+   ast->strs[0] = NULL;
+   ast->numStrs = 1;
+   fl.ast = ast;
+   fl.slots = NULL;
+   fl.numSlots = 0;
+   fl.open = NULL;
+   fl.maxOpen = 0;
+   visitAST(root, 0, flattenVisit, &fl);
+   free(fl.slots);
+   free(fl.open);
+   return ast;
+}
+
+void freeFlatAST(FlatAST* ast)
+{
+   if (!ast)
+      return;
+   free(ast->type);
+   free(ast->valType);
+   free(ast->varKind);
+   free(ast->links);
+   free(ast->ival);
+   free(ast->str);
+   free(ast->end);
+   free(ast->strs);
+   free(ast);
+}
+
+// The next sibling of a node, or NONODE
+NodeId flatNext(FlatAST* ast, NodeId id)
+{
+   return (ast->links[id] & LINKNEXT) ? ast->end[id] : NONODE;
+}
+
+// The first node of child slot k of a node, or NONODE
+// - the earlier filled slots are skipped a list at a time, one
+//   hop per list element
+NodeId flatChild(FlatAST* ast, NodeId id, int k)
+{
+   NodeId c = id + 1;
+   int i;
+   if (!(ast->links[id] & LINKCHILD(k)))
+      return NONODE;
+   for (i=0; i < k; i++) {
+      if (!(ast->links[id] & LINKCHILD(i)))
+         continue;
+      while (ast->links[c] & LINKNEXT)
+         c = ast->end[c];
+      c = ast->end[c];
+   }
+   return c;
+}
+
+// Bytes held by the nodes and the string table (not the strings)
+size_t flatASTBytes(FlatAST* ast)
+{
+   size_t perNode = 4*sizeof(uint8_t) + sizeof(int32_t) + sizeof(uint32_t) +
+                    sizeof(NodeId);
+   return ast->numNodes * perNode + ast->numStrs * sizeof(char*);
+}
+
+// Print one flat node for printFlatAST(), a phase at a time
+// - the node's fields are copied into an ASTNode so printASTNode()
+//   (astree.c) prints it, just as printASTree() does
+static int printFlatNode(FlatAST* ast, NodeId id, int phase, int level, FILE* out)
+{
+   ASTNode node;
+   memset(&node, 0, sizeof(node));
+   node.type = (ASTNodeType) ast->type[id];
+   node.valType = ast->valType[id];
+   node.varKind = ast->varKind[id];
+   node.ival = ast->ival[id];
+   node.strval = ast->strs[ast->str[id]];
+   return printASTNode(&node, phase, level, out);
+}
+
+// Print a flat AST list starting at node id, in exactly the form
+// printASTree() prints the same nodes
+// - the walk keeps its own stack of (node, level, phase) frames, as
+//   visitAST() does for the pointer AST, so deep nesting does not
+//   use C stack
+void printFlatAST(FlatAST* ast, NodeId id, int level, FILE* out)
+{
+   FlatFrame *stack, *f;
+   int sp = 0, max = 64, k;
+   NodeId c;
+
+   if (id == NONODE)
+      return;
+   stack = (FlatFrame*) malloc(max * sizeof(FlatFrame));
+   stack[sp].id = id;
+   stack[sp].level = level;
+   stack[sp++].phase = 0;
+   while (sp > 0) {
+      f = &stack[sp-1];
+      k = printFlatNode(ast, f->id, f->phase++, f->level, out);
+      if (k == VISITDONE) {
+         if ((c = flatNext(ast, f->id)) != NONODE) {
+            f->id = c;
+            f->phase = 0;
+         } else
+            sp--;
+         continue;
+      }
+      if ((c = flatChild(ast, f->id, k)) == NONODE)
+         continue;
+      if (sp == max) {
+         max *= 2;
+         stack = (FlatFrame*) realloc(stack, max * sizeof(FlatFrame));
+      }
+      stack[sp].id = c;
+      stack[sp].level = stack[sp-1].level + 1;
+      stack[sp++].phase = 0;
+   }
+   free(stack);
+}
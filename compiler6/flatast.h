@@ -0,0 +1,54 @@
+//
+// Flat AST Interface
+// - a compact copy of a finished AST: the nodes are stored in
+//   parallel arrays (struct of arrays) in pre-order and named by
+//   32-bit ids instead of pointers, so a whole-tree walk is a
+//   linear scan over a few dense arrays
+// - a node is followed by the lists of its child slots, in slot
+//   order; links[] says which slots are filled and whether the
+//   node has a next sibling, and end[] is the id just past the
+//   node's subtree, which is also its next sibling when it has one
+// - the small fields (type, valType, varKind, links) are a byte
+//   each, and strval is an index into a table of the distinct
+//   strings, so a node takes 16 bytes instead of sizeof(ASTNode)
+// - the flat AST is read-only; it is built with flattenAST() after
+//   parsing and does not change when the pointer AST does
+// - the compiler itself works on the pointer AST, which its passes
+//   rewrite in place; the flat copy is only built by the AST layout
+//   benchmark (astbench.c)
+//
+#ifndef FLATAST_H
+#define FLATAST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "astree.h"
+
+typedef uint32_t NodeId;
+
+#define NONODE    ((NodeId) -1)
+#define LINKNEXT  0x08        // links[] bit: node has a next sibling
+#define LINKCHILD(k) (1u << (k))  // links[] bit: child slot k is filled
+
+typedef struct
+{
+   uint8_t *type;       // ASTNodeType
+   uint8_t *valType;    // DataType
+   uint8_t *varKind;    // VariableKind
+   uint8_t *links;      // LINKCHILD(k) and LINKNEXT bits
+   int32_t *ival;
+   uint32_t *str;       // index into strs[], 0 for no string
+   NodeId *end;         // id just past the subtree
+   uint32_t numNodes, maxNodes;
+   char **strs;         // distinct strvals; strs[0] is NULL
+   uint32_t numStrs, maxStrs;
+} FlatAST;
+
+FlatAST *flattenAST(ASTNode *root);
+void freeFlatAST(FlatAST *ast);
+NodeId flatChild(FlatAST *ast, NodeId id, int k);
+NodeId flatNext(FlatAST *ast, NodeId id);
+size_t flatASTBytes(FlatAST *ast);
+void printFlatAST(FlatAST *ast, NodeId id, int level, FILE *out);
+
+#endif
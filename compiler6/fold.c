@@ -0,0 +1,366 @@
+//
+// AST Constant Folding
+// - see fold.h for the interface
+// - expressions are folded bottom up: an operator with two int
+//   constant operands becomes a constant, "x + 0", "0 + x" and
+//   "x - 0" become x, "x - x" becomes 0, and a constant on both
+//   sides of a variable ("3 + a + 4") is combined into one
+// - J expressions have no side effects (calls are statements), so
+//   any two structurally equal expressions have the same value
+// - arithmetic wraps at 32 bits, just like the RISC-V code would
+// - an if whose condition is known is replaced by the branch that
+//   is taken; a while whose condition is false is removed; a while
+//   whose condition is true stays, and lowering turns its test into
+//   a plain jump (see constCondValue())
+//
+#include <stdlib.h>
+#include <string.h>
+#include "fold.h"
+#include "compiler.h"
+#include "visit.h"
+
+static THREADLOCAL int numFolded = 0;       // total nodes folded away
+static THREADLOCAL int numFoldedConds = 0;  // if/while statements collapsed
+
+#define SAMESTACK 32         // expression pairs sameExpr() keeps locally
+#define INITIALFOLDSTACK 64  // nested lists foldStatements() starts with
+
+// A statement list being folded (see foldStatements())
+typedef struct
+{
+   ASTNode **link;  // link to the current node
+   int phase;       // 0 before its bodies, then one per body folded
+} FoldFrame;
+
+static int isIntConst(ASTNode* node)
+{
+   return node && node->type == AST_CONSTANT && node->valType == T_INT;
+}
+
+// Add or subtract at 32 bits with wraparound
+static int wrapOp(int a, int b, int op)
+{
+   if (op == '+')
+      return (int) ((unsigned int) a + (unsigned int) b);
+   return (int) ((unsigned int) a - (unsigned int) b);
+}
+
+// True if two expressions are structurally equal
+// - the node pairs still to compare are kept on an explicit stack,
+//   which only moves to the heap for an expression more than
+//   SAMESTACK pairs deep
+static int sameExpr(ASTNode* a, ASTNode* b)
+{
+   ASTNode* local[2*SAMESTACK];
+   ASTNode** stack = local;
+   int sp = 0, max = 2*SAMESTACK, same = 1;
+
+   stack[sp++] = a;
+   stack[sp++] = b;
+   while (same && sp > 0) {
+      b = stack[--sp];
+      a = stack[--sp];
+      if (!a || !b) {
+         same = a == b;
+         continue;
+      }
+      if (a->type != b->type) {
+         same = 0;
+         continue;
+      }
+      switch (a->type) {
+       case AST_CONSTANT:
+          same = a->valType == b->valType && a->ival == b->ival;
+          continue;
+       case AST_VARREF:
+          // every variable has its own symbol id
+          same = a->sym == b->sym && a->varKind == b->varKind;
+          break;
+       case AST_EXPRESSION:
+          same = a->ival == b->ival;
+          break;
+       default:
+          same = 0;
+      }
+      if (!same)
+         break;
+      if (sp + 4 > max) {
+         max *= 2;
+         if (stack == local) {
+            stack = (ASTNode**) malloc(max * sizeof(ASTNode*));
+            memcpy(stack, local, sp * sizeof(ASTNode*));
+         } else
+            stack = (ASTNode**) realloc(stack, max * sizeof(ASTNode*));
+      }
+      stack[sp++] = a->child[0];
+      stack[sp++] = b->child[0];
+      if (a->type == AST_EXPRESSION) {
+         stack[sp++] = a->child[1];
+         stack[sp++] = b->child[1];
+      }
+   }
+   if (stack != local)
+      free(stack);
+   return same;
+}
+
+// Overwrite node with a copy of src, keeping node's sibling link
+static void replaceNode(ASTNode* node, ASTNode* src)
+{
+   ASTNode* next = node->next;
+   *node = *src;
+   node->next = next;
+   numFolded++;
+}
+
+// Turn node into the int constant val
+static void makeConst(ASTNode* node, int val)
+{
+   node->type = AST_CONSTANT;
+   node->valType = T_INT;
+   node->ival = val;
+   node->strval = NULL;
+   node->sym = NOSYMID;
+   node->child[0] = node->child[1] = node->child[2] = NULL;
+   numFolded++;
+}
+
+// Split "x + c", "c + x", "x - c" or "c - x" into its variable part,
+// the sign of the variable part, and the constant part
+// - returns 0 if expr does not have exactly one int constant operand
+static int linearParts(ASTNode* expr, ASTNode** var, int* sign, ASTNode** cnst)
+{
+   if (expr->type != AST_EXPRESSION || (expr->ival != '+' && expr->ival != '-'))
+      return 0;
+   if (isIntConst(expr->child[1]) && !isIntConst(expr->child[0])) {
+      *var = expr->child[0];
+      *sign = 1;
+      *cnst = expr->child[1];
+      if (expr->ival == '-')
+         (*cnst)->ival = wrapOp(0, (*cnst)->ival, '-');
+      return 1;
+   }
+   if (isIntConst(expr->child[0]) && !isIntConst(expr->child[1])) {
+      *var = expr->child[1];
+      *sign = expr->ival == '+' ? 1 : -1;
+      *cnst = expr->child[0];
+      return 1;
+   }
+   return 0;
+}
+
+// Fold "k op (x +/- c)" or "(x +/- c) op k" into "x + c'" or "c' - x"
+// - node's operands are already folded, and exactly one is constant
+static int foldLinear(ASTNode* node)
+{
+   ASTNode *k, *inner, *var, *cnst;
+   int sign, val, kFirst = isIntConst(node->child[0]);
+
+   k = kFirst ? node->child[0] : node->child[1];
+   inner = kFirst ? node->child[1] : node->child[0];
+   if (!linearParts(inner, &var, &sign, &cnst))
+      return 0;
+   // inner is now sign*var + cnst (cnst's sign already applied)
+   if (node->ival == '+')
+      val = wrapOp(k->ival, cnst->ival, '+');
+   else if (kFirst) {            // k - (sign*var + c)
+      val = wrapOp(k->ival, cnst->ival, '-');
+      sign = -sign;
+   } else                        // (sign*var + c) - k
+      val = wrapOp(cnst->ival, k->ival, '-');
+   cnst->ival = val;
+   if (sign > 0 && val == 0)
+      replaceNode(node, var);
+   else if (sign > 0) {
+      node->ival = '+';
+      node->child[0] = var;
+      node->child[1] = cnst;
+   } else {
+      node->ival = '-';
+      node->child[0] = cnst;
+      node->child[1] = var;
+   }
+   numFolded++;
+   return 1;
+}
+
+// Fold an expression node once its operands are folded
+// - visitAST() walks the operands (and an array index) first; the
+//   walk is stopped after the root, which is one expression and
+//   not a list
+static int foldVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   ASTNode *left, *right;
+   (void) arg;
+   if (node->type == AST_VARREF && phase == 0)
+      return 0;  // array index
+   if (node->type == AST_EXPRESSION && phase < 2)
+      return phase;
+   if (node->type == AST_EXPRESSION && (node->ival == '+' || node->ival == '-')) {
+      left = node->child[0];
+      right = node->child[1];
+      if (isIntConst(left) && isIntConst(right))
+         makeConst(node, wrapOp(left->ival, right->ival, node->ival));
+      else if (isIntConst(right) && right->ival == 0)
+         replaceNode(node, left);                 // x + 0, x - 0
+      else if (node->ival == '+' && isIntConst(left) && left->ival == 0)
+         replaceNode(node, right);                // 0 + x
+      else if (node->ival == '-' && sameExpr(left, right))
+         makeConst(node, 0);                      // x - x
+      else if (isIntConst(left) || isIntConst(right))
+         foldLinear(node);
+   }
+   return depth == 0 ? VISITSTOP : VISITDONE;
+}
+
+// Fold an expression in place
+static void foldExpr(ASTNode* node)
+{
+   visitAST(node, 0, foldVisit, NULL);
+}
+
+// Value of a relational expression if it is known at compile time
+// - returns 1 (true), 0 (false), or -1 if it is not known
+// - the operands are compared as they are, so fold them first
+int constCondValue(ASTNode* rel)
+{
+   ASTNode *left, *right;
+   if (!rel || rel->type != AST_RELEXPR)
+      return -1;
+   left = rel->child[0];
+   right = rel->child[1];
+   if (isIntConst(left) && isIntConst(right)) {
+      switch (rel->ival) {
+       case '=': return left->ival == right->ival;
+       case '!': return left->ival != right->ival;
+       case '<': return left->ival < right->ival;
+       case '>': return left->ival > right->ival;
+       default: return -1;
+      }
+   }
+   if (sameExpr(left, right)) {
+      switch (rel->ival) {
+       case '=': return 1;
+       case '!': case '<': case '>': return 0;
+       default: return -1;
+      }
+   }
+   return -1;
+}
+
+// Fold a statement list in place
+// - a collapsed if or a removed while may change the head of the
+//   list, so it is passed by its link
+// - the lists still being folded are kept on an explicit stack: a
+//   frame is the link to the list's current node, and the phase of
+//   that node (its bodies folded so far), so deep nesting does not
+//   use C stack
+static void foldStatements(ASTNode** list)
+{
+   FoldFrame* stack;
+   FoldFrame* f;
+   ASTNode *node, *repl, *tail, *arg;
+   ASTNode** body;
+   int sp = 0, max = INITIALFOLDSTACK, cond;
+
+   stack = (FoldFrame*) malloc(max * sizeof(FoldFrame));
+   stack[sp].link = list;
+   stack[sp++].phase = 0;
+   while (sp > 0) {
+      f = &stack[sp-1];
+      node = *f->link;
+      body = NULL;
+      if (!node) {
+         sp--;
+         continue;
+      }
+      if (f->phase == 0) {
+         switch (node->type) {
+          case AST_ASSIGNMENT:
+             foldExpr(node->child[0]);  // right hand side
+             foldExpr(node->child[1]);  // array index
+             break;
+          case AST_FUNCALL:
+             for (arg = node->child[0]; arg; arg = arg->next)
+                foldExpr(arg->child[0]);
+             break;
+          case AST_WHILE:
+          case AST_IFTHEN:
+             foldExpr(node->child[0]->child[0]);
+             foldExpr(node->child[0]->child[1]);
+             body = &node->child[1];  // child 1 is the body
+             break;
+          default:
+             break;
+         }
+         if (!body)
+            f->link = &node->next;
+      } else if (f->phase == 1 && node->type == AST_IFTHEN) {
+         body = &node->child[2];  // child 2 is the else body
+      } else {
+         // both bodies are folded, the condition decides
+         f->phase = 0;
+         cond = constCondValue(node->child[0]);
+         if (cond < 0 || (node->type == AST_WHILE && cond == 1)) {
+            f->link = &node->next;
+            continue;
+         }
+         // splice the taken branch (or nothing) in place of node
+         numFoldedConds++;
+         repl = NULL;
+         if (node->type == AST_IFTHEN) {
+            repl = cond ? node->child[1] : node->child[2];
+            numFolded += 2 + countASTNodes(cond ? node->child[2] : node->child[1]);
+         } else
+            numFolded += 2 + countASTNodes(node->child[1]);
+         if (!repl) {
+            *f->link = node->next;
+            continue;
+         }
+         for (tail = repl; tail->next; tail = tail->next)
+            ;
+         tail->next = node->next;
+         *f->link = repl;
+         f->link = &tail->next;
+      }
+      if (!body)
+         continue;
+      f->phase++;
+      if (sp == max) {
+         max *= 2;
+         stack = (FoldFrame*) realloc(stack, max * sizeof(FoldFrame));
+      }
+      stack[sp].link = body;
+      stack[sp++].phase = 0;
+   }
+   free(stack);
+}
+
+// Fold every function body and the program block
+// - returns the number of AST nodes folded away or rewritten
+int foldConstants(ASTNode* program)
+{
+   ASTNode* func;
+   int before = numFolded;
+   if (!program)
+      return 0;
+   for (func = program->child[1]; func; func = func->next)  // child 1 is functions
+      foldStatements(&func->child[0]);   // child 0 is statements
+   foldStatements(&program->child[2]); // child 2 is program
+   return numFolded - before;
+}
+
+// Fold one function body, for a function compiled on its own
+// - returns the number of AST nodes folded away or rewritten
+int foldFunction(ASTNode* func)
+{
+   int before = numFolded;
+   foldStatements(&func->child[0]);
+   return numFolded - before;
+}
+
+void printFoldStats(FILE *out)
+{
+   fprintf(out, "fold: %d AST nodes folded, %d if/while collapsed\n",
+           numFolded, numFoldedConds);
+}
@@ -0,0 +1,18 @@
+//
+// AST Constant Folding Interface
+// - folds constant subexpressions and simple algebraic identities,
+//   and collapses if/while statements whose condition is known at
+//   compile time; works in place on the AST before it is lowered
+//
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdio.h>
+#include "astree.h"
+
+int foldConstants(ASTNode *program);
+int foldFunction(ASTNode *func);
+int constCondValue(ASTNode *relexpr);
+void printFoldStats(FILE *out);
+
+#endif
@@ -0,0 +1,254 @@
+//
+// Function Code Generation
+// - see funcgen.h for the interface
+// - worker threads take the next function in source order under a
+//   lock, so big and small functions even out by themselves; where
+//   each function's text ended up (worker and span) is recorded,
+//   and the calling thread stitches the spans together at the end
+// - the module state of the backend is THREADLOCAL (see
+//   compiler.h), so a worker only has to set up the options, the
+//   symbol table and the pass list on its own thread before it
+//   starts; the table is only read while functions are generated
+// - the function cache (see fcache.h) is only used on the calling
+//   thread: the keys are computed and the cache read before the
+//   workers start, and the new code is stored after they are done
+//
+#include <stdlib.h>
+#include <pthread.h>
+#include "funcgen.h"
+#include "compiler.h"
+#include "passes.h"
+#include "riscv.h"
+#include "deadcode.h"
+#include "fold.h"
+#include "fcache.h"
+
+typedef struct
+{
+   ASTNode **funcs;      // live functions, in source order
+   int numFuncs;
+   int next;             // next function to hand out
+   pthread_mutex_t lock;
+   int *worker;          // worker that generated each function
+   size_t *start, *len;  // and where its code is in that worker's text
+   int optLevel;
+   SymbolTable *symbols;
+} FuncQueue;
+
+typedef struct
+{
+   FuncQueue *queue;
+   int self;
+   Output text;          // code of the functions this worker did
+} FuncWorker;
+
+// Run the optimization passes on an IR function and emit it
+// - the IR is dumped to stderr under -t, after optimization
+void genIRFunc(IRFunc* func, Output* out)
+{
+   runPasses(func, optLevel);
+   if (debug)
+      printIRFunc(func, stderr);
+   genRISCV(func, out);
+   freeIRFunc(func);
+}
+
+// Take the next function, or -1 if they have all been taken
+static int nextFunc(FuncQueue* q)
+{
+   int f = -1;
+   pthread_mutex_lock(&q->lock);
+   if (q->next < q->numFuncs)
+      f = q->next++;
+   pthread_mutex_unlock(&q->lock);
+   return f;
+}
+
+static void* runFuncWorker(void* arg)
+{
+   FuncWorker* w = (FuncWorker*) arg;
+   FuncQueue* q = w->queue;
+   int f;
+   optLevel = q->optLevel;  // no-ops on the calling thread
+   symbols = q->symbols;
+   registerDefaultPasses();
+   while ((f = nextFunc(q)) >= 0) {
+      q->worker[f] = w->self;
+      q->start[f] = w->text.len;
+      genIRFunc(lowerFunction(q->funcs[f]), &w->text);
+      q->len[f] = w->text.len - q->start[f];
+   }
+   return NULL;
+}
+
+// Generate the code of funcs on codegenThreads threads
+// - the calling thread is worker 0
+// - if pos is not NULL, where each function's code starts in out
+//   is put in it
+static void genFunctionsParallel(ASTNode** funcs, int numFuncs, Output* out, size_t* pos)
+{
+   FuncQueue q;
+   FuncWorker* workers;
+   pthread_t* threads;
+   int i, numThreads = codegenThreads;
+
+   if (numThreads > numFuncs)
+      numThreads = numFuncs;
+   q.funcs = funcs;
+   q.numFuncs = numFuncs;
+   q.next = 0;
+   pthread_mutex_init(&q.lock, NULL);
+   q.worker = (int*) malloc(numFuncs * sizeof(int));
+   q.start = (size_t*) malloc(numFuncs * sizeof(size_t));
+   q.len = (size_t*) malloc(numFuncs * sizeof(size_t));
+   q.optLevel = optLevel;
+   q.symbols = symbols;
+   workers = (FuncWorker*) malloc(numThreads * sizeof(FuncWorker));
+   threads = (pthread_t*) malloc(numThreads * sizeof(pthread_t));
+   for (i=0; i < numThreads; i++) {
+      workers[i].queue = &q;
+      workers[i].self = i;
+      initOutput(&workers[i].text, -1);  // kept in memory
+   }
+
+   for (i=1; i < numThreads; i++)
+      pthread_create(&threads[i], NULL, runFuncWorker, &workers[i]);
+   runFuncWorker(&workers[0]);
+   for (i=1; i < numThreads; i++)
+      pthread_join(threads[i], NULL);
+
+   for (i=0; i < numFuncs; i++) {
+      if (pos)
+         pos[i] = out->len;
+      emitChars(out, workers[q.worker[i]].text.data + q.start[i], q.len[i]);
+   }
+
+   for (i=0; i < numThreads; i++)
+      freeOutput(&workers[i].text);
+   pthread_mutex_destroy(&q.lock);
+   free(q.worker);
+   free(q.start);
+   free(q.len);
+   free(workers);
+   free(threads);
+}
+
+// Generate the code of live functions, in parallel if there are
+// enough of them
+// - if pos is not NULL, where each function's code starts in out
+//   is put in pos[0..numFuncs-1], and where the last one ends in
+//   pos[numFuncs]; out must then be kept in memory (fd -1)
+static void genLiveFunctions(ASTNode** funcs, int numFuncs, Output* out, size_t* pos)
+{
+   int i;
+   if (codegenThreads <= 1 || debug || numFuncs < PARALLELMINFUNCS) {
+      for (i=0; i < numFuncs; i++) {
+         if (pos)
+            pos[i] = out->len;
+         genIRFunc(lowerFunction(funcs[i]), out);
+      }
+   } else
+      genFunctionsParallel(funcs, numFuncs, out, pos);
+   if (pos)
+      pos[numFuncs] = out->len;
+}
+
+// Generate the code of funcs through the function cache
+// - the functions found in the cache are copied from it; the rest
+//   are generated together (so still in parallel) into a buffer,
+//   stored in the cache, and then everything is emitted in source
+//   order
+static void genFunctionsCached(ASTNode** funcs, int numFuncs, Output* out)
+{
+   FuncKey* keys;
+   char** cached;
+   size_t* cachedLen;
+   ASTNode** misses;
+   int* missOf;
+   size_t* pos;
+   Output gen;
+   int i, m, numMisses = 0;
+
+   keys = (FuncKey*) malloc(numFuncs * sizeof(FuncKey));
+   cached = (char**) malloc(numFuncs * sizeof(char*));
+   cachedLen = (size_t*) malloc(numFuncs * sizeof(size_t));
+   misses = (ASTNode**) malloc(numFuncs * sizeof(ASTNode*));
+   missOf = (int*) malloc(numFuncs * sizeof(int));
+   pos = (size_t*) malloc((numFuncs+1) * sizeof(size_t));
+   for (i=0; i < numFuncs; i++) {
+      funcCacheKey(funcs[i], &keys[i]);
+      cached[i] = loadCachedFunc(&keys[i], &cachedLen[i]);
+      missOf[i] = -1;
+      if (!cached[i]) {
+         missOf[i] = numMisses;
+         misses[numMisses++] = funcs[i];
+      }
+   }
+
+   initOutput(&gen, -1);  // kept in memory
+   genLiveFunctions(misses, numMisses, &gen, pos);
+   for (i=0; i < numFuncs; i++) {
+      m = missOf[i];
+      if (m < 0) {
+         emitChars(out, cached[i], cachedLen[i]);
+         free(cached[i]);
+      } else {
+         storeCachedFunc(&keys[i], gen.data + pos[m], pos[m+1] - pos[m]);
+         emitChars(out, gen.data + pos[m], pos[m+1] - pos[m]);
+      }
+      freeFuncKey(&keys[i]);
+   }
+
+   freeOutput(&gen);
+   free(keys);
+   free(cached);
+   free(cachedLen);
+   free(misses);
+   free(missOf);
+   free(pos);
+}
+
+// Generate the code of every live function in a function list
+// - dead functions (never called) are skipped
+void genFunctions(ASTNode* funcs, Output* out)
+{
+   ASTNode** live;
+   ASTNode* node;
+   int numLive = 0, maxLive = 64;
+
+   if (!funcCacheOn() && (codegenThreads <= 1 || debug)) {
+      for (node = funcs; node; node = node->next)
+         if (isLiveFunction(node->sym))
+            genIRFunc(lowerFunction(node), out);
+      return;
+   }
+   live = (ASTNode**) malloc(maxLive * sizeof(ASTNode*));
+   for (node = funcs; node; node = node->next) {
+      if (!isLiveFunction(node->sym))
+         continue;
+      if (numLive == maxLive) {
+         maxLive *= 2;
+         live = (ASTNode**) realloc(live, maxLive * sizeof(ASTNode*));
+      }
+      live[numLive++] = node;
+   }
+   if (funcCacheOn())
+      genFunctionsCached(live, numLive, out);
+   else
+      genLiveFunctions(live, numLive, out, NULL);
+   free(live);
+}
+
+// Generate the code of a function that was just parsed
+// - nothing is known about the rest of the program yet, so it is
+//   not inlined into and is always live; its constants are folded
+//   here, since the whole program is never folded
+void genStreamedFunction(ASTNode* func, Output* out)
+{
+   if (optLevel > 0)
+      foldFunction(func);
+   if (funcCacheOn())
+      genFunctionsCached(&func, 1, out);
+   else
+      genIRFunc(lowerFunction(func), out);
+}
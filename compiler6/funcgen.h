@@ -0,0 +1,36 @@
+//
+// Function Code Generation Interface
+// - genIRFunc() optimizes one IR function and emits its assembly;
+//   genFunctions() lowers and emits every live function of the
+//   program's function list, in source order
+// - the code of a function depends on nothing but its own AST:
+//   block labels are numbered per function (see ir.h), and the
+//   lowering, the passes, and the backend only keep per-function
+//   state, so functions can be generated on any thread
+// - with codegenThreads above 1 (-fcodegen-threads=N) the functions
+//   are shared out among that many threads, each appending the code
+//   of the functions it takes to a buffer of its own; the pieces are
+//   then copied to the output in source order, so the output is the
+//   same, byte for byte, as with one thread
+// - under -t everything stays on the calling thread, so the IR
+//   dumps come out in order and the pass statistics are all kept
+// - genStreamedFunction() does one function straight from the
+//   parser, for streaming compilation (see compiler.h)
+// - with a function cache (-fcache-dir=DIR, see fcache.h), a
+//   function whose code is in the cache is copied from it and not
+//   lowered at all, so under -t it has no IR dump
+//
+#ifndef FUNCGEN_H
+#define FUNCGEN_H
+
+#include "astree.h"
+#include "ir.h"
+#include "output.h"
+
+#define PARALLELMINFUNCS 8  // fewer live functions are done serially
+
+void genIRFunc(IRFunc *func, Output *out);
+void genFunctions(ASTNode *funcs, Output *out);
+void genStreamedFunction(ASTNode *func, Output *out);
+
+#endif
@@ -0,0 +1,406 @@
+//
+// AST Function Inliner
+// - see inline.h for the interface
+// - functions are handled bottom up over the call graph, so a body
+//   is copied with the calls inside it already inlined; a call is
+//   inlined once, and the copy it leaves is not looked at again
+// - a call is inlined when the callee is not recursive (it cannot
+//   reach itself in the call graph), its body has at most
+//   inlineLimit AST nodes, and the argument count matches
+// - the callee's params and locals become new locals of the caller,
+//   numbered after the caller's own and renamed "func.var.site";
+//   a '.' cannot appear in a J identifier, so the new names never
+//   collide with anything the symbol table held for the caller, and
+//   each new local gets a symbol id of its own
+// - the call becomes one assignment per param (the args are only
+//   read before the first param is assigned, since the new locals
+//   are fresh) followed by the copied body
+// - "returnvalue" reads a0 as the last call left it; a J function
+//   has no return statement, so nothing it computes is returned,
+//   but a call that is inlined no longer sets a0; a call is kept
+//   if returnvalue may be read after it before another call, and
+//   callees that read returnvalue are never inlined
+// - bodies are copied and searched with the visitor (see visit.h)
+//
+#include <stdlib.h>
+#include <string.h>
+#include "inline.h"
+#include "compiler.h"
+#include "visit.h"
+#include "intern.h"
+
+THREADLOCAL int inlineLimit = DEFAULTINLINELIMIT;
+
+static THREADLOCAL int numCallSites = 0;  // call sites to J functions seen
+static THREADLOCAL int numInlined = 0;    // call sites inlined
+static THREADLOCAL int numNodesCopied = 0;
+
+// pass state
+static THREADLOCAL ASTNode** funcs;       // all function defs
+static THREADLOCAL int numFuncs;
+static THREADLOCAL int* funcIndex;        // index in funcs by symbol id, or -1
+static THREADLOCAL int* done;             // function already had its calls inlined
+static THREADLOCAL int* recursive;
+static THREADLOCAL int* bodySize;         // AST nodes in each body, after inlining
+static THREADLOCAL ASTNode* caller;       // function being inlined into, NULL for program
+static THREADLOCAL const char* callerName;
+static THREADLOCAL int callerReadsRetVal;
+static THREADLOCAL int nextVar;           // next free var number in the caller
+static THREADLOCAL int siteNum;           // call sites seen in the caller
+
+// Index in funcs of the function a call calls, or -1 for a
+// library function
+static int findFunc(ASTNode* call)
+{
+   return funcIndex[call->sym];
+}
+
+// Stop the walk at the first read of returnvalue
+static int retValVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   (void) depth;
+   (void) arg;
+   if (phase == 0 && node->type == AST_CONSTANT && node->valType == T_RETURNVAL)
+      return VISITSTOP;
+   return phase < ASTNUMCHILDREN ? phase : VISITDONE;
+}
+
+// True if a tree or its sibling list reads returnvalue
+static int readsRetVal(ASTNode* node)
+{
+   return visitAST(node, 0, retValVisit, NULL) == VISITSTOP;
+}
+
+// True if function g can be reached by following the calls in a
+// statement list
+// - seen marks the functions already searched
+static int reaches(ASTNode* stmts, int g, char* seen)
+{
+   int c;
+   for (; stmts; stmts = stmts->next) {
+      if (stmts->type == AST_FUNCALL && (c = findFunc(stmts)) >= 0) {
+         if (c == g)
+            return 1;
+         if (!seen[c]) {
+            seen[c] = 1;
+            if (reaches(funcs[c]->child[0], g, seen))  // child 0 is statements
+               return 1;
+         }
+      } else if (stmts->type == AST_WHILE || stmts->type == AST_IFTHEN) {
+         if (reaches(stmts->child[1], g, seen) || reaches(stmts->child[2], g, seen))
+            return 1;
+      }
+   }
+   return 0;
+}
+
+// True if returnvalue cannot be read after a call whose following
+// statements are stmts before another call resets a0
+// - nested is set when stmts is inside an if or while, so the code
+//   after the list is not known
+static int retValSafeAfter(ASTNode* stmts, int nested)
+{
+   int i;
+   for (; stmts; stmts = stmts->next) {
+      if (stmts->type == AST_FUNCALL)
+         return !readsRetVal(stmts->child[0]);  // args are read first
+      for (i=0; i < ASTNUMCHILDREN; i++)
+         if (readsRetVal(stmts->child[i]))
+            return 0;
+   }
+   return !nested || !callerReadsRetVal;
+}
+
+typedef struct
+{
+   char **names;         // new name and symbol id of each callee var
+   SymId *ids;
+   int base;
+   ASTNode ***links;     // where the next copy goes, by depth
+   ASTNode **copies;     // node last copied, by depth
+   int maxDepth;
+} CopyState;
+
+// Copy a node when it is first visited, and point the copies of
+// each of its child lists into it
+static int copyVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   CopyState* cs = (CopyState*) arg;
+   ASTNode* copy;
+   int i;
+   if (phase == 0) {
+      copy = newASTNode(node->type);
+      *copy = *node;
+      copy->next = NULL;
+      for (i=0; i < ASTNUMCHILDREN; i++)
+         copy->child[i] = NULL;
+      if ((node->type == AST_VARREF || node->type == AST_ASSIGNMENT) &&
+          (node->varKind == V_PARAM || node->varKind == V_LOCAL)) {
+         copy->strval = cs->names[node->ival];
+         copy->sym = cs->ids[node->ival];
+         copy->ival = node->ival + cs->base;
+         copy->varKind = V_LOCAL;
+      }
+      numNodesCopied++;
+      *cs->links[depth] = copy;
+      cs->links[depth] = &copy->next;
+      cs->copies[depth] = copy;
+   }
+   if (phase == ASTNUMCHILDREN)
+      return VISITDONE;
+   if (node->child[phase]) {
+      if (depth+1 == cs->maxDepth) {
+         cs->maxDepth *= 2;
+         cs->links = (ASTNode***) realloc(cs->links, cs->maxDepth * sizeof(ASTNode**));
+         cs->copies = (ASTNode**) realloc(cs->copies, cs->maxDepth * sizeof(ASTNode*));
+      }
+      cs->links[depth+1] = &cs->copies[depth]->child[phase];
+   }
+   return phase;
+}
+
+// Copy a tree and its sibling list, moving the callee's vars
+// - names[v] and ids[v] are the new name and symbol id of callee
+//   var v, base is added to its number
+static ASTNode* copyTree(ASTNode* node, char** names, SymId* ids, int base)
+{
+   ASTNode* head = NULL;
+   CopyState cs;
+   cs.names = names;
+   cs.ids = ids;
+   cs.base = base;
+   cs.maxDepth = 64;
+   cs.links = (ASTNode***) malloc(cs.maxDepth * sizeof(ASTNode**));
+   cs.copies = (ASTNode**) malloc(cs.maxDepth * sizeof(ASTNode*));
+   cs.links[0] = &head;
+   visitAST(node, 0, copyVisit, &cs);
+   free(cs.links);
+   free(cs.copies);
+   return head;
+}
+
+// Add a local var declaration to the caller
+static void addLocal(ASTNode* decl, char* name, SymId sym, int num)
+{
+   ASTNode *local, **link;
+   if (!caller)
+      return;  // the program block has no decl list, see lowerProgramBlock()
+   local = newASTNode(AST_VARDECL);
+   local->valType = decl->valType;
+   local->varKind = V_LOCAL;
+   local->strval = name;
+   local->sym = sym;
+   local->ival = num;
+   for (link = &caller->child[2]; *link; link = &(*link)->next)  // child 2 is locals
+      ;
+   *link = local;
+}
+
+// Build the statements that replace a call to funcs[f]
+// - returns NULL if the call is not inlined; *empty is set if it is
+//   inlined into no statements at all
+static ASTNode* expandCall(ASTNode* call, int f, int* empty)
+{
+   ASTNode *callee = funcs[f], *decl, *arg, *stmts, *assign;
+   ASTNode *head = NULL, **link = &head;
+   char **names, buf[256];
+   SymId* ids;
+   int i, numArgs = 0, numParams = 0, numVars = 0, base = nextVar;
+
+   *empty = 0;
+   for (arg = call->child[0]; arg; arg = arg->next)
+      numArgs++;
+   for (decl = callee->child[1]; decl; decl = decl->next)  // child 1 is params
+      numParams++;
+   if (numArgs != numParams)
+      return NULL;
+   for (decl = callee->child[1]; decl; decl = decl->next)
+      if (decl->ival >= numVars)
+         numVars = decl->ival+1;
+   for (decl = callee->child[2]; decl; decl = decl->next)  // child 2 is locals
+      if (decl->ival >= numVars)
+         numVars = decl->ival+1;
+
+   names = (char**) calloc(numVars+1, sizeof(char*));
+   ids = (SymId*) calloc(numVars+1, sizeof(SymId));
+   for (i=1; i <= 2; i++)   // params, then locals
+      for (decl = callee->child[i]; decl; decl = decl->next) {
+         snprintf(buf, sizeof(buf), "%s.%s.%d", callee->strval, decl->strval, siteNum);
+         names[decl->ival] = internString(buf);
+         ids[decl->ival] = addSymbolId(symbols, names[decl->ival], decl->valType, 0,
+                                       base + decl->ival, V_LOCAL);
+         addLocal(decl, names[decl->ival], ids[decl->ival], base + decl->ival);
+      }
+   nextVar += numVars;
+
+   // param = arg, in order
+   for (decl = callee->child[1], arg = call->child[0]; decl;
+        decl = decl->next, arg = arg->next) {
+      assign = newASTNode(AST_ASSIGNMENT);
+      assign->valType = decl->valType;
+      assign->varKind = V_LOCAL;
+      assign->strval = names[decl->ival];
+      assign->sym = ids[decl->ival];
+      assign->ival = base + decl->ival;
+      assign->child[0] = arg->child[0];
+      *link = assign;
+      link = &assign->next;
+   }
+   stmts = copyTree(callee->child[0], names, ids, base);  // child 0 is statements
+   *link = stmts;
+   free(names);
+   free(ids);
+   *empty = head == NULL;
+   return head;
+}
+
+// Inline the calls in a statement list
+// - returns the new head of the list, since an inlined call may
+//   change it
+static ASTNode* inlineStatements(ASTNode* list, int nested)
+{
+   ASTNode *node, *repl, *tail;
+   ASTNode** link = &list;
+   int f, empty;
+
+   while ((node = *link) != NULL) {
+      switch (node->type) {
+       case AST_WHILE:
+       case AST_IFTHEN:
+          node->child[1] = inlineStatements(node->child[1], 1);
+          if (node->type == AST_IFTHEN)
+             node->child[2] = inlineStatements(node->child[2], 1);
+          break;
+       case AST_FUNCALL:
+          f = findFunc(node);
+          if (f < 0)
+             break;  // library function
+          numCallSites++;
+          siteNum++;
+          if (recursive[f] || bodySize[f] > inlineLimit ||
+              readsRetVal(funcs[f]->child[0]) || !retValSafeAfter(node->next, nested))
+             break;
+          repl = expandCall(node, f, &empty);
+          if (!repl && !empty)
+             break;
+          numInlined++;
+          if (debug)
+             fprintf(stderr, "inline: call %d in %s to %s inlined (%d nodes)\n",
+                     siteNum, callerName, node->strval, bodySize[f]);
+          if (!repl) {
+             *link = node->next;
+             continue;
+          }
+          for (tail = repl; tail->next; tail = tail->next)
+             ;
+          tail->next = node->next;
+          *link = repl;
+          link = &tail->next;  // do not look at the copy again
+          continue;
+       default:
+          break;
+      }
+      link = &node->next;
+   }
+   return list;
+}
+
+// Set up the caller state for a function (or the program, if func
+// is NULL) and inline the calls in its statements
+static ASTNode* inlineInto(ASTNode* func, ASTNode* stmts)
+{
+   ASTNode* decl;
+   caller = func;
+   callerName = func ? func->strval : "program";
+   callerReadsRetVal = readsRetVal(stmts);
+   nextVar = 0;
+   siteNum = 0;
+   if (func) {
+      for (decl = func->child[1]; decl; decl = decl->next)  // params
+         if (decl->ival >= nextVar)
+            nextVar = decl->ival+1;
+      for (decl = func->child[2]; decl; decl = decl->next)  // locals
+         if (decl->ival >= nextVar)
+            nextVar = decl->ival+1;
+   }
+   return inlineStatements(stmts, 0);
+}
+
+static void inlineBottomUp(int f);
+
+// Handle the callees in a statement list before the caller
+static void visitCallees(ASTNode* stmts)
+{
+   int c;
+   for (; stmts; stmts = stmts->next) {
+      if (stmts->type == AST_FUNCALL && (c = findFunc(stmts)) >= 0 && !done[c])
+         inlineBottomUp(c);
+      else if (stmts->type == AST_WHILE || stmts->type == AST_IFTHEN) {
+         visitCallees(stmts->child[1]);
+         visitCallees(stmts->child[2]);
+      }
+   }
+}
+
+// Inline into funcs[f] after its callees (depth first)
+static void inlineBottomUp(int f)
+{
+   done[f] = 1;  // also stops the walk at recursive calls
+   visitCallees(funcs[f]->child[0]);  // child 0 is statements
+   funcs[f]->child[0] = inlineInto(funcs[f], funcs[f]->child[0]);
+   bodySize[f] = countASTNodes(funcs[f]->child[0]);
+}
+
+// Inline small functions into every function and the program block
+// - returns the number of call sites inlined
+int inlineFunctions(ASTNode* program)
+{
+   ASTNode* func;
+   char* seen;
+   int i, j, before = numInlined;
+
+   if (!program || inlineLimit <= 0)
+      return 0;
+   numFuncs = 0;
+   for (func = program->child[1]; func; func = func->next)  // child 1 is functions
+      numFuncs++;
+   funcs = (ASTNode**) malloc((numFuncs+1)*sizeof(ASTNode*));
+   done = (int*) calloc(numFuncs+1, sizeof(int));
+   recursive = (int*) calloc(numFuncs+1, sizeof(int));
+   bodySize = (int*) calloc(numFuncs+1, sizeof(int));
+   seen = (char*) malloc(numFuncs+1);
+   funcIndex = (int*) malloc(symbols->numIds * sizeof(int));
+   for (i=0; i < symbols->numIds; i++)
+      funcIndex[i] = -1;
+   for (i=0, func = program->child[1]; func; func = func->next) {
+      if (funcIndex[func->sym] < 0)
+         funcIndex[func->sym] = i;
+      funcs[i++] = func;
+   }
+   for (i=0; i < numFuncs; i++) {
+      for (j=0; j < numFuncs; j++)
+         seen[j] = 0;
+      recursive[i] = reaches(funcs[i]->child[0], i, seen);
+   }
+
+   for (i=0; i < numFuncs; i++)
+      if (!done[i])
+         inlineBottomUp(i);
+   program->child[2] = inlineInto(NULL, program->child[2]); // child 2 is program
+
+   free(funcs);
+   free(done);
+   free(recursive);
+   free(bodySize);
+   free(seen);
+   free(funcIndex);
+   funcs = NULL;
+   funcIndex = NULL;
+   return numInlined - before;
+}
+
+void printInlineStats(FILE *out)
+{
+   fprintf(out, "inline: %d of %d call sites inlined, %d AST nodes copied (limit %d)\n",
+           numInlined, numCallSites, numNodesCopied, inlineLimit);
+}
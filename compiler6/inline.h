@@ -0,0 +1,21 @@
+//
+// AST Function Inliner Interface
+// - replaces calls to small, non-recursive J functions with a copy
+//   of the function body; works in place on the AST before it is
+//   folded and lowered
+//
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdio.h>
+#include "astree.h"
+#include "compiler.h"
+
+#define DEFAULTINLINELIMIT 40  // max AST nodes in an inlined body
+
+extern THREADLOCAL int inlineLimit;  // -finline-limit=N, 0 turns inlining off
+
+int inlineFunctions(ASTNode *program);
+void printInlineStats(FILE *out);
+
+#endif
@@ -0,0 +1,92 @@
+//
+// Memory-Mapped Source Input
+// - see input.h for the interface
+// - an anonymous mapping of the file size plus 2, rounded up to
+//   whole pages, is made first and the file is mapped over its
+//   start; the rest of the file's last page reads as zeros, and so
+//   does the anonymous page after it when the file ends right at a
+//   page boundary, so the trailing NULs are there without copying
+//
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+
+// Map a source file
+// - returns 0, or -1 if the file cannot be mapped (in which case
+//   it should be read the normal way)
+int mapInputFile(const char* path, InputText* in)
+{
+   struct stat st;
+   size_t page = (size_t) sysconf(_SC_PAGESIZE);
+   char* base;
+   int fd = open(path, O_RDONLY);
+
+   in->data = NULL;
+   in->size = in->mapSize = 0;
+   if (fd < 0)
+      return -1;
+   if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+      close(fd);
+      return -1;
+   }
+   in->size = (size_t) st.st_size;
+   in->mapSize = (in->size + 2 + page-1) & ~(page-1);
+   base = (char*) mmap(NULL, in->mapSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (base == MAP_FAILED) {
+      close(fd);
+      return -1;
+   }
+   if (mmap(base, in->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+            fd, 0) == MAP_FAILED) {
+      munmap(base, in->mapSize);
+      close(fd);
+      return -1;
+   }
+   close(fd);  // the mapping keeps the file
+   madvise(base, in->size, MADV_SEQUENTIAL);
+   in->data = base;
+   return 0;
+}
+
+// Read all of a stream (stdin, a pipe) into memory
+// - returns 0, or -1 on a read error or if memory runs out
+int readInputFile(FILE* f, InputText* in)
+{
+   size_t max = 64*1024, n;
+   char* data;
+
+   in->size = in->mapSize = 0;
+   in->data = (char*) malloc(max);
+   while (in->data) {
+      n = fread(in->data + in->size, 1, max - 2 - in->size, f);
+      in->size += n;
+      if (in->size < max - 2)
+         break;  // end of input (or an error)
+      max *= 2;
+      data = (char*) realloc(in->data, max);
+      if (!data)
+         free(in->data);
+      in->data = data;
+   }
+   if (!in->data || ferror(f)) {
+      freeInputText(in);
+      return -1;
+   }
+   in->data[in->size] = in->data[in->size+1] = '\0';
+   return 0;
+}
+
+// Release a mapped or read input
+void freeInputText(InputText* in)
+{
+   if (in->data && in->mapSize)
+      munmap(in->data, in->mapSize);
+   else
+      free(in->data);
+   in->data = NULL;
+   in->size = in->mapSize = 0;
+}
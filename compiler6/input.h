@@ -0,0 +1,30 @@
+//
+// Memory-Mapped Source Input Interface
+// - maps a source file into memory so the scanner can work on it
+//   in place (see compileInPlace() in compiler.h) instead of
+//   reading it through stdio and flex's own buffers
+// - the mapping is private and writable: flex writes a NUL after
+//   each token while it is being matched, and that must not reach
+//   the file; the two NULs flex wants after the text are there too
+// - only regular files can be mapped; for stdin, pipes, and empty
+//   files mapInputFile() fails, and readInputFile() reads them into
+//   a malloc'd buffer laid out the same way
+//
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct
+{
+   char *data;      // file text, followed by two NULs
+   size_t size;     // bytes of file text
+   size_t mapSize;  // bytes mapped, page rounded, 0 if malloc'd
+} InputText;
+
+int mapInputFile(const char *path, InputText *in);
+int readInputFile(FILE *f, InputText *in);
+void freeInputText(InputText *in);
+
+#endif
@@ -0,0 +1,121 @@
+//
+// String Interning Module
+// - the intern table is an open-addressing hash table (linear
+//   probing) of pointers to unique strings; the strings themselves
+//   live in an arena owned by this module
+// - the table doubles in size when it becomes 3/4 full
+//
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+#include "compiler.h"
+#include "arena.h"
+
+#define INITIALSLOTS 1024  // must be a power of two
+
+typedef struct
+{
+   char *str;          // interned string, NULL if slot is empty
+   unsigned int hash;  // full hash of str, saves rehashing on growth
+} InternSlot;
+
+static THREADLOCAL InternSlot *slots = NULL;
+static THREADLOCAL unsigned int numSlots = 0;
+static THREADLOCAL unsigned int numStrings = 0;
+static THREADLOCAL unsigned long numLookups = 0;
+static THREADLOCAL Arena *stringArena = NULL;
+
+// FNV-1a string hash
+// - also used by other modules that need a good string hash
+unsigned int stringHash(const char *str)
+{
+   unsigned int h = 2166136261u;
+   while (*str) {
+      h ^= (unsigned char) *str++;
+      h *= 16777619u;
+   }
+   return h;
+}
+
+// Double the number of slots and reinsert every string
+static int growInternTable()
+{
+   unsigned int i, j, newNum = numSlots ? numSlots*2 : INITIALSLOTS;
+   InternSlot *newSlots = (InternSlot*) calloc(newNum, sizeof(InternSlot));
+   if (!newSlots)
+      return -1;
+   for (i=0; i < numSlots; i++) {
+      if (!slots[i].str)
+         continue;
+      j = slots[i].hash & (newNum-1);
+      while (newSlots[j].str)
+         j = (j+1) & (newNum-1);
+      newSlots[j] = slots[i];
+   }
+   free(slots);
+   slots = newSlots;
+   numSlots = newNum;
+   return 0;
+}
+
+// Return the unique interned copy of str
+// - the string is copied into the table the first time it is seen
+// - returns NULL only if memory runs out
+char* internString(const char *str)
+{
+   return internStringLen(str, strlen(str));
+}
+
+// Return the unique interned copy of the len chars at str
+// - str need not be NUL terminated, so the scanner can intern token
+//   text right where it sits in the input buffer
+char* internStringLen(const char *str, size_t len)
+{
+   unsigned int h = 2166136261u, i;
+   numLookups++;
+   if (numStrings*4 >= numSlots*3 && growInternTable() < 0)
+      return NULL;
+   for (i=0; i < len; i++) {  // FNV-1a, same as stringHash()
+      h ^= (unsigned char) str[i];
+      h *= 16777619u;
+   }
+   i = h & (numSlots-1);
+   while (slots[i].str) {
+      if (slots[i].hash == h && !strncmp(slots[i].str, str, len) &&
+          slots[i].str[len] == '\0')
+         return slots[i].str;
+      i = (i+1) & (numSlots-1);
+   }
+   if (!stringArena)
+      stringArena = newArena(0);
+   if (!stringArena)
+      return NULL;
+   slots[i].str = (char*) arenaAlloc(stringArena, len+1);
+   if (!slots[i].str)
+      return NULL;
+   memcpy(slots[i].str, str, len);
+   slots[i].str[len] = '\0';
+   slots[i].hash = h;
+   numStrings++;
+   return slots[i].str;
+}
+
+// Free the table and every interned string
+void freeInternTable()
+{
+   free(slots);
+   slots = NULL;
+   numSlots = 0;
+   numStrings = 0;
+   numLookups = 0;
+   freeArena(stringArena);
+   stringArena = NULL;
+}
+
+// Print interning statistics
+void printInternStats(FILE *out)
+{
+   fprintf(out, "Interned strings: %u distinct from %lu lookups, %u slots\n",
+           numStrings, numLookups, numSlots);
+   printArenaStats(stringArena, "String", out);
+}
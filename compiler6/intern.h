@@ -0,0 +1,20 @@
+//
+// String Interning Module Interface
+// - every distinct identifier or string literal is stored exactly
+//   once; internString() always returns the same pointer for the
+//   same contents, so interned strings can be compared with ==
+// - interned strings must never be modified or freed by callers;
+//   they all stay valid until freeInternTable() is called
+//
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdio.h>
+
+char *internString(const char *str);
+char *internStringLen(const char *str, size_t len);
+unsigned int stringHash(const char *str);
+void freeInternTable();
+void printInternStats(FILE *out);
+
+#endif
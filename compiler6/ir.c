@@ -0,0 +1,390 @@
+//
+// Three-Address IR Module
+// - construction helpers, CFG maintenance, and an IR printer
+// - see ir.h for what the instructions mean
+//
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "compiler.h"
+
+// Create a new, empty IR function
+IRFunc* newIRFunc(char* name, int isProgram)
+{
+   IRFunc* func = (IRFunc*) calloc(1, sizeof(IRFunc));
+   if (!func)
+      return NULL;
+   func->name = name;
+   func->isProgram = isProgram;
+   return func;
+}
+
+static void freeIRBlock(IRBlock* block)
+{
+   free(block->instrs);
+   free(block->preds);
+   free(block->note);
+   free(block);
+}
+
+// Free an IR function along with all of its blocks
+void freeIRFunc(IRFunc* func)
+{
+   int i;
+   if (!func)
+      return;
+   for (i=0; i < func->numBlocks; i++)
+      freeIRBlock(func->blocks[i]);
+   free(func->blocks);
+   free(func);
+}
+
+// Append a new empty block to the function's block list
+IRBlock* newIRBlock(IRFunc* func)
+{
+   IRBlock* block = (IRBlock*) calloc(1, sizeof(IRBlock));
+   if (!block)
+      return NULL;
+   if (func->numBlocks == func->maxBlocks) {
+      func->maxBlocks = func->maxBlocks ? func->maxBlocks*2 : 16;
+      func->blocks = (IRBlock**) realloc(func->blocks, func->maxBlocks*sizeof(IRBlock*));
+   }
+   block->id = func->numBlocks;
+   block->label = func->numLabels++;  // unique within the function
+   func->blocks[func->numBlocks++] = block;
+   return block;
+}
+
+// Create a new empty block at position pos of the block list
+// - the blocks from pos on move down one, and all ids are renumbered
+IRBlock* insertIRBlock(IRFunc* func, int pos)
+{
+   int i;
+   IRBlock* block = newIRBlock(func);
+   if (!block)
+      return NULL;
+   memmove(&func->blocks[pos+1], &func->blocks[pos],
+           (func->numBlocks-1-pos)*sizeof(IRBlock*));
+   func->blocks[pos] = block;
+   for (i=0; i < func->numBlocks; i++)
+      func->blocks[i]->id = i;
+   return block;
+}
+
+// Get a new temporary vreg
+int newVReg(IRFunc* func)
+{
+   return func->numVRegs++;
+}
+
+// Insert an instruction at position pos in a block
+// - returns the new instruction so callers can set sym/target/relop
+IRInstr* insertIR(IRBlock* block, int pos, IROp op, int dst, int src1, int src2, int imm)
+{
+   IRInstr* ins;
+   if (block->numInstrs == block->maxInstrs) {
+      block->maxInstrs = block->maxInstrs ? block->maxInstrs*2 : 8;
+      block->instrs = (IRInstr*) realloc(block->instrs, block->maxInstrs*sizeof(IRInstr));
+   }
+   memmove(&block->instrs[pos+1], &block->instrs[pos],
+           (block->numInstrs-pos)*sizeof(IRInstr));
+   block->numInstrs++;
+   ins = &block->instrs[pos];
+   memset(ins, 0, sizeof(IRInstr));
+   ins->op = op;
+   ins->dst = dst;
+   ins->src1 = src1;
+   ins->src2 = src2;
+   ins->imm = imm;
+   return ins;
+}
+
+// Insert a copy of an existing instruction at position pos
+IRInstr* insertIRCopy(IRBlock* block, int pos, IRInstr* ins)
+{
+   IRInstr copy = *ins;  // ins may point into block->instrs
+   IRInstr* n = insertIR(block, pos, copy.op, copy.dst, copy.src1, copy.src2, copy.imm);
+   *n = copy;
+   return n;
+}
+
+// Append an instruction to the end of a block
+IRInstr* emitIR(IRBlock* block, IROp op, int dst, int src1, int src2, int imm)
+{
+   return insertIR(block, block->numInstrs, op, dst, src1, src2, imm);
+}
+
+// Remove the instruction at position pos from a block
+void removeIR(IRBlock* block, int pos)
+{
+   memmove(&block->instrs[pos], &block->instrs[pos+1],
+           (block->numInstrs-pos-1)*sizeof(IRInstr));
+   block->numInstrs--;
+}
+
+int isTerminator(IROp op)
+{
+   return op == IR_BR || op == IR_JUMP || op == IR_RET;
+}
+
+// The block's terminator, or NULL if it has none (yet)
+IRInstr* blockTerminator(IRBlock* block)
+{
+   if (block->numInstrs == 0 || !isTerminator(block->instrs[block->numInstrs-1].op))
+      return NULL;
+   return &block->instrs[block->numInstrs-1];
+}
+
+int numSuccs(IRBlock* block)
+{
+   IRInstr* term = blockTerminator(block);
+   if (!term || term->op == IR_RET)
+      return 0;
+   return term->op == IR_BR ? 2 : 1;
+}
+
+IRBlock* blockSucc(IRBlock* block, int n)
+{
+   return blockTerminator(block)->target[n];
+}
+
+// Fill uses[] with the vregs an instruction reads
+// - returns how many there are (0 to 2); ZEROVREG is not counted
+int irUses(IRInstr* ins, int* uses)
+{
+   int n = 0;
+   if (ins->src1 >= 0)
+      uses[n++] = ins->src1;
+   if (ins->src2 >= 0)
+      uses[n++] = ins->src2;
+   return n;
+}
+
+// True if an instruction must be kept even if its dst is unused,
+// or must not be moved or merged with an identical one
+int irHasSideEffects(IRInstr* ins)
+{
+   switch (ins->op) {
+    case IR_STOREG: case IR_STORE: case IR_ARG: case IR_CALL:
+    case IR_GETRET: case IR_BR: case IR_JUMP: case IR_RET:
+       return 1;
+    default:
+       return 0;
+   }
+}
+
+// Recompute predecessor lists and block ids from the terminators
+void buildCFG(IRFunc* func)
+{
+   int i, j;
+   IRBlock *b, *s;
+   for (i=0; i < func->numBlocks; i++) {
+      func->blocks[i]->id = i;
+      func->blocks[i]->numPreds = 0;
+   }
+   for (i=0; i < func->numBlocks; i++) {
+      b = func->blocks[i];
+      for (j=0; j < numSuccs(b); j++) {
+         s = blockSucc(b, j);
+         if (s->numPreds == s->maxPreds) {
+            s->maxPreds = s->maxPreds ? s->maxPreds*2 : 4;
+            s->preds = (IRBlock**) realloc(s->preds, s->maxPreds*sizeof(IRBlock*));
+         }
+         s->preds[s->numPreds++] = b;
+      }
+   }
+}
+
+// Delete blocks that cannot be reached from the entry block
+// - returns the number of blocks removed; the CFG is rebuilt
+int removeUnreachableBlocks(IRFunc* func)
+{
+   int i, j, n, removed;
+   char* seen = (char*) calloc(func->numBlocks, 1);
+   IRBlock** work = (IRBlock**) malloc(func->numBlocks*sizeof(IRBlock*));
+   IRBlock* b;
+
+   buildCFG(func);
+   n = 0;
+   work[n++] = func->blocks[0];
+   seen[0] = 1;
+   while (n > 0) {
+      b = work[--n];
+      for (j=0; j < numSuccs(b); j++)
+         if (!seen[blockSucc(b, j)->id]) {
+            seen[blockSucc(b, j)->id] = 1;
+            work[n++] = blockSucc(b, j);
+         }
+   }
+   for (i=0, j=0; i < func->numBlocks; i++) {
+      if (seen[i])
+         func->blocks[j++] = func->blocks[i];
+      else
+         freeIRBlock(func->blocks[i]);
+   }
+   removed = func->numBlocks - j;
+   func->numBlocks = j;
+   free(seen);
+   free(work);
+   buildCFG(func);
+   return removed;
+}
+
+// Number the blocks reachable from the entry in reverse postorder
+// - order receives the blocks by rpoNum; returns how many there are
+static int reversePostorder(IRFunc* func, IRBlock** order)
+{
+   int i, n, sp = 0, count = func->numBlocks;
+   IRBlock** stack = (IRBlock**) malloc(func->numBlocks*sizeof(IRBlock*));
+   int* nextSucc = (int*) calloc(func->numBlocks, sizeof(int));
+   IRBlock *b, *s;
+
+   for (i=0; i < func->numBlocks; i++)
+      func->blocks[i]->rpoNum = -1;
+   stack[sp++] = func->blocks[0];
+   func->blocks[0]->rpoNum = 0;   // marks it as seen
+   while (sp > 0) {
+      b = stack[sp-1];
+      if (nextSucc[b->id] < numSuccs(b)) {
+         s = blockSucc(b, nextSucc[b->id]++);
+         if (s->rpoNum < 0) {
+            s->rpoNum = 0;
+            stack[sp++] = s;
+         }
+         continue;
+      }
+      sp--;
+      order[--count] = b;  // postorder, filled from the back
+   }
+   n = func->numBlocks - count;
+   memmove(order, order+count, n*sizeof(IRBlock*));
+   for (i=0; i < func->numBlocks; i++)
+      func->blocks[i]->rpoNum = -1;
+   for (i=0; i < n; i++)
+      order[i]->rpoNum = i;
+   free(stack);
+   free(nextSucc);
+   return n;
+}
+
+// Compute the immediate dominator of every reachable block
+// - iterative algorithm of Cooper, Harvey and Kennedy over the
+//   reverse postorder; the entry's idom is itself and unreachable
+//   blocks get NULL
+// - needs up to date predecessor lists (buildCFG)
+void computeDominators(IRFunc* func)
+{
+   int i, j, n, changed;
+   IRBlock** order = (IRBlock**) malloc(func->numBlocks*sizeof(IRBlock*));
+   IRBlock *b, *p, *newIdom, *x, *y;
+
+   n = reversePostorder(func, order);
+   for (i=0; i < func->numBlocks; i++)
+      func->blocks[i]->idom = NULL;
+   order[0]->idom = order[0];
+   do {
+      changed = 0;
+      for (i=1; i < n; i++) {
+         b = order[i];
+         newIdom = NULL;
+         for (j=0; j < b->numPreds; j++) {
+            p = b->preds[j];
+            if (!p->idom)
+               continue;  // not processed yet, or unreachable
+            if (!newIdom) {
+               newIdom = p;
+               continue;
+            }
+            // walk both up the tree to their common dominator
+            x = p; y = newIdom;
+            while (x != y) {
+               while (x->rpoNum > y->rpoNum)
+                  x = x->idom;
+               while (y->rpoNum > x->rpoNum)
+                  y = y->idom;
+            }
+            newIdom = x;
+         }
+         if (b->idom != newIdom) {
+            b->idom = newIdom;
+            changed = 1;
+         }
+      }
+   } while (changed);
+   free(order);
+}
+
+// True if block a dominates block b (every block dominates itself)
+// - uses the idoms from the last computeDominators()
+int dominates(IRBlock* a, IRBlock* b)
+{
+   if (!b->idom)
+      return 0;
+   while (b != a && b->idom != b)
+      b = b->idom;
+   return b == a;
+}
+
+static const char* irOpNames[] = {
+   "li", "la", "lastr", "mov", "add", "sub", "addi", "slli", "loadg",
+   "storeg", "load", "store", "getret", "arg", "call", "br", "jump", "ret"
+};
+
+// Print one vreg operand: params/locals are v<N>, temps t<N>
+static void printVReg(IRFunc* func, int v, FILE* out)
+{
+   if (v == ZEROVREG)
+      fprintf(out, "zero");
+   else if (v < func->numVars)
+      fprintf(out, "v%d", v);
+   else
+      fprintf(out, "t%d", v);
+}
+
+// Print an IR function in a readable form (used for tracing)
+void printIRFunc(IRFunc* func, FILE* out)
+{
+   int i, j;
+   IRBlock* b;
+   IRInstr* ins;
+   fprintf(out, "IR function %s (%d params, %d vars, %d vregs)\n", func->name,
+           func->numParams, func->numVars, func->numVRegs);
+   for (i=0; i < func->numBlocks; i++) {
+      b = func->blocks[i];
+      fprintf(out, " B%d (.L%s_%d) depth %d preds:", b->id, func->name, b->label,
+              b->loopDepth);
+      for (j=0; j < b->numPreds; j++)
+         fprintf(out, " B%d", b->preds[j]->id);
+      fprintf(out, "\n");
+      if (b->note)
+         fprintf(out, "   # %s\n", b->note);
+      for (j=0; j < b->numInstrs; j++) {
+         ins = &b->instrs[j];
+         fprintf(out, "   %-7s", irOpNames[ins->op]);
+         if (ins->dst != NOVREG) {
+            printVReg(func, ins->dst, out);
+            fprintf(out, " =");
+         }
+         if (ins->src1 != NOVREG) {
+            fprintf(out, " ");
+            printVReg(func, ins->src1, out);
+         }
+         if (ins->src2 != NOVREG) {
+            fprintf(out, " ");
+            printVReg(func, ins->src2, out);
+         }
+         if (ins->op == IR_BR)
+            fprintf(out, " (%c) B%d B%d", ins->relop, ins->target[0]->id,
+                    ins->target[1]->id);
+         else if (ins->op == IR_JUMP)
+            fprintf(out, " B%d", ins->target[0]->id);
+         else if (ins->sym != NOSYMID)
+            fprintf(out, " %s", symbols->info[ins->sym].name);
+         if (ins->op == IR_LI || ins->op == IR_ADDI || ins->op == IR_SLLI ||
+             ins->op == IR_LOAD || ins->op == IR_STORE || ins->op == IR_ARG ||
+             ins->op == IR_LASTR || ins->op == IR_CALL)
+            fprintf(out, " #%d", ins->imm);
+         fprintf(out, "\n");
+      }
+   }
+}
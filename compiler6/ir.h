@@ -0,0 +1,121 @@
+//
+// Three-Address IR Interface
+// - each AST_FUNCTION (and the program block) is lowered into an
+//   IRFunc: a list of basic blocks of three-address instructions
+//   over virtual registers (vregs), forming a control flow graph
+// - params and locals are vregs too: param/local number N (the
+//   ival of its AST_VARDECL) is vreg N; the vregs after them are
+//   temporaries, and most temporaries are only assigned once
+// - globals stay in memory and are read and written with
+//   IR_LOADG/IR_STOREG, global arrays with IR_LA + IR_LOAD/IR_STORE;
+//   globals and functions are named by symbol id, and their names
+//   are only looked at when the assembly text is made
+// - every block ends in exactly one terminator (IR_BR, IR_JUMP or
+//   IR_RET), so the CFG edges are explicit and blocks can be
+//   reordered freely
+// - block labels are numbered per function and printed as
+//   .L<function>_<label>, so a function's code does not depend on
+//   what was generated before it (see funcgen.h)
+//
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+#include "astree.h"
+
+#define NOVREG   (-1)   // operand not used
+#define ZEROVREG (-2)   // the constant 0 (the zero register)
+
+typedef enum {
+   IR_LI,      // dst = imm
+   IR_LA,      // dst = address of global sym
+   IR_LASTR,   // dst = address of string constant number imm
+   IR_MOV,     // dst = src1
+   IR_ADD,     // dst = src1 + src2
+   IR_SUB,     // dst = src1 - src2
+   IR_ADDI,    // dst = src1 + imm
+   IR_SLLI,    // dst = src1 << imm
+   IR_LOADG,   // dst = global sym
+   IR_STOREG,  // global sym = src1
+   IR_LOAD,    // dst = word at src1 + imm
+   IR_STORE,   // word at src2 + imm = src1
+   IR_GETRET,  // dst = return value of the last call (a0)
+   IR_ARG,     // argument register number imm = src1 (just before a call)
+   IR_CALL,    // call function sym with imm args
+   IR_BR,      // if (src1 relop src2) goto target[0] else goto target[1]
+   IR_JUMP,    // goto target[0]
+   IR_RET      // return from the function (or exit from the program)
+} IROp;
+
+struct irblock_s;
+
+typedef struct
+{
+   IROp op;
+   int dst;          // vreg written, or NOVREG
+   int src1, src2;   // vregs read, NOVREG, or ZEROVREG
+   int imm;          // immediate, arg number, string number, etc.
+   int relop;        // IR_BR only: '<', '>', '=', or '!' (same as AST)
+   SymId sym;        // global or function, NOSYMID if none (see symtable.h)
+   struct irblock_s *target[2]; // IR_BR/IR_JUMP targets
+} IRInstr;
+
+typedef struct irblock_s
+{
+   int id;               // index in the function's block list
+   int label;            // assembly label number (.L<func>_<label>)
+   IRInstr *instrs;
+   int numInstrs, maxInstrs;
+   struct irblock_s **preds;  // predecessors (filled by buildCFG)
+   int numPreds, maxPreds;
+   int loopDepth;        // loop nesting depth, set by lowering
+   struct irblock_s *idom;    // immediate dominator (computeDominators)
+   int rpoNum;           // reverse postorder number, -1 if unreachable
+   char *note;           // comment emitted with the block, or NULL (malloc'd)
+} IRBlock;
+
+typedef struct
+{
+   char *name;        // function name; "program" for the program block
+   SymId sym;         // function id, NOSYMID for the program block
+   int isProgram;     // program block: no frame, ends with exit
+   int numParams;     // params are vregs 0..numParams-1
+   int numVars;       // params + locals are vregs 0..numVars-1
+   int numVRegs;      // total vregs (vars + temps)
+   IRBlock **blocks;  // blocks in layout order; blocks[0] is the entry
+   int numBlocks, maxBlocks;
+   int numLabels;     // block labels handed out so far
+} IRFunc;
+
+// building
+IRFunc *newIRFunc(char *name, int isProgram);
+void freeIRFunc(IRFunc *func);
+IRBlock *newIRBlock(IRFunc *func);
+IRBlock *insertIRBlock(IRFunc *func, int pos);
+int newVReg(IRFunc *func);
+IRInstr *emitIR(IRBlock *block, IROp op, int dst, int src1, int src2, int imm);
+IRInstr *insertIR(IRBlock *block, int pos, IROp op, int dst, int src1, int src2, int imm);
+IRInstr *insertIRCopy(IRBlock *block, int pos, IRInstr *ins);
+void removeIR(IRBlock *block, int pos);
+
+// queries
+IRInstr *blockTerminator(IRBlock *block);
+int numSuccs(IRBlock *block);
+IRBlock *blockSucc(IRBlock *block, int n);
+int irUses(IRInstr *ins, int *uses);
+int irHasSideEffects(IRInstr *ins);
+int isTerminator(IROp op);
+
+// CFG maintenance
+void buildCFG(IRFunc *func);
+int removeUnreachableBlocks(IRFunc *func);
+void computeDominators(IRFunc *func);
+int dominates(IRBlock *a, IRBlock *b);
+
+void printIRFunc(IRFunc *func, FILE *out);
+
+// lowering from the AST (see lower.c)
+IRFunc *lowerFunction(ASTNode *func);
+IRFunc *lowerProgramBlock(ASTNode *stmts);
+
+#endif
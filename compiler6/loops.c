@@ -0,0 +1,485 @@
+//
+// Loop Optimizations
+// - finds the natural loops of the CFG (a back edge is an edge
+//   to a block that dominates its source), gives every loop a
+//   preheader, and recomputes each block's loop depth
+// - loop-invariant code motion: a pure instruction whose operands
+//   are not written in the loop is moved to the preheader; loads
+//   of globals move too if the loop has no call and does not store
+//   to that global, and so do loads from a fixed global address if
+//   the loop has no call and no store at all
+// - induction variable strength reduction: for a variable whose
+//   only write in the loop is "v = v + c", an array address
+//   base + (v << k) is replaced by a pointer that starts at the
+//   same address in the preheader and is bumped by c << k along
+//   with v
+// - inner loops are done first, so invariants can move out of a
+//   whole nest one loop at a time
+// - only the first MAXLOOPS loops of a function are found; the
+//   rest are left as they are, and counted for -t
+// - under -t each loop header gets a note with what was done,
+//   which the IR dump and the backend show as a comment
+//
+#include <stdlib.h>
+#include <string.h>
+#include "passes.h"
+#include "compiler.h"
+
+#define MAXLOOPS 256
+#define MAXLOOPPTRS 8  // strength reduced pointers per loop
+
+typedef struct
+{
+   IRBlock* header;
+   char* inLoop;       // by block id
+   int numBlocks;
+   IRBlock* preheader;
+   int hasCall, hasStore;
+   int hoisted, reduced;
+} Loop;
+
+// pass state for the function being processed
+static THREADLOCAL IRFunc* curFunc;
+static THREADLOCAL Loop loops[MAXLOOPS];
+static THREADLOCAL int numLoops;
+static THREADLOCAL int numOverflow;          // loops past MAXLOOPS in this function
+static THREADLOCAL int numSkippedLoops = 0;  // ... in all functions, not optimized
+static THREADLOCAL int* funcDefs;    // writes of each vreg in the whole function
+static THREADLOCAL int* loopDefs;    // writes of each vreg inside the current loop
+static THREADLOCAL int* defOp;       // op writing a single-def vreg, or -1
+static THREADLOCAL int* defSrc;      // ... its first operand
+static THREADLOCAL int* defImm;      // ... and its immediate
+
+// Find the natural loops; loops with the same header are merged
+// - needs the dominators to be up to date
+static void findLoops()
+{
+   int i, j, n, sp, numBlocks = curFunc->numBlocks;
+   IRBlock *b, *h, *p;
+   IRBlock** stack = (IRBlock**) malloc(numBlocks*sizeof(IRBlock*));
+   Loop* loop;
+
+   numLoops = numOverflow = 0;
+   for (i=0; i < numBlocks; i++) {
+      b = curFunc->blocks[i];
+      for (j=0; j < numSuccs(b); j++) {
+         h = blockSucc(b, j);
+         if (!dominates(h, b) || h == curFunc->blocks[0])
+            continue;
+         for (loop = NULL, n = 0; n < numLoops; n++)
+            if (loops[n].header == h)
+               loop = &loops[n];
+         if (!loop) {
+            if (numLoops == MAXLOOPS) {
+               numOverflow++;
+               continue;
+            }
+            loop = &loops[numLoops++];
+            memset(loop, 0, sizeof(Loop));
+            loop->header = h;
+            loop->inLoop = (char*) calloc(numBlocks, 1);
+            loop->inLoop[h->id] = 1;
+            loop->numBlocks = 1;
+         }
+         // everything that reaches the latch without the header
+         sp = 0;
+         if (!loop->inLoop[b->id]) {
+            loop->inLoop[b->id] = 1;
+            loop->numBlocks++;
+            stack[sp++] = b;
+         }
+         while (sp > 0) {
+            b = stack[--sp];
+            for (n=0; n < b->numPreds; n++) {
+               p = b->preds[n];
+               if (!loop->inLoop[p->id] && p->idom) {
+                  loop->inLoop[p->id] = 1;
+                  loop->numBlocks++;
+                  stack[sp++] = p;
+               }
+            }
+         }
+         b = curFunc->blocks[i];
+      }
+   }
+   free(stack);
+}
+
+static void freeLoops()
+{
+   int i;
+   for (i=0; i < numLoops; i++)
+      free(loops[i].inLoop);
+   numLoops = 0;
+}
+
+// Make sure the loop is entered through a block that only jumps
+// to the header, creating one just before the header if needed
+// - returns 1 if a block was created
+static int makePreheader(Loop* loop)
+{
+   int i, j, numOutside = 0;
+   IRBlock *h = loop->header, *p, *outside = NULL, *pre;
+   IRInstr* term;
+
+   for (i=0; i < h->numPreds; i++)
+      if (!loop->inLoop[h->preds[i]->id]) {
+         outside = h->preds[i];
+         numOutside++;
+      }
+   if (numOutside == 1 && numSuccs(outside) == 1) {
+      loop->preheader = outside;
+      return 0;
+   }
+   pre = insertIRBlock(curFunc, h->id);
+   pre->loopDepth = h->loopDepth;
+   for (i=0; i < h->numPreds; i++) {
+      p = h->preds[i];
+      if (loop->inLoop[p->id])
+         continue;
+      term = blockTerminator(p);
+      for (j=0; j < numSuccs(p); j++)
+         if (term->target[j] == h)
+            term->target[j] = pre;
+   }
+   emitIR(pre, IR_JUMP, NOVREG, NOVREG, NOVREG, 0)->target[0] = h;
+   return 1;
+}
+
+// True if operand v does not change inside the current loop
+static int isInvariant(int v)
+{
+   return v < 0 || loopDefs[v] == 0;
+}
+
+// True if ins can be moved to the preheader of loop
+static int canHoist(Loop* loop, IRInstr* ins)
+{
+   int i, j;
+   IRBlock* b;
+   if (ins->dst < curFunc->numVars || funcDefs[ins->dst] != 1)
+      return 0;  // only single-assigned temps
+   if (!isInvariant(ins->src1) || !isInvariant(ins->src2))
+      return 0;
+   switch (ins->op) {
+    case IR_LA: case IR_ADD: case IR_SUB: case IR_ADDI: case IR_SLLI:
+       return 1;
+    case IR_LOADG:
+       if (loop->hasCall)
+          return 0;
+       for (i=0; i < curFunc->numBlocks; i++) {
+          b = curFunc->blocks[i];
+          if (!loop->inLoop[i])
+             continue;
+          for (j=0; j < b->numInstrs; j++)
+             if (b->instrs[j].op == IR_STOREG && b->instrs[j].sym == ins->sym)
+                return 0;
+       }
+       return 1;
+    case IR_LOAD:
+       // the address must be a global's, so the load cannot fault
+       return !loop->hasCall && !loop->hasStore && ins->src1 >= 0 &&
+              defOp[ins->src1] == IR_LA;
+    default:
+       return 0;  // li/lastr are as cheap as keeping them in a register
+   }
+}
+
+// Make every instruction that reads vreg from read vreg to
+static void renameUses(int from, int to)
+{
+   int i, j;
+   IRInstr* ins;
+   for (i=0; i < curFunc->numBlocks; i++)
+      for (j=0; j < curFunc->blocks[i]->numInstrs; j++) {
+         ins = &curFunc->blocks[i]->instrs[j];
+         if (ins->src1 == from)
+            ins->src1 = to;
+         if (ins->src2 == from)
+            ins->src2 = to;
+      }
+}
+
+// True if the value prev computes at position k of the preheader
+// is still what ins would compute at the end of it
+// - a load is only reused if nothing after it in the preheader can
+//   write the memory it read; the preheader may be an existing
+//   block of the function, with stores and calls in it
+static int canReuse(IRBlock* pre, int k, IRInstr* ins)
+{
+   IRInstr* later;
+   if (ins->op != IR_LOADG && ins->op != IR_LOAD)
+      return 1;
+   for (k++; k < pre->numInstrs; k++) {
+      later = &pre->instrs[k];
+      if (later->op == IR_CALL || later->op == IR_STORE)
+         return 0;
+      if (later->op == IR_STOREG && (ins->op == IR_LOAD || later->sym == ins->sym))
+         return 0;
+   }
+   return 1;
+}
+
+// Move every invariant instruction of the loop to its preheader
+static void hoistInvariants(Loop* loop)
+{
+   int i, j, k, moved;
+   IRBlock *b, *pre = loop->preheader;
+   IRInstr *ins, *prev;
+   do {
+      moved = 0;
+      for (i=0; i < curFunc->numBlocks; i++) {
+         b = curFunc->blocks[i];
+         if (!loop->inLoop[i])
+            continue;
+         for (j=0; j < b->numInstrs; j++) {
+            ins = &b->instrs[j];
+            if (!canHoist(loop, ins))
+               continue;
+            loopDefs[ins->dst]--;
+            // an identical instruction may already be in the preheader
+            for (k=0; k < pre->numInstrs-1; k++) {
+               prev = &pre->instrs[k];
+               if (prev->op == ins->op && prev->src1 == ins->src1 &&
+                   prev->src2 == ins->src2 && prev->imm == ins->imm &&
+                   prev->sym == ins->sym && prev->dst >= curFunc->numVars &&
+                   funcDefs[prev->dst] == 1 && canReuse(pre, k, ins))
+                  break;
+            }
+            if (k < pre->numInstrs-1) {
+               renameUses(ins->dst, prev->dst);
+               funcDefs[ins->dst] = 0;
+               defOp[ins->dst] = -1;
+            } else
+               insertIRCopy(pre, pre->numInstrs-1, ins);
+            removeIR(b, j--);
+            loop->hoisted++;
+            moved = 1;
+         }
+      }
+   } while (moved);
+}
+
+// Find "v = v + c", the only write of var v in the loop
+// - returns its block and sets *pos, or returns NULL
+static IRBlock* findIncrement(Loop* loop, int v, int* pos)
+{
+   int i, j;
+   IRBlock* b;
+   IRInstr* ins;
+   if (v < 0 || v >= curFunc->numVars || loopDefs[v] != 1)
+      return NULL;
+   for (i=0; i < curFunc->numBlocks; i++) {
+      b = curFunc->blocks[i];
+      if (!loop->inLoop[i])
+         continue;
+      for (j=0; j < b->numInstrs; j++) {
+         ins = &b->instrs[j];
+         if (ins->dst != v)
+            continue;
+         if (ins->op != IR_ADDI || ins->src1 != v)
+            return NULL;
+         *pos = j;
+         return b;
+      }
+   }
+   return NULL;
+}
+
+// Count the reads of vreg v in the whole function
+static int countUses(int v)
+{
+   int i, j, n = 0;
+   IRInstr* ins;
+   for (i=0; i < curFunc->numBlocks; i++)
+      for (j=0; j < curFunc->blocks[i]->numInstrs; j++) {
+         ins = &curFunc->blocks[i]->instrs[j];
+         n += (ins->src1 == v) + (ins->src2 == v);
+      }
+   return n;
+}
+
+// Turn base + (v << k) address computations into bumped pointers
+static void reduceInductionVars(Loop* loop)
+{
+   int i, j, k, n, s, v, t, base, shift, step, incPos, ptr, found;
+   int ptrV[MAXLOOPPTRS], ptrBase[MAXLOOPPTRS], ptrShift[MAXLOOPPTRS];
+   int ptrReg[MAXLOOPPTRS], numPtrs = 0;
+   IRBlock *b, *incBlock, *pre = loop->preheader;
+   IRInstr* ins;
+
+   for (i=0; i < curFunc->numBlocks; i++) {
+      b = curFunc->blocks[i];
+      if (!loop->inLoop[i])
+         continue;
+      for (j=0; j < b->numInstrs; j++) {
+         ins = &b->instrs[j];
+         if (ins->op != IR_ADD || ins->dst < curFunc->numVars || funcDefs[ins->dst] != 1)
+            continue;
+         // one operand is the shifted variable, the other the base
+         for (s=0; s < 2; s++) {
+            t = s == 0 ? ins->src1 : ins->src2;
+            base = s == 0 ? ins->src2 : ins->src1;
+            if (t >= 0 && defOp[t] == IR_SLLI && base >= 0 && isInvariant(base))
+               break;
+         }
+         if (s == 2)
+            continue;
+         // the shift must be earlier in this block, with no write of
+         // v between it and the add
+         for (k=j-1; k >= 0 && b->instrs[k].dst != t; k--)
+            ;
+         if (k < 0)
+            continue;
+         v = defSrc[t];
+         shift = defImm[t];
+         incBlock = findIncrement(loop, v, &incPos);
+         if (!incBlock || (incBlock == b && incPos > k && incPos < j))
+            continue;
+         step = incBlock->instrs[incPos].imm << shift;
+         if (step < -2048 || step > 2047)
+            continue;
+
+         // reuse the pointer for the same v, base and shift
+         for (n=0; n < numPtrs; n++)
+            if (ptrV[n] == v && ptrBase[n] == base && ptrShift[n] == shift)
+               break;
+         if (n == numPtrs) {
+            if (numPtrs == MAXLOOPPTRS)
+               continue;
+            ptr = newVReg(curFunc);
+            k = newVReg(curFunc);
+            insertIR(pre, pre->numInstrs-1, IR_SLLI, k, v, NOVREG, shift);
+            insertIR(pre, pre->numInstrs-1, IR_ADD, ptr, base, k, 0);
+            insertIR(incBlock, incPos+1, IR_ADDI, ptr, ptr, NOVREG, step);
+            if (incBlock == b && incPos < j)
+               j++;
+            ptrV[n] = v; ptrBase[n] = base; ptrShift[n] = shift; ptrReg[n] = ptr;
+            numPtrs++;
+         }
+         ptr = ptrReg[n];
+         ins = &b->instrs[j];
+
+         // read the pointer directly if every use of the address is
+         // in this block before the pointer is bumped
+         found = 0;
+         for (k=j+1; k < b->numInstrs && b->instrs[k].dst != ptr; k++)
+            found += (b->instrs[k].src1 == ins->dst) + (b->instrs[k].src2 == ins->dst);
+         if (found == countUses(ins->dst)) {
+            for (k=j+1; k < b->numInstrs && b->instrs[k].dst != ptr; k++) {
+               if (b->instrs[k].src1 == ins->dst)
+                  b->instrs[k].src1 = ptr;
+               if (b->instrs[k].src2 == ins->dst)
+                  b->instrs[k].src2 = ptr;
+            }
+            funcDefs[ins->dst] = 0;
+            removeIR(b, j--);
+         } else {
+            ins->op = IR_MOV;
+            ins->src1 = ptr;
+            ins->src2 = NOVREG;
+         }
+         loop->reduced++;
+      }
+   }
+}
+
+// Loop pass
+// - returns the number of instructions hoisted or strength reduced
+int loopOptimize(IRFunc* func)
+{
+   int i, j, v, size, created = 0, changes = 0;
+   IRBlock* b;
+   IRInstr* ins;
+   Loop* loop;
+   Loop tmp;
+   char note[128];
+
+   curFunc = func;
+   // adding a preheader renumbers the blocks, so start over each time
+   do {
+      buildCFG(func);
+      computeDominators(func);
+      findLoops();
+      for (i=0; i < numLoops && !makePreheader(&loops[i]); i++)
+         ;
+      if (i < numLoops) {
+         created++;
+         freeLoops();
+         i = -1;
+      }
+   } while (i < 0);
+   buildCFG(func);
+   numSkippedLoops += numOverflow;
+
+   // innermost (smallest) loops first
+   for (i=1; i < numLoops; i++)
+      for (j=i; j > 0 && loops[j].numBlocks < loops[j-1].numBlocks; j--) {
+         tmp = loops[j]; loops[j] = loops[j-1]; loops[j-1] = tmp;
+      }
+   for (i=0; i < func->numBlocks; i++) {
+      func->blocks[i]->loopDepth = 0;
+      for (j=0; j < numLoops; j++)
+         func->blocks[i]->loopDepth += loops[j].inLoop[i];
+   }
+
+   for (i=0; i < numLoops; i++) {
+      loop = &loops[i];
+      // per-vreg info, with room for the vregs reduction adds
+      size = func->numVRegs + 2*MAXLOOPPTRS + 1;
+      funcDefs = (int*) calloc(size, sizeof(int));
+      loopDefs = (int*) calloc(size, sizeof(int));
+      defOp = (int*) malloc(size*sizeof(int));
+      defSrc = (int*) malloc(size*sizeof(int));
+      defImm = (int*) malloc(size*sizeof(int));
+      for (v=0; v < size; v++)
+         defOp[v] = -1;
+      for (j=0; j < func->numBlocks; j++) {
+         b = func->blocks[j];
+         for (v=0; v < b->numInstrs; v++) {
+            ins = &b->instrs[v];
+            if (ins->dst >= 0) {
+               funcDefs[ins->dst]++;
+               defOp[ins->dst] = ins->op;
+               defSrc[ins->dst] = ins->src1;
+               defImm[ins->dst] = ins->imm;
+            }
+            if (!loop->inLoop[j])
+               continue;
+            if (ins->dst >= 0)
+               loopDefs[ins->dst]++;
+            if (ins->op == IR_CALL)
+               loop->hasCall = 1;
+            if (ins->op == IR_STORE || ins->op == IR_STOREG)
+               loop->hasStore = 1;
+         }
+      }
+      for (v=0; v < func->numVRegs; v++)
+         if (funcDefs[v] != 1)
+            defOp[v] = -1;
+      hoistInvariants(loop);
+      reduceInductionVars(loop);
+      free(funcDefs);
+      free(loopDefs);
+      free(defOp);
+      free(defSrc);
+      free(defImm);
+
+      if (debug) {
+         snprintf(note, sizeof(note), "loop .L%s_%d: depth %d, %d blocks, %d hoisted, "
+                  "%d strength reduced", curFunc->name, loop->header->label,
+                  loop->header->loopDepth, loop->numBlocks, loop->hoisted, loop->reduced);
+         free(loop->header->note);
+         loop->header->note = strdup(note);
+      }
+      changes += loop->hoisted + loop->reduced;
+   }
+   freeLoops();
+   return changes + created;
+}
+
+void printLoopStats(FILE *out)
+{
+   fprintf(out, "loops: %d not optimized (more than %d in a function)\n",
+           numSkippedLoops, MAXLOOPS);
+}
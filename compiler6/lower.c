@@ -0,0 +1,453 @@
+//
+// AST to IR Lowering
+// - turns one AST_FUNCTION (or the program block statements) into
+//   an IRFunc, see ir.h
+// - expressions are lowered bottom up into fresh temporaries; the
+//   operand that needs more registers (its Sethi-Ullman number) is
+//   lowered first, which keeps register pressure down later on
+// - an expression whose value goes straight into a param/local
+//   (assignment) or an argument is given that vreg as its
+//   destination, so "i = i + 1" lowers to a single IR_ADDI
+//
+#include <stdlib.h>
+#include "ir.h"
+#include "compiler.h"
+#include "fold.h"
+#include "visit.h"
+
+// Lowering state of a node being walked, kept by depth
+// - a node lowers its children through visitAST(), and each child
+//   that has a value leaves its vreg in its parent's frame
+typedef struct
+{
+   ASTNodeType type;     // the node's type
+   int dst;              // vreg the node's value must go in, or NOVREG
+   int childDst;         // ... the one for the child walked next
+   int vals[MAXARGS];    // values of the children walked so far
+   int numVals;
+   int mode;             // how an expression is lowered, see lowerVisit()
+   int offset;           // array byte offset, for a constant index
+   IRBlock *top, *first, *firstEnd, *second, *secondEnd, *join;
+   IRBlock *ifTrue, *ifFalse;  // branch targets for a condition child
+} LowerFrame;
+
+// lowering state for the function being lowered
+static THREADLOCAL IRFunc* curFunc;
+static THREADLOCAL IRBlock* curBlock;
+static THREADLOCAL int curLoopDepth;
+static THREADLOCAL LowerFrame* frames;
+static THREADLOCAL int maxFrames;
+
+// how an expression node is lowered (LowerFrame mode)
+#define XGENERAL  0   // both operands, the one needing more registers first
+#define XSWAPPED  1   // ... the right one first
+#define XIMMRIGHT 2   // "x + k" or "x - k", k an immediate
+#define XIMMLEFT  3   // "k + x"
+
+// True if expr is an int constant that fits in a 12 bit immediate
+static int isSmallConst(ASTNode* expr)
+{
+   return expr && expr->type == AST_CONSTANT && expr->valType == T_INT &&
+          expr->ival >= -2048 && expr->ival <= 2047;
+}
+
+static int needOf(ASTNode* expr)
+{
+   return expr ? expr->regNeed : 0;
+}
+
+// Set the Sethi-Ullman number of a node once its children have
+// theirs: how many registers it takes to evaluate an expression
+// without spilling
+// - a param/local is already in a vreg and needs none
+static int needVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   int l, r, n;
+   (void) depth;
+   (void) arg;
+   if (phase < ASTNUMCHILDREN)
+      return phase;
+   l = needOf(node->child[0]);
+   r = needOf(node->child[1]);
+   switch (node->type) {
+    case AST_VARREF:
+       if (node->varKind == V_GLARRAY)
+          n = l > 2 ? l : 2;  // index plus array base address
+       else if (node->varKind == V_PARAM || node->varKind == V_LOCAL)
+          n = 0;
+       else
+          n = 1;
+       break;
+    case AST_EXPRESSION:
+    case AST_RELEXPR:
+       n = l == r ? l+1 : (l > r ? l : r);
+       break;
+    default:
+       n = 1;
+   }
+   node->regNeed = n < 255 ? n : 255;
+   return VISITDONE;
+}
+
+// Start a new block at the current loop depth
+static IRBlock* startBlock()
+{
+   curBlock = newIRBlock(curFunc);
+   curBlock->loopDepth = curLoopDepth;
+   return curBlock;
+}
+
+// End the current block with a jump to target
+static void jumpTo(IRBlock* target)
+{
+   emitIR(curBlock, IR_JUMP, NOVREG, NOVREG, NOVREG, 0)->target[0] = target;
+}
+
+// Destination vreg for a result: dst if given, else a new temp
+static int destVReg(int dst)
+{
+   return dst != NOVREG ? dst : newVReg(curFunc);
+}
+
+// Address of arr[index] for a small constant index: the array base,
+// with the byte offset in *offset; NOVREG for any other index
+static int constArrayAddr(ASTNode* index, SymId sym, int* offset)
+{
+   int base;
+   *offset = 0;
+   if (!isSmallConst(index) || index->ival < 0 || index->ival >= 512)
+      return NOVREG;
+   *offset = 4*index->ival;
+   base = newVReg(curFunc);
+   emitIR(curBlock, IR_LA, base, NOVREG, NOVREG, 0)->sym = sym;
+   return base;
+}
+
+// Address of arr[index], with the index already in vreg idx
+static int indexArrayAddr(int idx, SymId sym)
+{
+   int scaled, base, addr;
+   scaled = newVReg(curFunc);
+   emitIR(curBlock, IR_SLLI, scaled, idx, NOVREG, 2);
+   base = newVReg(curFunc);
+   emitIR(curBlock, IR_LA, base, NOVREG, NOVREG, 0)->sym = sym;
+   addr = newVReg(curFunc);
+   emitIR(curBlock, IR_ADD, addr, base, scaled, 0);
+   return addr;
+}
+
+// Hand the value of the node at depth to its parent
+static void giveValue(int depth, int v)
+{
+   LowerFrame* parent;
+   if (depth == 0)
+      return;
+   parent = &frames[depth-1];
+   if (parent->numVals < MAXARGS)
+      parent->vals[parent->numVals++] = v;
+}
+
+// The operands of a binary or relational expression, in order
+static void operandValues(LowerFrame* f, int* lv, int* rv)
+{
+   *lv = f->vals[f->mode == XSWAPPED];
+   *rv = f->vals[f->mode != XSWAPPED];
+}
+
+// Lower one node, a phase at a time
+// - statements emit their code; an expression leaves the vreg that
+//   holds its value with its parent (see giveValue()), and its
+//   value goes in dst if the parent gave it one: the var of an
+//   assignment, so "i = i + 1" lowers to a single IR_ADDI
+// - an expression's operands are lowered bottom up into fresh
+//   temporaries, the one that needs more registers (regNeed) first
+// - a while is laid out as: jump to cond; body; cond: branch to
+//   body; exit, and an if as: branch; if part; else part; join
+// - a condition known at compile time becomes a plain jump
+static int lowerVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   LowerFrame* f;
+   IRInstr* br;
+   int v, lv, rv, i, known;
+   IROp op;
+   (void) arg;
+
+   if (depth == maxFrames) {
+      maxFrames = maxFrames ? 2*maxFrames : 64;
+      frames = (LowerFrame*) realloc(frames, maxFrames * sizeof(LowerFrame));
+   }
+   f = &frames[depth];
+   if (phase == 0) {
+      f->type = node->type;
+      f->dst = depth > 0 ? frames[depth-1].childDst : NOVREG;
+      f->childDst = NOVREG;
+      f->numVals = 0;
+   }
+
+   switch (node->type) {
+    case AST_CONSTANT: // for both int and string constants
+       if (node->valType == T_INT) {
+          if (node->ival == 0 && f->dst == NOVREG)
+             v = ZEROVREG;
+          else {
+             v = destVReg(f->dst);
+             emitIR(curBlock, IR_LI, v, NOVREG, NOVREG, node->ival);
+          }
+       } else if (node->valType == T_STRING) {
+          v = destVReg(f->dst);
+          emitIR(curBlock, IR_LASTR, v, NOVREG, NOVREG, node->ival);
+       } else { // T_RETURNVAL
+          v = destVReg(f->dst);
+          emitIR(curBlock, IR_GETRET, v, NOVREG, NOVREG, 0);
+       }
+       giveValue(depth, v);
+       return VISITDONE;
+
+    case AST_VARREF:
+       if (node->varKind == V_GLARRAY) {
+          if (phase == 0) {
+             lv = constArrayAddr(node->child[0], node->sym, &f->offset);
+             if (lv == NOVREG)
+                return 0;  // child 0 is the index
+          } else
+             lv = indexArrayAddr(f->vals[0], node->sym);
+          v = destVReg(f->dst);
+          emitIR(curBlock, IR_LOAD, v, lv, NOVREG, phase == 0 ? f->offset : 0);
+       } else if (node->varKind == V_PARAM || node->varKind == V_LOCAL) {
+          v = node->ival;
+          if (f->dst != NOVREG && f->dst != node->ival) {
+             emitIR(curBlock, IR_MOV, f->dst, node->ival, NOVREG, 0);
+             v = f->dst;
+          }
+       } else {
+          v = destVReg(f->dst);
+          emitIR(curBlock, IR_LOADG, v, NOVREG, NOVREG, 0)->sym = node->sym;
+       }
+       giveValue(depth, v);
+       return VISITDONE;
+
+    case AST_EXPRESSION: // only for binary op expression
+       if (node->ival != '+' && node->ival != '-') {
+          if (phase == 0) {
+             fprintf(stderr, "Unknown operator (%c) in expression\n", node->ival);
+             f->childDst = f->dst;
+             return 0;  // lowered as its left side
+          }
+          giveValue(depth, f->vals[0]);
+          return VISITDONE;
+       }
+       if (phase == 0) {
+          // x + k, k + x, and x - k use an immediate
+          if (isSmallConst(node->child[1]) &&
+              (node->ival == '+' || node->child[1]->ival != -2048))
+             f->mode = XIMMRIGHT;
+          else if (node->ival == '+' && isSmallConst(node->child[0]))
+             f->mode = XIMMLEFT;
+          else
+             f->mode = needOf(node->child[1]) > needOf(node->child[0]) ? XSWAPPED : XGENERAL;
+          return f->mode == XIMMLEFT || f->mode == XSWAPPED;
+       }
+       if (phase == 1 && (f->mode == XGENERAL || f->mode == XSWAPPED))
+          return f->mode == XGENERAL;  // the other operand
+       v = destVReg(f->dst);
+       if (f->mode == XIMMRIGHT)
+          emitIR(curBlock, IR_ADDI, v, f->vals[0], NOVREG,
+                 node->ival == '+' ? node->child[1]->ival : -node->child[1]->ival);
+       else if (f->mode == XIMMLEFT)
+          emitIR(curBlock, IR_ADDI, v, f->vals[0], NOVREG, node->child[0]->ival);
+       else {
+          operandValues(f, &lv, &rv);
+          op = node->ival == '+' ? IR_ADD : IR_SUB;
+          emitIR(curBlock, op, v, lv, rv, 0);
+       }
+       giveValue(depth, v);
+       return VISITDONE;
+
+    case AST_RELEXPR: // a condition, ends the current block
+       if (phase == 0) {
+          known = constCondValue(node);
+          if (known >= 0) {
+             jumpTo(known ? frames[depth-1].ifTrue : frames[depth-1].ifFalse);
+             return VISITDONE;
+          }
+          f->mode = needOf(node->child[1]) > needOf(node->child[0]) ? XSWAPPED : XGENERAL;
+          return f->mode == XSWAPPED;
+       }
+       if (phase == 1)
+          return f->mode == XGENERAL;
+       operandValues(f, &lv, &rv);
+       br = emitIR(curBlock, IR_BR, NOVREG, lv, rv, 0);
+       br->relop = node->ival;
+       br->target[0] = frames[depth-1].ifTrue;
+       br->target[1] = frames[depth-1].ifFalse;
+       return VISITDONE;
+
+    case AST_ASSIGNMENT:
+       if (phase == 0) {
+          if (node->varKind != V_GLARRAY && node->varKind != V_GLOBAL)
+             f->childDst = node->ival;  // straight into the var
+          return 0;  // child 0 is the right hand side
+       }
+       if (node->varKind == V_GLARRAY) {
+          if (phase == 1) {
+             lv = constArrayAddr(node->child[1], node->sym, &f->offset);
+             if (lv == NOVREG)
+                return 1;  // child 1 is the index
+          } else
+             lv = indexArrayAddr(f->vals[1], node->sym);
+          emitIR(curBlock, IR_STORE, NOVREG, f->vals[0], lv, phase == 1 ? f->offset : 0);
+       } else if (node->varKind == V_GLOBAL)
+          emitIR(curBlock, IR_STOREG, NOVREG, f->vals[0], NOVREG, 0)->sym = node->sym;
+       return VISITDONE;
+
+    case AST_FUNCALL:
+       // args are all evaluated before any argument register is
+       // set, since "returnvalue" in an arg still needs to read a0
+       // (the parser rejects calls with more than MAXARGS)
+       if (phase == 0)
+          return 0;  // child 0 is the argument list
+       for (i=0; i < f->numVals; i++)
+          emitIR(curBlock, IR_ARG, NOVREG, f->vals[i], NOVREG, i);
+       emitIR(curBlock, IR_CALL, NOVREG, NOVREG, NOVREG, f->numVals)->sym = node->sym;
+       return VISITDONE;
+
+    case AST_ARGUMENT:
+       if (phase == 0)
+          return 0;  // child 0 is the argument expr
+       giveValue(depth, f->vals[0]);
+       return VISITDONE;
+
+    case AST_WHILE:
+       if (phase == 0) {
+          f->top = curBlock;
+          curLoopDepth++;
+          f->first = startBlock();
+          return 1;  // child 1 is loop body
+       } else if (phase == 1) {
+          f->firstEnd = curBlock;
+          f->second = startBlock();
+          curLoopDepth--;
+          f->join = newIRBlock(curFunc);
+          f->join->loopDepth = curLoopDepth;
+          f->ifTrue = f->first;
+          f->ifFalse = f->join;
+          return 0;  // child 0 is condition, lowered in the cond block
+       }
+       curBlock = f->firstEnd;
+       jumpTo(f->second);
+       curBlock = f->top;
+       jumpTo(f->second);
+       curBlock = f->join;
+       return VISITDONE;
+
+    case AST_IFTHEN:
+       if (phase == 0) {
+          f->top = curBlock;
+          f->first = startBlock();
+          return 1;  // child 1 is if body
+       } else if (phase == 1) {
+          f->firstEnd = curBlock;
+          f->second = startBlock();
+          return 2;  // child 2 is else body
+       } else if (phase == 2) {
+          f->secondEnd = curBlock;
+          f->join = startBlock();
+          curBlock = f->firstEnd;
+          jumpTo(f->join);
+          curBlock = f->secondEnd;
+          jumpTo(f->join);
+          curBlock = f->top;
+          f->ifTrue = f->first;
+          f->ifFalse = f->second;
+          return 0;  // child 0 is condition, it ends the top block
+       }
+       curBlock = f->join;
+       return VISITDONE;
+
+    default:
+       if (depth == 0 || frames[depth-1].type == AST_WHILE ||
+           frames[depth-1].type == AST_IFTHEN)
+          fprintf(stderr, "Unknown AST node in statement list\n");
+       else {
+          fprintf(stderr, "Unknown AST node in expression\n");
+          giveValue(depth, ZEROVREG);
+       }
+       return VISITDONE;
+   }
+}
+
+// Lower a statement list into curFunc
+// - both walks are iterative (see visit.h), so neither long lists
+//   nor deep nesting use C stack
+static void lowerStatements(ASTNode* stmts)
+{
+   visitAST(stmts, 0, needVisit, NULL);
+   visitAST(stmts, 0, lowerVisit, NULL);
+   free(frames);
+   frames = NULL;
+   maxFrames = 0;
+}
+
+// Finish a function: make sure the last block returns and build the CFG
+static IRFunc* finishFunc()
+{
+   emitIR(curBlock, IR_RET, NOVREG, NOVREG, NOVREG, 0);
+   buildCFG(curFunc);
+   return curFunc;
+}
+
+// Lower an AST_FUNCTION into an IRFunc
+// - params and locals become vregs 0..numVars-1 (by their ival)
+IRFunc* lowerFunction(ASTNode* func)
+{
+   ASTNode* decl;
+   curFunc = newIRFunc(func->strval, 0);
+   curFunc->sym = func->sym;
+   for (decl = func->child[1]; decl; decl = decl->next) {  // params
+      curFunc->numParams++;
+      if (decl->ival >= curFunc->numVars)
+         curFunc->numVars = decl->ival+1;
+   }
+   for (decl = func->child[2]; decl; decl = decl->next)   // locals
+      if (decl->ival >= curFunc->numVars)
+         curFunc->numVars = decl->ival+1;
+   curFunc->numVRegs = curFunc->numVars;
+   curLoopDepth = 0;
+   startBlock();
+   lowerStatements(func->child[0]);  // child 0 is statements
+   return finishFunc();
+}
+
+// Keep the highest local var number referenced, plus one
+static int localVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   int* n = (int*) arg;
+   (void) depth;
+   if (phase == 0 && (node->type == AST_VARREF || node->type == AST_ASSIGNMENT) &&
+       node->varKind == V_LOCAL && node->ival >= *n)
+      *n = node->ival+1;
+   return phase < ASTNUMCHILDREN ? phase : VISITDONE;
+}
+
+// Number of local vars referenced in a tree (one more than the
+// highest var number)
+static int countLocalVars(ASTNode* node)
+{
+   int n = 0;
+   visitAST(node, 0, localVisit, &n);
+   return n;
+}
+
+// Lower the main program statements into an IRFunc named "program"
+// - the program has no decls of its own; its only locals are the
+//   ones left by inlined functions (see inline.c)
+IRFunc* lowerProgramBlock(ASTNode* stmts)
+{
+   curFunc = newIRFunc("program", 1);
+   curFunc->numVars = countLocalVars(stmts);
+   curFunc->numVRegs = curFunc->numVars;
+   curLoopDepth = 0;
+   startBlock();
+   lowerStatements(stmts);
+   return finishFunc();
+}
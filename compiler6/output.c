@@ -0,0 +1,117 @@
+//
+// Buffered Output
+// - see output.h for the interface
+// - the buffer doubles as it fills, up to OUTCHUNKSIZE; past that
+//   it is written out and reused, so a huge program is streamed in
+//   large chunks and a normal one takes a single write()
+//
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "output.h"
+
+#define INITIALOUTSIZE (64*1024)
+
+// Initialize an empty buffer that writes to fd (-1 for none)
+void initOutput(Output* out, int fd)
+{
+   out->data = NULL;
+   out->len = out->max = 0;
+   out->fd = fd;
+   out->error = 0;
+   out->bytesWritten = 0;
+   out->numWrites = 0;
+}
+
+// Release the buffer; anything not flushed is lost
+void freeOutput(Output* out)
+{
+   free(out->data);
+   out->data = NULL;
+   out->len = out->max = 0;
+}
+
+// Write the buffered text to the file descriptor
+// - returns 0, or -1 if a write failed (out->error stays set)
+int flushOutput(Output* out)
+{
+   size_t done = 0;
+   ssize_t n;
+   if (out->fd < 0)
+      return out->error ? -1 : 0;
+   while (done < out->len && !out->error) {
+      n = write(out->fd, out->data + done, out->len - done);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0)
+         out->error = 1;
+      else {
+         done += n;
+         out->numWrites++;
+      }
+   }
+   out->bytesWritten += done;
+   out->len = 0;
+   return out->error ? -1 : 0;
+}
+
+// Make room for n more bytes
+// - flushes instead of growing once the buffer is a chunk big, if
+//   there is a file to flush to
+static void reserve(Output* out, size_t n)
+{
+   if (out->len + n <= out->max)
+      return;
+   if (out->fd >= 0 && out->len + n > OUTCHUNKSIZE) {
+      flushOutput(out);
+      if (n <= out->max)
+         return;
+   }
+   if (!out->max)
+      out->max = INITIALOUTSIZE;
+   while (out->len + n > out->max)
+      out->max *= 2;
+   out->data = (char*) realloc(out->data, out->max);
+}
+
+void emitChars(Output* out, const char* s, size_t n)
+{
+   reserve(out, n);
+   memcpy(out->data + out->len, s, n);
+   out->len += n;
+}
+
+void emitStr(Output* out, const char* s)
+{
+   emitChars(out, s, strlen(s));
+}
+
+void emitChar(Output* out, char c)
+{
+   reserve(out, 1);
+   out->data[out->len++] = c;
+}
+
+// Emit a decimal integer
+// - digits are produced backwards into a small buffer; the value
+//   is negated as unsigned so INT_MIN works too
+void emitInt(Output* out, int v)
+{
+   char buf[12];
+   int i = sizeof(buf);
+   unsigned int u = v < 0 ? 0u - (unsigned int) v : (unsigned int) v;
+   do {
+      buf[--i] = '0' + u % 10;
+      u /= 10;
+   } while (u);
+   if (v < 0)
+      buf[--i] = '-';
+   emitChars(out, buf + i, sizeof(buf) - i);
+}
+
+void printOutputStats(Output* out, FILE* f)
+{
+   fprintf(f, "output: %lu bytes in %d writes\n",
+           (unsigned long) out->bytesWritten, out->numWrites);
+}
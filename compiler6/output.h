@@ -0,0 +1,40 @@
+//
+// Buffered Output Interface
+// - the code generator appends assembly text to an Output buffer
+//   with the small emit functions below instead of calling fprintf
+//   for every line; integers are formatted by hand, so no format
+//   string is ever parsed
+// - the text is written to the buffer's file descriptor with one
+//   write() at flushOutput(), or in OUTCHUNKSIZE pieces if it grows
+//   larger than that; an Output with fd -1 just keeps everything
+//   in memory
+//
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define OUTCHUNKSIZE (4*1024*1024)  // flush when the buffer gets this full
+
+typedef struct
+{
+   char *data;
+   size_t len;           // bytes in data[] not written yet
+   size_t max;           // size of data[]
+   int fd;               // file descriptor to write to, or -1
+   int error;            // set if a write() failed
+   size_t bytesWritten;  // total bytes written to fd
+   int numWrites;        // number of write() calls
+} Output;
+
+void initOutput(Output *out, int fd);
+void freeOutput(Output *out);
+void emitChars(Output *out, const char *s, size_t n);
+void emitStr(Output *out, const char *s);
+void emitChar(Output *out, char c);
+void emitInt(Output *out, int v);
+int flushOutput(Output *out);
+void printOutputStats(Output *out, FILE *f);
+
+#endif
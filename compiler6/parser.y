@@ -1,28 +1,62 @@
+%code requires {
+#include "compiler.h"
+}
+
 %{
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "symtable.h"
 #include "astree.h"
-int yyerror(char *s);
-int yylex(void);
-int debug=0;
-
-Symbol** table;
-ASTNode* astRoot;
+#include "strpool.h"
+#include "output.h"
+#include "input.h"
+#include "batch.h"
+#include "funcgen.h"
 
-char* savedStrings[100];
-int lastStringIndex=0;
-int argCount = 0;
-int paramNum = 0;
+// all parser state is in the CompilerContext (see compiler.h)
 // int currentScope = 0;
-int addString(char* str)
+
+// While a statement list is being parsed it is kept circular,
+// pointing at its last statement, whose next is the first; this
+// lets the statements rule be left recursive and still append in
+// constant time
+static ASTNode* appendStatement(ASTNode* list, ASTNode* stmt)
+{
+   if (list) {
+      stmt->next = list->next;
+      list->next = stmt;
+   } else
+      stmt->next = stmt;
+   return stmt;
+}
+
+// Turn a finished circular statement list into a normal one
+static ASTNode* statementList(ASTNode* list)
 {
-   savedStrings[lastStringIndex] = strdup(str);
-   return lastStringIndex++;
+   ASTNode* first;
+   if (!list)
+      return NULL;
+   first = list->next;
+   list->next = NULL;
+   return first;
 }
 %}
 
+/* a pure (reentrant) parser: yylval is passed to the scanner, and
+*  the context and the scanner are passed to the parser
+*/
+%define api.pure full
+%parse-param {CompilerContext *ctx} {void *scanner}
+%lex-param {void *scanner}
+
+%code {
+int yylex(YYSTYPE *lvalp, void *scanner);
+int yyerror(CompilerContext *ctx, void *scanner, const char *s);
+}
+
 /* token value data types */
 %union {
    int ival; char* str; struct astnode_s * astnode;
@@ -38,41 +72,59 @@ int addString(char* str)
 
 wholeprogram: globals functions program 
    {
-      astRoot = (ASTNode*) newASTNode(AST_PROGRAM);
-      astRoot->child[0] = $1;
-      astRoot->child[1] = $2;
-      astRoot->child[2] = $3;
-      astRoot->strval = NULL;
+      ctx->astRoot = (ASTNode*) newASTNode(AST_PROGRAM);
+      ctx->astRoot->child[0] = $1;
+      ctx->astRoot->child[1] = $2;
+      ctx->astRoot->child[2] = $3;
+      ctx->astRoot->strval = NULL;
    }
 program: KWPROGRAM LBRACE statements RBRACE
    {
-      $$ = $3;
+      $$ = statementList($3);
    }
+/* left recursive, so the parser stack does not grow with the
+*  number of functions; when streaming, each function is compiled
+*  and its AST released as soon as it is reduced
+*/
 functions:  /*empty*/
    {
       $$ = 0;
+      if (ctx->streamOut) {
+         markASTNodes();  // the nodes after this are the functions'
+         ctx->idMark = ctx->table->numIds;  // and so are the ids
+      }
    }
-   |function functions
+   |functions function
    {
-      $1->next=$2;
-      $$ = $1;
+      if (ctx->streamOut) {
+         genStreamedFunction($2, ctx->streamOut);
+         releaseASTNodes();
+         releaseSymbolIds(ctx->table, ctx->idMark);  // function ids stay
+         ctx->idMark = ctx->table->numIds;
+         $$ = 0;
+      } else {
+         if ($1)
+            ctx->lastFunc->next = $2;
+         ctx->lastFunc = $2;
+         $$ = $1 ? $1 : $2;
+      }
    }
 function: KWFUNCTION ID LPAREN parameters RPAREN LBRACE localvars statements RBRACE
    {
       $$ = (ASTNode*) newASTNode(AST_FUNCTION);
       $$->strval = $2;
-      $$->strNeedsFreed = 1;
-      $$->child[0] = $8; //stmnt
+      $$->sym = functionId(ctx->table, $2);
+      $$->child[0] = statementList($8); //stmnt
       $$->child[1] = $4; // params
       $$->child[2] = $7; // local vars
-      delScopeLevel(table, 1); // important: remove param/local decls from symtable
-      paramNum = 0;  // important: reset param/local counter
+      delScopeLevel(ctx->table, 1); // important: remove param/local decls from symtable
+      ctx->paramNum = 0;  // important: reset param/local counter
    }
 whileloop: KWWHILE LPAREN boolexpr RPAREN KWDO LBRACE statements RBRACE
    {
       $$ = (ASTNode*) newASTNode(AST_WHILE);
       $$->child[0] = $3;
-      $$->child[1] = $7;
+      $$->child[1] = statementList($7);
       $$->child[2] = NULL;
       $$->strval=NULL;
    }
@@ -80,19 +132,22 @@ ifthenelse: KWIF LPAREN boolexpr RPAREN KWTHEN LBRACE statements RBRACE KWELSE L
    {
       $$ = (ASTNode*) newASTNode(AST_IFTHEN);
       $$->child[0] = $3;
-      $$->child[1] = $7;
-      $$->child[2] = $11;
+      $$->child[1] = statementList($7);
+      $$->child[2] = statementList($11);
       $$->strval=NULL;
    }
 
+/* left recursive, so the parser stack does not grow with the
+*  number of statements; the list is circular until statementList()
+*  is applied where it is used
+*/
 statements: /*empty*/
    {
       $$ = 0;
    }
-   | statement statements
+   | statements statement
    {
-      $1->next=$2;
-      $$ = $1;
+      $$ = appendStatement($1, $2);
    }
 statement: funcall
    {
@@ -112,10 +167,10 @@ statement: funcall
    }
 funcall: KWCALL ID LPAREN arguments RPAREN SEMICOLON
    {
-      argCount = 0;
+      ctx->argCount = 0;
       $$ = (ASTNode*) newASTNode(AST_FUNCALL);
       $$->strval = $2;
-      $$->strNeedsFreed = 1;
+      $$->sym = functionId(ctx->table, $2);  // may be defined later
       $$->child[0] = $4;
       $$->child[1] = NULL;
       $$->child[2] = NULL;
@@ -136,27 +191,32 @@ arguments:  /*empty*/
 argument: expression
    {
       if (debug) fprintf(stderr,"RULE:argument\n");
+      if (ctx->argCount == MAXARGS)
+      {
+         fprintf(stderr, "Call with more than %d arguments not supported. Exiting.\n", MAXARGS);
+         YYABORT;
+      }
       $$ = (ASTNode*) newASTNode(AST_ARGUMENT);
       $$->child[0] = $1;
       $$->child[1] = NULL;
       $$->child[2] = NULL;
       $$->strval=NULL;
-      $$->ival = argCount++;
+      $$->ival = ctx->argCount++;
    }
 assignment: ID EQUALS expression SEMICOLON
    {
-      Symbol* sym = findSymbol(table, $1);
+      Symbol* sym = findSymbol(ctx->table, $1);
       if(sym == NULL)
-      // if(findSymbol(table, $1) == NULL)
+      // if(findSymbol(ctx->table, $1) == NULL)
       {
          fprintf(stderr, "Variable (%s) not declared. Exiting.\n", $1);
-         exit(1);
+         YYABORT;
       }
       else
       {
          $$ = (ASTNode*) newASTNode(AST_ASSIGNMENT);
          $$->strval = $1;
-         $$->strNeedsFreed = 1;
+         $$->sym = sym->id;
          $$->child[0] = $3;
          $$->child[1] = NULL;
          $$->child[2] = NULL;
@@ -166,16 +226,17 @@ assignment: ID EQUALS expression SEMICOLON
    }
    | ID LBRACKET expression RBRACKET EQUALS expression SEMICOLON
    {
-      if(findSymbol(table, $1) == NULL)
+      Symbol* sym = findSymbol(ctx->table, $1);
+      if(sym == NULL)
       {
          fprintf(stderr, "Variable (%s) not declared. Exiting.\n", $1);
-         exit(1);
+         YYABORT;
       }
       else
       {
          $$ = (ASTNode*) newASTNode(AST_ASSIGNMENT);
          $$->strval = $1;
-         $$->strNeedsFreed = 1;
+         $$->sym = sym->id;
          $$->child[0] = $6;
          $$->child[1] = $3;
          $$->child[2] = NULL;
@@ -188,7 +249,6 @@ boolexpr: expression RELOP expression
    {
       $$ = (ASTNode*) newASTNode(AST_RELEXPR);
       $$->ival = $2;
-      $$->strNeedsFreed = 0;
       $$->child[0] = $1;
       $$->child[1] = $3;
       $$->child[2] = NULL;
@@ -199,7 +259,6 @@ expression: STRING
       int sid = addString($1);
       $$->strval = $1;
       $$->ival = sid;
-      $$->strNeedsFreed = 1;
       $$->valType = T_STRING;
       $$->child[0] = NULL;
       $$->child[1] = NULL;
@@ -209,7 +268,6 @@ expression: STRING
    {
       $$ = (ASTNode*) newASTNode(AST_CONSTANT);
       $$->ival = $1;
-      $$->strNeedsFreed = 0;
       $$->valType = T_INT;
       $$->child[0] = NULL;
       $$->child[1] = NULL;
@@ -217,23 +275,23 @@ expression: STRING
    }
    | ID
    {
-      Symbol* sym = findSymbol(table, $1);
+      Symbol* sym = findSymbol(ctx->table, $1);
       if(sym == NULL)
-      //if(findSymbol(table, $1) == NULL)
+      //if(findSymbol(ctx->table, $1) == NULL)
       {
          fprintf(stderr, "Variable (%s) not declared. Exiting.\n", $1);
-         exit(1);
+         YYABORT;
       }
       else
       {
          $$ = (ASTNode*) newASTNode(AST_VARREF);
          $$->strval = $1;
+         $$->sym = sym->id;
          $$->ival = sym->offset;
          $$->varKind = sym->varKind;
          $$->child[0] = NULL;
          $$->child[1] = NULL;
          $$->child[2] = NULL;
-         $$->strNeedsFreed=1;
       }
    }
    | KWRETURNVAL
@@ -245,27 +303,26 @@ expression: STRING
    {
       $$ = (ASTNode*) newASTNode(AST_EXPRESSION);
       $$->ival = $2;
-      $$->strNeedsFreed = 0;
       $$->child[0] = $1;
       $$->child[1] = $3;
       $$->child[2] = NULL;
    }
    | ID LBRACKET expression RBRACKET
    {
-      Symbol* sym = findSymbol(table, $1);
+      Symbol* sym = findSymbol(ctx->table, $1);
       if(sym == NULL)
       {
          fprintf(stderr, "Variable (%s) not declared. Exiting.\n", $1);
-         exit(1);
+         YYABORT;
       }
       else
       {
          $$ = (ASTNode*) newASTNode(AST_VARREF);
          $$->strval = $1;
+         $$->sym = sym->id;
          $$->child[0] = $3;
          $$->child[1] = NULL;
          $$->child[2] = NULL;
-         $$->strNeedsFreed=1;
          $$->varKind = V_GLARRAY;
          $$->ival = sym->offset;
       }
@@ -286,73 +343,76 @@ globals:  /*empty*/
 vardecl:
 KWINT ID
    {
-      if(findSymbol(table, $2) == NULL)
+      SymId id;
+      if(findSymbol(ctx->table, $2) == NULL)
       {
-         if (addSymbol(table, $2, 0, T_INT, 0, 0, V_GLOBAL) < 0)
+         if ((id = addSymbol(ctx->table, $2, 0, T_INT, 0, 0, V_GLOBAL)) < 0)
          {
             fprintf(stderr, "Error adding global variable (%s). Exiting.\n", $2);
-            exit(1);
+            YYABORT;
          }
          else{
             $$ = (ASTNode*) newASTNode(AST_VARDECL);
             $$->strval = $2;
+            $$->sym = id;
             $$->valType = T_INT;
             $$->varKind = V_GLOBAL;
             $$->child[0] = NULL;
             $$->child[1] = NULL;
             $$->child[2] = NULL;
-            $$->strNeedsFreed=1;
 
          }
       }
       else
       {
          fprintf(stderr, "Variable (%s) already declared. Exiting.\n", $2);
-         exit(1);
+         YYABORT;
       }
    }
 | KWSTRING ID
    {
-      if(findSymbol(table, $2) == NULL)
+      SymId id;
+      if(findSymbol(ctx->table, $2) == NULL)
       {
-         if (addSymbol(table, $2, 0, T_STRING, 0, 0, V_GLOBAL) < 0)
+         if ((id = addSymbol(ctx->table, $2, 0, T_STRING, 0, 0, V_GLOBAL)) < 0)
          {
             fprintf(stderr, "Error adding global variable (%s). Exiting.\n", $2);
-            exit(1);
+            YYABORT;
          }
          else
          {
             $$ = (ASTNode*) newASTNode(AST_VARDECL);
             $$->strval = $2;
+            $$->sym = id;
             $$->valType = T_STRING;
             $$->varKind = V_GLOBAL;
             $$->child[0] = NULL;
             $$->child[1] = NULL;
             $$->child[2] = NULL;
-            $$->strNeedsFreed=1;
          }
       }
       else
       {
          fprintf(stderr, "Variable (%s) already declared. Exiting.\n", $2);
-         exit(1);
+         YYABORT;
       }
 
    }
 | KWINT ID LBRACKET NUMBER RBRACKET
    {
-      if(findSymbol(table, $2) == NULL)
+      SymId id;
+      if(findSymbol(ctx->table, $2) == NULL)
       {
-         if (addSymbol(table, $2, 0, T_INT, $4, 0, V_GLARRAY) < 0)
+         if ((id = addSymbol(ctx->table, $2, 0, T_INT, $4, 0, V_GLARRAY)) < 0)
          {
             fprintf(stderr, "Error adding global variable (%s). Exiting.\n", $2);
-            exit(1);
+            YYABORT;
          }
          else
          {
             $$ = newASTNode(AST_VARDECL);
             $$->strval = $2;
-            $$->strNeedsFreed = 1;
+            $$->sym = id;
             $$->valType = T_INT;
             $$->ival = $4;
             $$->varKind = V_GLARRAY;
@@ -364,7 +424,7 @@ KWINT ID
       else
       {
          fprintf(stderr, "Variable (%s) already declared. Exiting.\n", $2);
-         exit(1);
+         YYABORT;
       }
    }
 
@@ -385,20 +445,27 @@ parameters:
 paramdecl:
 KWINT ID
    {
-      if(findSymbol(table, $2) == NULL)
+      SymId id;
+      if (ctx->paramNum == MAXARGS)
       {
-         if (addSymbol(table, $2, 1, T_INT, 0, paramNum, V_PARAM) < 0)
+         fprintf(stderr, "Parameter (%s): more than %d parameters not supported. Exiting.\n",
+                 $2, MAXARGS);
+         YYABORT;
+      }
+      if(findSymbol(ctx->table, $2) == NULL)
+      {
+         if ((id = addSymbol(ctx->table, $2, 1, T_INT, 0, ctx->paramNum, V_PARAM)) < 0)
          {
             fprintf(stderr, "Error adding global variable (%s). Exiting.\n", $2);
-            exit(1);
+            YYABORT;
          }
          else
          {
             $$ = newASTNode(AST_VARDECL);
             $$->strval = $2;
-            $$->strNeedsFreed = 1;
+            $$->sym = id;
             $$->valType = T_INT;
-            $$->ival = paramNum++;
+            $$->ival = ctx->paramNum++;
             $$->varKind = V_PARAM;
             $$->child[0] = NULL;
             $$->child[1] = NULL;
@@ -408,26 +475,33 @@ KWINT ID
       else
       {
          fprintf(stderr, "Variable (%s) already declared. Exiting.\n", $2);
-         exit(1);
+         YYABORT;
       }
    }
 | KWSTRING ID
    {
-      if(findSymbol(table, $2) == NULL)
+      SymId id;
+      if (ctx->paramNum == MAXARGS)
       {
-         if (addSymbol(table, $2, 1, T_STRING, 0, paramNum, V_PARAM) < 0)
+         fprintf(stderr, "Parameter (%s): more than %d parameters not supported. Exiting.\n",
+                 $2, MAXARGS);
+         YYABORT;
+      }
+      if(findSymbol(ctx->table, $2) == NULL)
+      {
+         if ((id = addSymbol(ctx->table, $2, 1, T_STRING, 0, ctx->paramNum, V_PARAM)) < 0)
          {
             fprintf(stderr, "Error adding global variable (%s). Exiting.\n", $2);
-            exit(1);
+            YYABORT;
          }
          else
          {
-            // addSymbol(table, $2, 1, T_STRING, 0, paramNum, V_PARAM);
+            // addSymbol(ctx->table, $2, 1, T_STRING, 0, ctx->paramNum, V_PARAM);
             $$ = newASTNode(AST_VARDECL);
             $$->strval = $2;
-            $$->strNeedsFreed = 1;
+            $$->sym = id;
             $$->valType = T_STRING;
-            $$->ival = paramNum++;
+            $$->ival = ctx->paramNum++;
             $$->varKind = V_PARAM;
             $$->child[0] = NULL;
             $$->child[1] = NULL;
@@ -437,7 +511,7 @@ KWINT ID
       else
       {
          fprintf(stderr, "Variable (%s) already declared. Exiting.\n", $2);
-         exit(1);
+         YYABORT;
       }
    }
 
@@ -453,22 +527,22 @@ localvars:
 
 localdecl:KWINT ID
    {
-
-      if(findSymbol(table, $2) == NULL)
+      SymId id;
+      if(findSymbol(ctx->table, $2) == NULL)
       {
-         if (addSymbol(table, $2, 1, T_INT, 0, paramNum, V_LOCAL) < 0)
+         if ((id = addSymbol(ctx->table, $2, 1, T_INT, 0, ctx->paramNum, V_LOCAL)) < 0)
          {
             fprintf(stderr, "Error adding global variable (%s). Exiting.\n", $2);
-            exit(1);
+            YYABORT;
          }
          else
          {
 
             $$ = newASTNode(AST_VARDECL);
             $$->strval = $2;
-            $$->strNeedsFreed = 1;
+            $$->sym = id;
             $$->valType = T_INT;
-            $$->ival = paramNum++;
+            $$->ival = ctx->paramNum++;
             $$->varKind = V_LOCAL;
             $$->child[0] = NULL;
             $$->child[1] = NULL;
@@ -478,25 +552,26 @@ localdecl:KWINT ID
       else
       {
          fprintf(stderr, "Variable (%s) already declared. Exiting.\n", $2);
-         exit(1);
+         YYABORT;
       }
    }
 | KWSTRING ID
    {
-      if(findSymbol(table, $2) == NULL)
+      SymId id;
+      if(findSymbol(ctx->table, $2) == NULL)
       {
-         if (addSymbol(table, $2, 1, T_STRING, 0, paramNum, V_LOCAL) < 0)
+         if ((id = addSymbol(ctx->table, $2, 1, T_STRING, 0, ctx->paramNum, V_LOCAL)) < 0)
          {
             fprintf(stderr, "Error adding global variable (%s). Exiting.\n", $2);
-            exit(1);
+            YYABORT;
          }
          else
          {
             $$ = newASTNode(AST_VARDECL);
             $$->strval = $2;
-            $$->strNeedsFreed = 1;
+            $$->sym = id;
             $$->valType = T_STRING;
-            $$->ival = paramNum++;
+            $$->ival = ctx->paramNum++;
             $$->varKind = V_LOCAL;
             $$->child[0] = NULL;
             $$->child[1] = NULL;
@@ -506,7 +581,7 @@ localdecl:KWINT ID
       else
       {
          fprintf(stderr, "Variable (%s) already declared. Exiting.\n", $2);
-         exit(1);
+         YYABORT;
       }
    }
 
@@ -514,112 +589,162 @@ localdecl:KWINT ID
 ;
 %%
 /******* Functions *******/
-extern FILE *yyin; // from lex
-extern void yylex_destroy();
+extern int yyget_lineno(void *scanner); // from lex
 
 int main(int argc, char **argv)
 {
    int stat = 1;
    int doAssembly = 1;
-   int doTrace = 0;
-   FILE *outputFile = NULL;
+   int outputFd = -1;
+   Output output;
+   CompilerContext ctx;
+   InputText inputText = { NULL, 0, 0 };
+   FILE *inputFile = NULL;
    char *inputFilename = NULL;
    char outputFilename[256];
+   char **batchFiles = (char**) malloc(argc * sizeof(char*));
+   char **manifestFiles;
+   int numBatchFiles = 0, numManifestFiles, useManifest = 0;
+   int numThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
 
-   table = newSymbolTable();
+   initCompilerContext(&ctx);
 
    // Validating the command line arguments
    for (int i = 1; i < argc; i++) {
       if (strcmp(argv[i], "-t") == 0) {
-         doTrace = 1;
+         ctx.debug = 1;
       } else if (strcmp(argv[i], "-d") == 0) {
          doAssembly = 0;  //disable assembly generation
+         ctx.printAST = 1;
          printf("Please provide the j source code then hit ctrl+D to indicate EOF:\n");
+      } else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 ||
+                 strcmp(argv[i], "-O2") == 0) {
+         ctx.optLevel = argv[i][2] - '0';
+      } else if (strncmp(argv[i], "-finline-limit=", 15) == 0) {
+         ctx.inlineLimit = atoi(argv[i] + 15);
+      } else if (strncmp(argv[i], "-fcodegen-threads=", 18) == 0) {
+         ctx.codegenThreads = atoi(argv[i] + 18);
+      } else if (strncmp(argv[i], "-fcache-dir=", 12) == 0 && argv[i][12] != '\0') {
+         ctx.cacheDir = argv[i] + 12;
+      } else if (strcmp(argv[i], "-fstream") == 0) {
+         ctx.streaming = 1;
+      } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+         numThreads = atoi(argv[i] + 2);
       } else if (argv[i][0] == '-') {
          fprintf(stderr, "Error: Unknown argument '%s'\nExiting!", argv[i]);
          return 1;
-      } else if (inputFilename == NULL) {
-         inputFilename = argv[i];
+      } else if (argv[i][0] == '@') {
+         // a manifest: a file listing the input files, one per line
+         if (readManifest(argv[i] + 1, &manifestFiles, &numManifestFiles) < 0) {
+            fprintf(stderr, "Error: Unable to read manifest '%s'\n\nExiting!", argv[i] + 1);
+            return 1;
+         }
+         batchFiles = (char**) realloc(batchFiles, (argc + numBatchFiles + numManifestFiles) * sizeof(char*));
+         for (int j = 0; j < numManifestFiles; j++)
+            batchFiles[numBatchFiles++] = manifestFiles[j];
+         free(manifestFiles);
+         useManifest = 1;
       } else {
-         fprintf(stderr, "Error: Too many input files. Only one .j file supported.\n\nExiting!");
+         batchFiles[numBatchFiles++] = argv[i];
+      }
+   }
+
+   // Many files (or a manifest): compile them all on a thread pool
+   if (numBatchFiles > 1 || useManifest) {
+      if (ctx.printAST) {
+         fprintf(stderr, "Error: -d takes a single input\n\nExiting!");
          return 1;
       }
+      stat = compileBatch(batchFiles, numBatchFiles, numThreads, &ctx) > 0;
+      free(batchFiles);  // manifest names are left to the exit
+      return stat;
    }
+   if (numBatchFiles == 1)
+      inputFilename = batchFiles[0];
+   free(batchFiles);
 
-   if (inputFilename == NULL) {
+   if (inputFilename == NULL && ctx.streaming) {
+      inputFile = stdin;  // scanned as it is read
+   } else if (inputFilename == NULL) {
       // read from stdin
-      yyin = stdin;
+      if (readInputFile(stdin, &inputText) < 0) {
+         fprintf(stderr, "Error: Unable to read standard input\n\nExiting!");
+         return 1;
+      }
    } else {
       // Check for ".j" extension
       if (strlen(inputFilename) < 3 || strcmp(inputFilename + strlen(inputFilename) - 2, ".j") != 0) {
          fprintf(stderr, "Error: Input file must have a '.j' extension\n\nExiting!");
          return 1;
       }
-      
-      yyin = fopen(inputFilename, "r");
-      if (!yyin) {
-         fprintf(stderr, "Error: Unable to open input file '%s'\n\nExiting!", inputFilename);
-         return 1;
+
+      // when streaming, the scanner reads the file a buffer at a
+      // time; otherwise map the file so the scanner works on it in
+      // place, and a file that cannot be mapped is read into memory
+      if (ctx.streaming) {
+         inputFile = fopen(inputFilename, "r");
+         if (!inputFile) {
+            fprintf(stderr, "Error: Unable to open input file '%s'\n\nExiting!", inputFilename);
+            return 1;
+         }
+      } else if (mapInputFile(inputFilename, &inputText) < 0) {
+         inputFile = fopen(inputFilename, "r");
+         if (!inputFile || readInputFile(inputFile, &inputText) < 0) {
+            fprintf(stderr, "Error: Unable to open input file '%s'\n\nExiting!", inputFilename);
+            if (inputFile)
+               fclose(inputFile);
+            return 1;
+         }
+         fclose(inputFile);
       }
 
    if (doAssembly == 1) {
       // Out file (replace .j with .s)
       snprintf(outputFilename, sizeof(outputFilename), "%.*s.s", (int)(strlen(inputFilename) - 2), inputFilename);
-      outputFile = fopen(outputFilename, "w");
-      if (!outputFile) {
+      outputFd = open(outputFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (outputFd < 0) {
          fprintf(stderr, "Error: Unable to open output file '%s'\n\nExiting!", outputFilename);
-         fclose(yyin);
+         freeInputText(&inputText);
+         if (inputFile)
+            fclose(inputFile);
          return 1;
       }
       }
    }
 
    // Toggling debugging flag
-   if (doTrace) {
+   if (ctx.debug) {
       fprintf(stderr, "Debugging enabled\n");
-      debug = 1;
    }
 
-   stat = yyparse();
-
-   fclose(yyin);
-
-   if (doAssembly == 1) {
-      if (outputFile != NULL) {
-         fprintf(outputFile, "\n\t.data\n");
-         for (int i = 0; i < lastStringIndex; i++) {
-            fprintf(outputFile, ".SC%d:   .string %s\n", i, savedStrings[i]);
-            free(savedStrings[i]);
-         }
-         genCodeFromASTree(astRoot, 0, outputFile);
-         fclose(outputFile);
+   if (outputFd >= 0) {
+      initOutput(&output, outputFd);
+      if (inputFile)
+         stat = compileStream(&ctx, inputFile, &output);
+      else
+         stat = compileInPlace(&ctx, inputText.data, inputText.size, &output);
+      if (flushOutput(&output) < 0) {
+         fprintf(stderr, "Error: Unable to write output file '%s'\n", outputFilename);
+         stat = 1;
       }
+      if (ctx.debug)
+         printOutputStats(&output, stderr);
+      freeOutput(&output);
+      close(outputFd);
+   } else if (inputFile) {
+      stat = compileStream(&ctx, inputFile, NULL);
+   } else {
+      stat = compileInPlace(&ctx, inputText.data, inputText.size, NULL);
    }
-   else{
-   printASTree(astRoot, 0, stdout);
-   }
-
-   if (outputFile != NULL) {
-      fclose(outputFile);
-   }
-   freeAllSymbols(table);
-   free(table);
-   freeASTree(astRoot);
-   yylex_destroy();
+   freeInputText(&inputText);
+   if (inputFile && inputFile != stdin)
+      fclose(inputFile);
 
    return stat;
 }
 
-
-extern int yylineno; // from lex
-
-int yyerror(char *s)
+int yyerror(CompilerContext *ctx, void *scanner, const char *s)
 {
-   fprintf(stderr, "Error: line %d: %s\n",yylineno,s);
+   fprintf(stderr, "Error: line %d: %s\n", yyget_lineno(scanner), s);
    return 0;
 }
-
-int yywrap()
-{
-   return(1);
-}
\ No newline at end of file
@@ -0,0 +1,289 @@
+//
+// IR Pass Manager and basic IR cleanup passes
+// - see passes.h for the pass interface
+// - -O0 runs no passes; -O1 cleans up the CFG and removes unused
+//   temporaries; -O2 adds the more expensive passes
+//
+#include <stdlib.h>
+#include <string.h>
+#include "passes.h"
+#include "compiler.h"
+
+static THREADLOCAL IRPass passes[MAXPASSES];
+static THREADLOCAL int numPasses = 0;
+
+// Add a pass to the end of the pipeline
+// - returns 0 on success, -1 if the pass table is full
+int registerPass(const char *name, IRPassFunc run, int minOptLevel)
+{
+   if (numPasses == MAXPASSES)
+      return -1;
+   passes[numPasses].name = name;
+   passes[numPasses].run = run;
+   passes[numPasses].minOptLevel = minOptLevel;
+   passes[numPasses].changes = 0;
+   passes[numPasses].runs = 0;
+   numPasses++;
+   return 0;
+}
+
+// Register the standard pipeline (only once)
+void registerDefaultPasses()
+{
+   if (numPasses > 0)
+      return;
+   registerPass("simplifycfg", simplifyCFG, 1);
+   registerPass("tailcalls", tailCalls, 1);
+   registerPass("copyprop", copyPropagation, 2);
+   registerPass("gvn", valueNumbering, 2);
+   registerPass("loops", loopOptimize, 2);
+   registerPass("deadstores", deadStoreElim, 1);
+   registerPass("dce", deadCodeElim, 1);
+}
+
+// Run every pass enabled at optLevel over func, in order
+// - returns the total number of changes made
+int runPasses(IRFunc *func, int optLevel)
+{
+   int i, n, total = 0;
+   for (i=0; i < numPasses; i++) {
+      if (optLevel < passes[i].minOptLevel)
+         continue;
+      n = passes[i].run(func);
+      passes[i].changes += n;
+      passes[i].runs++;
+      total += n;
+   }
+   buildCFG(func);
+   return total;
+}
+
+// Print how much each pass did
+void printPassStats(FILE *out)
+{
+   int i;
+   for (i=0; i < numPasses; i++)
+      if (passes[i].runs > 0)
+         fprintf(out, "pass %-12s %4d runs %6ld changes\n", passes[i].name,
+                 passes[i].runs, passes[i].changes);
+}
+
+// Follow a chain of blocks that only hold a jump
+static IRBlock* jumpTarget(IRBlock* b)
+{
+   int hops = 0;
+   while (b->numInstrs == 1 && b->instrs[0].op == IR_JUMP &&
+          b->instrs[0].target[0] != b && hops++ < 16)
+      b = b->instrs[0].target[0];
+   return b;
+}
+
+// CFG simplification
+// - jumps/branches to a block that only jumps on are redirected
+// - a branch with both targets the same becomes a jump
+// - a block that is the only successor of its only predecessor is
+//   merged into it
+// - unreachable blocks are deleted
+int simplifyCFG(IRFunc *func)
+{
+   int i, j, changes = 0;
+   IRBlock *b, *s;
+   IRInstr* term;
+
+   for (i=0; i < func->numBlocks; i++) {
+      term = blockTerminator(func->blocks[i]);
+      for (j=0; j < numSuccs(func->blocks[i]); j++) {
+         s = jumpTarget(term->target[j]);
+         if (s != term->target[j]) {
+            term->target[j] = s;
+            changes++;
+         }
+      }
+      if (term->op == IR_BR && term->target[0] == term->target[1]) {
+         term->op = IR_JUMP;
+         term->src1 = term->src2 = NOVREG;
+         changes++;
+      }
+   }
+   buildCFG(func);
+   for (i=0; i < func->numBlocks; i++) {
+      b = func->blocks[i];
+      term = blockTerminator(b);
+      if (!term || term->op != IR_JUMP)
+         continue;
+      s = term->target[0];
+      if (s == b || s == func->blocks[0] || s->numPreds != 1)
+         continue;
+      // move s's instructions onto the end of b
+      removeIR(b, b->numInstrs-1);
+      for (j=0; j < s->numInstrs; j++)
+         insertIRCopy(b, b->numInstrs, &s->instrs[j]);
+      s->numInstrs = 0;
+      emitIR(s, IR_RET, NOVREG, NOVREG, NOVREG, 0); // s is now unreachable
+      buildCFG(func);
+      changes++;
+      i--;  // b may be able to absorb its new successor too
+   }
+   changes += removeUnreachableBlocks(func);
+   return changes;
+}
+
+// Dead code elimination for temporaries
+// - an instruction with no side effects whose result is a temp
+//   that is never read is removed; repeated until nothing changes
+// - params and locals are left alone
+int deadCodeElim(IRFunc *func)
+{
+   int i, j, k, n, uses[2], changes = 0, removed;
+   int* useCount = (int*) malloc((func->numVRegs+1)*sizeof(int));
+   IRBlock* b;
+   IRInstr* ins;
+   do {
+      removed = 0;
+      memset(useCount, 0, (func->numVRegs+1)*sizeof(int));
+      for (i=0; i < func->numBlocks; i++)
+         for (j=0; j < func->blocks[i]->numInstrs; j++) {
+            n = irUses(&func->blocks[i]->instrs[j], uses);
+            for (k=0; k < n; k++)
+               useCount[uses[k]]++;
+         }
+      for (i=0; i < func->numBlocks; i++) {
+         b = func->blocks[i];
+         for (j=b->numInstrs-1; j >= 0; j--) {
+            ins = &b->instrs[j];
+            if (!irHasSideEffects(ins) && ins->dst >= func->numVars &&
+                useCount[ins->dst] == 0) {
+               removeIR(b, j);
+               removed++;
+            }
+         }
+      }
+      changes += removed;
+   } while (removed);
+   free(useCount);
+   return changes;
+}
+
+// Dead store elimination for params and locals
+// - solves the liveness of the vars over the CFG; an instruction
+//   with no side effects that writes a var which is not read again
+//   before being overwritten (or before the function returns) is
+//   removed, and dce then removes what computed its operands
+int deadStoreElim(IRFunc *func)
+{
+   int i, j, k, n, s, uses[2], changed, changes = 0, nv = func->numVars;
+   int nb = func->numBlocks;
+   char *in, *live;
+   IRBlock* b;
+   IRInstr* ins;
+
+   if (nv == 0)
+      return 0;
+   in = (char*) calloc((size_t) nb*nv, 1);
+   live = (char*) malloc(nv);
+   buildCFG(func);
+   do {
+      // live-in sets of the vars, iterated to a fixed point
+      changed = 0;
+      for (i=nb-1; i >= 0; i--) {
+         b = func->blocks[i];
+         memset(live, 0, nv);
+         for (j=0; j < numSuccs(b); j++)
+            for (s=blockSucc(b, j)->id, k=0; k < nv; k++)
+               live[k] |= in[s*nv+k];
+         for (j=b->numInstrs-1; j >= 0; j--) {
+            ins = &b->instrs[j];
+            if (ins->dst >= 0 && ins->dst < nv)
+               live[ins->dst] = 0;
+            n = irUses(ins, uses);
+            for (k=0; k < n; k++)
+               if (uses[k] < nv)
+                  live[uses[k]] = 1;
+         }
+         if (memcmp(live, in+i*nv, nv) != 0) {
+            memcpy(in+i*nv, live, nv);
+            changed = 1;
+         }
+      }
+   } while (changed);
+
+   // the same backward walk, now removing the dead writes
+   for (i=0; i < nb; i++) {
+      b = func->blocks[i];
+      memset(live, 0, nv);
+      for (j=0; j < numSuccs(b); j++)
+         for (s=blockSucc(b, j)->id, k=0; k < nv; k++)
+            live[k] |= in[s*nv+k];
+      for (j=b->numInstrs-1; j >= 0; j--) {
+         ins = &b->instrs[j];
+         if (ins->dst >= 0 && ins->dst < nv) {
+            if (!live[ins->dst] && !irHasSideEffects(ins)) {
+               removeIR(b, j);
+               changes++;
+               continue;
+            }
+            live[ins->dst] = 0;
+         }
+         n = irUses(ins, uses);
+         for (k=0; k < n; k++)
+            if (uses[k] < nv)
+               live[uses[k]] = 1;
+      }
+   }
+   free(in);
+   free(live);
+   return changes;
+}
+
+// Local copy propagation
+// - after "mov d, s" in a block, later reads of d in that block
+//   read s instead, until d or s is written again
+// - the mov itself is left for dead code elimination
+int copyPropagation(IRFunc *func)
+{
+   int i, j, k, v, changes = 0, numKeys;
+   int* copyOf = (int*) malloc((func->numVRegs+1)*sizeof(int));
+   int* keys = (int*) malloc((func->numVRegs+1)*sizeof(int));
+   char* isKey = (char*) calloc(func->numVRegs+1, 1);
+   IRBlock* b;
+   IRInstr* ins;
+
+   for (v=0; v < func->numVRegs; v++)
+      copyOf[v] = NOVREG;
+   for (i=0; i < func->numBlocks; i++) {
+      b = func->blocks[i];
+      numKeys = 0;
+      for (j=0; j < b->numInstrs; j++) {
+         ins = &b->instrs[j];
+         if (ins->src1 >= 0 && copyOf[ins->src1] != NOVREG) {
+            ins->src1 = copyOf[ins->src1];
+            changes++;
+         }
+         if (ins->src2 >= 0 && copyOf[ins->src2] != NOVREG) {
+            ins->src2 = copyOf[ins->src2];
+            changes++;
+         }
+         if (ins->dst < 0)
+            continue;
+         // a write to dst ends every copy relation involving it
+         for (k=0; k < numKeys; k++)
+            if (keys[k] == ins->dst || copyOf[keys[k]] == ins->dst)
+               copyOf[keys[k]] = NOVREG;
+         if (ins->op == IR_MOV && ins->src1 != ins->dst) {
+            copyOf[ins->dst] = ins->src1;
+            if (!isKey[ins->dst]) {
+               isKey[ins->dst] = 1;
+               keys[numKeys++] = ins->dst;
+            }
+         }
+      }
+      for (k=0; k < numKeys; k++) {
+         copyOf[keys[k]] = NOVREG;
+         isKey[keys[k]] = 0;
+      }
+   }
+   free(copyOf);
+   free(keys);
+   free(isKey);
+   return changes;
+}
@@ -0,0 +1,48 @@
+//
+// IR Pass Manager Interface
+// - an optimization pass is a function that rewrites one IRFunc
+//   and returns how many changes it made
+// - passes are registered with the lowest -O level they run at,
+//   and runPasses() runs every enabled pass in registration order
+//
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <stdio.h>
+#include "ir.h"
+
+#define MAXPASSES 32
+
+typedef int (*IRPassFunc)(IRFunc *func);
+
+typedef struct
+{
+   const char *name;
+   IRPassFunc run;
+   int minOptLevel;   // pass runs at this -O level and above
+   long changes;      // total changes made, for statistics
+   int runs;          // number of times it was run
+} IRPass;
+
+int registerPass(const char *name, IRPassFunc run, int minOptLevel);
+void registerDefaultPasses();
+int runPasses(IRFunc *func, int optLevel);
+void printPassStats(FILE *out);
+
+// passes defined in passes.c
+int simplifyCFG(IRFunc *func);
+int deadCodeElim(IRFunc *func);
+int deadStoreElim(IRFunc *func);
+int copyPropagation(IRFunc *func);
+
+// value numbering (see cse.c)
+int valueNumbering(IRFunc *func);
+
+// loop optimizations (see loops.c)
+int loopOptimize(IRFunc *func);
+void printLoopStats(FILE *out);
+
+// tail calls and self recursion (see tailcall.c)
+int tailCalls(IRFunc *func);
+
+#endif
@@ -0,0 +1,475 @@
+//
+// Machine Code Buffer and Peephole Optimizer
+// - see peephole.h for the buffer interface
+// - the optimizer slides over the buffer trying every rule of the
+//   rule table at each position; a rule looks at a small window of
+//   instructions starting there and rewrites it in place; after a
+//   rewrite the window backs up a little, since the new code may
+//   now match a rule together with the instructions before it
+// - to add a rule, write a function like the ones below and add it
+//   to peepRules[]; each rule counts how often it fired
+// - some rules need to know that a register is dead after an
+//   instruction; regDeadAfter() looks ahead in the straight-line
+//   code and gives up (says live) at any label or branch
+//
+#include <stdlib.h>
+#include <string.h>
+#include "peephole.h"
+#include "compiler.h"
+#include "regalloc.h"
+
+// Initialize an empty buffer
+void initMBuffer(MBuffer* buf)
+{
+   buf->instrs = NULL;
+   buf->numInstrs = buf->maxInstrs = 0;
+   buf->func = NULL;
+}
+
+void freeMBuffer(MBuffer* buf)
+{
+   free(buf->instrs);
+   initMBuffer(buf);
+}
+
+// Append an instruction; label and sym start out unset
+MInstr* emitM(MBuffer* buf, MOp op, int rd, int rs1, int rs2, int imm)
+{
+   MInstr* m;
+   if (buf->numInstrs == buf->maxInstrs) {
+      buf->maxInstrs = buf->maxInstrs ? buf->maxInstrs*2 : 64;
+      buf->instrs = (MInstr*) realloc(buf->instrs, buf->maxInstrs*sizeof(MInstr));
+   }
+   m = &buf->instrs[buf->numInstrs++];
+   m->op = op;
+   m->rd = rd;
+   m->rs1 = rs1;
+   m->rs2 = rs2;
+   m->imm = imm;
+   m->label = -1;
+   m->sym = NULL;
+   return m;
+}
+
+// Remove an instruction
+// - it is only marked; peephole() closes the gaps as it goes, so a
+//   removal does not move the rest of the buffer
+void removeM(MBuffer* buf, int pos)
+{
+   buf->instrs[pos].op = M_DELETED;
+}
+
+static const char* branchNames[] = { "\tbeq\t", "\tbne\t", "\tblt\t", "\tbgt\t", "\tbge\t", "\tble\t" };
+
+// Emit a register name followed by sep
+static void emitReg(Output* out, int r, const char* sep)
+{
+   emitStr(out, regName(r));
+   emitStr(out, sep);
+}
+
+// Emit a label of the buffer's function, .L<func>_<label>
+static void emitLabel(Output* out, MBuffer* buf, int label)
+{
+   emitStr(out, ".L");
+   emitStr(out, buf->func);
+   emitChar(out, '_');
+   emitInt(out, label);
+}
+
+// Print the buffer as assembly text
+void printMBuffer(MBuffer* buf, Output* out)
+{
+   int i;
+   MInstr* m;
+   for (i=0; i < buf->numInstrs; i++) {
+      m = &buf->instrs[i];
+      switch (m->op) {
+       case M_LABEL:
+          emitChar(out, '\n');
+          if (m->sym)
+             emitStr(out, m->sym);
+          else
+             emitLabel(out, buf, m->label);
+          emitStr(out, ":\n");
+          break;
+       case M_COMMENT:
+          emitStr(out, "# ");
+          emitStr(out, m->sym);
+          emitChar(out, '\n');
+          break;
+       case M_LI:
+          emitStr(out, "\tli\t");
+          emitReg(out, m->rd, ", ");
+          emitInt(out, m->imm);
+          emitChar(out, '\n');
+          break;
+       case M_LA:
+          emitStr(out, "\tla\t");
+          emitReg(out, m->rd, ", ");
+          emitStr(out, m->sym);
+          emitChar(out, '\n');
+          break;
+       case M_LASTR:
+          emitStr(out, "\tla\t");
+          emitReg(out, m->rd, ", .SC");
+          emitInt(out, m->imm);
+          emitChar(out, '\n');
+          break;
+       case M_MV:
+          emitStr(out, "\tmv\t");
+          emitReg(out, m->rd, ", ");
+          emitReg(out, m->rs1, "\n");
+          break;
+       case M_ADD:
+       case M_SUB:
+          emitStr(out, m->op == M_ADD ? "\tadd\t" : "\tsub\t");
+          emitReg(out, m->rd, ", ");
+          emitReg(out, m->rs1, ", ");
+          emitReg(out, m->rs2, "\n");
+          break;
+       case M_ADDI:
+       case M_SLLI:
+          emitStr(out, m->op == M_ADDI ? "\taddi\t" : "\tslli\t");
+          emitReg(out, m->rd, ", ");
+          emitReg(out, m->rs1, ", ");
+          emitInt(out, m->imm);
+          emitChar(out, '\n');
+          break;
+       case M_LW:
+          emitStr(out, "\tlw\t");
+          emitReg(out, m->rd, ", ");
+          emitInt(out, m->imm);
+          emitChar(out, '(');
+          emitReg(out, m->rs1, ")\n");
+          break;
+       case M_SW:
+          emitStr(out, "\tsw\t");
+          emitReg(out, m->rs1, ", ");
+          emitInt(out, m->imm);
+          emitChar(out, '(');
+          emitReg(out, m->rs2, ")\n");
+          break;
+       case M_LWG:
+          emitStr(out, "\tlw\t");
+          emitReg(out, m->rd, ", ");
+          emitStr(out, m->sym);
+          emitChar(out, '\n');
+          break;
+       case M_SWG:
+          emitStr(out, "\tsw\t");
+          emitReg(out, m->rs1, ", ");
+          emitStr(out, m->sym);
+          emitStr(out, ", t6\n");
+          break;
+       case M_BEQ: case M_BNE: case M_BLT: case M_BGT: case M_BGE: case M_BLE:
+          emitStr(out, branchNames[m->op-M_BEQ]);
+          emitReg(out, m->rs1, ", ");
+          emitReg(out, m->rs2, ", ");
+          emitLabel(out, buf, m->label);
+          emitChar(out, '\n');
+          break;
+       case M_B:
+          emitStr(out, "\tb\t");
+          emitLabel(out, buf, m->label);
+          emitChar(out, '\n');
+          break;
+       case M_JAL:
+          emitStr(out, "\tjal\t");
+          emitStr(out, m->sym);
+          emitChar(out, '\n');
+          break;
+       case M_TAIL:
+          emitStr(out, "\ttail\t");
+          emitStr(out, m->sym);
+          emitChar(out, '\n');
+          break;
+       case M_RET:
+          emitStr(out, "\tret\n");
+          break;
+       case M_ECALL:
+          emitStr(out, "\tecall\n");
+          break;
+       case M_DELETED:
+          break;
+      }
+   }
+}
+
+//
+// Register use helpers
+//
+
+static int isBranch(MOp op)
+{
+   return op >= M_BEQ && op <= M_BLE;
+}
+
+static int isArgReg(int r)
+{
+   return r >= 10 && r <= 17;
+}
+
+static int isTempReg(int r)
+{
+   return (r >= 5 && r <= 7) || r >= 28;
+}
+
+// True if the instruction reads register r
+static int readsReg(MInstr* m, int r)
+{
+   switch (m->op) {
+    case M_JAL:
+    case M_ECALL:
+       return isArgReg(r);  // arguments (ecall: a0 and a7)
+    case M_RET:
+    case M_TAIL:
+       return !isTempReg(r);  // includes the args of a tail call
+    default:
+       return m->rs1 == r || m->rs2 == r;
+   }
+}
+
+// True if the instruction overwrites register r
+static int writesReg(MInstr* m, int r)
+{
+   switch (m->op) {
+    case M_SWG:
+       return r == REG_T6;  // address scratch register
+    case M_JAL:
+       return isTempReg(r) || isArgReg(r) || r == REG_RA;
+    default:
+       return m->rd == r;
+   }
+}
+
+// Index of the next real instruction after i (skipping comments
+// and removed instructions), or -1 at the end of the buffer
+static int nextInstr(MBuffer* buf, int i)
+{
+   for (i++; i < buf->numInstrs; i++)
+      if (buf->instrs[i].op != M_COMMENT && buf->instrs[i].op != M_DELETED)
+         return i;
+   return -1;
+}
+
+// True if register r is certainly not read after instruction i
+// before being overwritten
+static int regDeadAfter(MBuffer* buf, int i, int r)
+{
+   MInstr* m;
+   for (i = nextInstr(buf, i); i >= 0; i = nextInstr(buf, i)) {
+      m = &buf->instrs[i];
+      if (m->op == M_LABEL || m->op == M_B || isBranch(m->op))
+         return 0;  // other paths may read it
+      if (readsReg(m, r))
+         return 0;
+      if (writesReg(m, r) || ((m->op == M_RET || m->op == M_TAIL) && isTempReg(r)))
+         return 1;
+   }
+   return 0;
+}
+
+// True if the instruction only computes its rd from its sources
+static int isPureDef(MOp op)
+{
+   switch (op) {
+    case M_LI: case M_LA: case M_LASTR: case M_MV: case M_ADD: case M_SUB:
+    case M_ADDI: case M_SLLI: case M_LW: case M_LWG:
+       return 1;
+    default:
+       return 0;
+   }
+}
+
+//
+// Peephole rules
+// - each rule gets the buffer and the position of the first
+//   instruction of its window, and returns 1 if it rewrote it
+//
+
+// mv r, r => (nothing)
+static int ruleSelfMove(MBuffer* buf, int i)
+{
+   MInstr* m = &buf->instrs[i];
+   if (m->op != M_MV || m->rd != m->rs1)
+      return 0;
+   removeM(buf, i);
+   return 1;
+}
+
+// op x, ... ; mv y, x => op y, ...  (x dead afterwards)
+static int ruleDefMove(MBuffer* buf, int i)
+{
+   int j = nextInstr(buf, i);
+   MInstr *m = &buf->instrs[i], *mv;
+   if (j < 0 || !isPureDef(m->op))
+      return 0;
+   mv = &buf->instrs[j];
+   if (mv->op != M_MV || mv->rs1 != m->rd || mv->rd == m->rd ||
+       mv->rd == REG_SP || !regDeadAfter(buf, j, m->rd))
+      return 0;
+   m->rd = mv->rd;
+   removeM(buf, j);
+   return 1;
+}
+
+// b .LLn ; .LLn: => .LLn:
+static int ruleJumpToNext(MBuffer* buf, int i)
+{
+   int j = nextInstr(buf, i);
+   MInstr* m = &buf->instrs[i];
+   if (m->op != M_B || j < 0 || buf->instrs[j].op != M_LABEL ||
+       buf->instrs[j].sym || buf->instrs[j].label != m->label)
+      return 0;
+   removeM(buf, i);
+   return 1;
+}
+
+// bcc .LLa ; b .LLb ; .LLa: => b!cc .LLb ; .LLa:
+static int ruleBranchOverJump(MBuffer* buf, int i)
+{
+   static const MOp inverse[] = { M_BNE, M_BEQ, M_BGE, M_BLE, M_BLT, M_BGT };
+   int j = nextInstr(buf, i), k;
+   MInstr* m = &buf->instrs[i];
+   if (!isBranch(m->op) || j < 0 || buf->instrs[j].op != M_B)
+      return 0;
+   k = nextInstr(buf, j);
+   if (k < 0 || buf->instrs[k].op != M_LABEL || buf->instrs[k].sym ||
+       buf->instrs[k].label != m->label)
+      return 0;
+   m->op = inverse[m->op-M_BEQ];
+   m->label = buf->instrs[j].label;
+   removeM(buf, j);
+   return 1;
+}
+
+// sw x, k(b) ; lw y, k(b) => sw x, k(b) ; mv y, x
+// (and the same for globals)
+static int ruleStoreLoad(MBuffer* buf, int i)
+{
+   int j = nextInstr(buf, i);
+   MInstr *st = &buf->instrs[i], *ld;
+   if (j < 0)
+      return 0;
+   ld = &buf->instrs[j];
+   if (st->op == M_SW && ld->op == M_LW) {
+      if (st->rs2 != ld->rs1 || st->imm != ld->imm)
+         return 0;
+   } else if (st->op == M_SWG && ld->op == M_LWG) {
+      if (st->sym != ld->sym || st->rs1 == REG_T6)  // t6 held the address
+         return 0;
+   } else
+      return 0;
+   if (ld->rd == st->rs1) {
+      removeM(buf, j);
+      return 1;
+   }
+   ld->op = M_MV;
+   ld->rs1 = st->rs1;
+   ld->rs2 = -1;
+   ld->sym = NULL;
+   return 1;
+}
+
+// addi r, r, a ; addi r, r, b => addi r, r, a+b  (or nothing)
+static int ruleAddAdd(MBuffer* buf, int i)
+{
+   int j = nextInstr(buf, i), sum;
+   MInstr *a = &buf->instrs[i], *b;
+   if (j < 0 || a->op != M_ADDI || a->rd != a->rs1)
+      return 0;
+   b = &buf->instrs[j];
+   if (b->op != M_ADDI || b->rd != a->rd || b->rs1 != a->rd)
+      return 0;
+   sum = a->imm + b->imm;
+   if (sum < -2048 || sum > 2047)
+      return 0;
+   removeM(buf, j);
+   if (sum == 0)
+      removeM(buf, i);
+   else
+      a->imm = sum;
+   return 1;
+}
+
+// addi x, y, 0 => mv x, y
+static int ruleAddZero(MBuffer* buf, int i)
+{
+   MInstr* m = &buf->instrs[i];
+   if (m->op != M_ADDI || m->imm != 0)
+      return 0;
+   m->op = M_MV;
+   return 1;
+}
+
+// mv x, y ; mv y, x => mv x, y
+static int ruleMoveBack(MBuffer* buf, int i)
+{
+   int j = nextInstr(buf, i);
+   MInstr *a = &buf->instrs[i], *b;
+   if (j < 0 || a->op != M_MV)
+      return 0;
+   b = &buf->instrs[j];
+   if (b->op != M_MV || b->rd != a->rs1 || b->rs1 != a->rd)
+      return 0;
+   removeM(buf, j);
+   return 1;
+}
+
+typedef struct
+{
+   const char *name;
+   int (*apply)(MBuffer *buf, int pos);
+   long hits;
+} PeepRule;
+
+static THREADLOCAL PeepRule peepRules[] = {
+   { "self-move",       ruleSelfMove, 0 },
+   { "def-move",        ruleDefMove, 0 },
+   { "jump-to-next",    ruleJumpToNext, 0 },
+   { "branch-over-jump", ruleBranchOverJump, 0 },
+   { "store-load",      ruleStoreLoad, 0 },
+   { "addi-addi",       ruleAddAdd, 0 },
+   { "addi-zero",       ruleAddZero, 0 },
+   { "move-back",       ruleMoveBack, 0 },
+};
+#define NUMPEEPRULES ((int)(sizeof(peepRules)/sizeof(peepRules[0])))
+
+// Run the rule table over the buffer until nothing matches
+// - returns the number of rewrites
+// - the instructions before position i that are done are kept
+//   packed in front of w, and removed ones are dropped as i passes
+//   them; backing up moves the last two done instructions back in
+//   front of i, so they are next to the window again
+int peephole(MBuffer* buf)
+{
+   int i = 0, w = 0, k, r, total = 0;
+   while (i < buf->numInstrs) {
+      if (buf->instrs[i].op == M_DELETED) {
+         i++;
+         continue;
+      }
+      for (r=0; r < NUMPEEPRULES; r++)
+         if (peepRules[r].apply(buf, i))
+            break;
+      if (r == NUMPEEPRULES) {
+         buf->instrs[w++] = buf->instrs[i++];
+         continue;
+      }
+      peepRules[r].hits++;
+      total++;
+      for (k=0; k < 2 && w > 0; k++)  // back up over the window just changed
+         buf->instrs[--i] = buf->instrs[--w];
+   }
+   buf->numInstrs = w;
+   return total;
+}
+
+// Print how often each rule fired
+void printPeepholeStats(FILE* out)
+{
+   int r;
+   for (r=0; r < NUMPEEPRULES; r++)
+      fprintf(out, "peephole %-17s %6ld hits\n", peepRules[r].name, peepRules[r].hits);
+}
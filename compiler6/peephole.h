@@ -0,0 +1,64 @@
+//
+// Machine Code Buffer and Peephole Optimizer Interface
+// - the backend emits a function's RISC-V code into an MBuffer of
+//   structured instructions instead of straight to the output
+//   file; the peephole optimizer rewrites the buffer, and then it
+//   is printed as assembly text
+// - register operands are x-register numbers (see regalloc.h)
+//
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+#include "output.h"
+
+typedef enum {
+   M_LABEL,    // .L<func>_<label>: or, if sym is set, sym:
+   M_COMMENT,  // # text
+   M_LI,       // li rd, imm
+   M_LA,       // la rd, sym
+   M_LASTR,    // la rd, .SC<imm>
+   M_MV,       // mv rd, rs1
+   M_ADD,      // add rd, rs1, rs2
+   M_SUB,      // sub rd, rs1, rs2
+   M_ADDI,     // addi rd, rs1, imm
+   M_SLLI,     // slli rd, rs1, imm
+   M_LW,       // lw rd, imm(rs1)
+   M_SW,       // sw rs1, imm(rs2)
+   M_LWG,      // lw rd, sym
+   M_SWG,      // sw rs1, sym, t6
+   M_BEQ, M_BNE, M_BLT, M_BGT, M_BGE, M_BLE,  // b?? rs1, rs2, .L<func>_<label>
+   M_B,        // b .L<func>_<label>
+   M_JAL,      // jal sym
+   M_TAIL,     // tail sym
+   M_RET,      // ret
+   M_ECALL,    // ecall
+   M_DELETED   // removed by the peephole optimizer, not printed
+} MOp;
+
+typedef struct
+{
+   MOp op;
+   int rd, rs1, rs2;   // registers, -1 if not used
+   int imm;            // immediate, offset, or string number
+   int label;          // label number for labels and branches
+   const char *sym;    // symbol name, or comment text
+} MInstr;
+
+typedef struct
+{
+   MInstr *instrs;
+   int numInstrs, maxInstrs;
+   const char *func;   // function name, the prefix of its labels
+} MBuffer;
+
+void initMBuffer(MBuffer *buf);
+void freeMBuffer(MBuffer *buf);
+MInstr *emitM(MBuffer *buf, MOp op, int rd, int rs1, int rs2, int imm);
+void removeM(MBuffer *buf, int pos);
+void printMBuffer(MBuffer *buf, Output *out);
+
+int peephole(MBuffer *buf);
+void printPeepholeStats(FILE *out);
+
+#endif
@@ -0,0 +1,338 @@
+//
+// Register Allocation Module
+// - linear scan allocation over the vregs of an IRFunc
+// - liveness is solved over the CFG for the vregs that are used
+//   in more than one block (params/locals and loop carried temps);
+//   every other vreg lives inside a single block
+// - each vreg gets one live interval [start,end] over the linear
+//   instruction order; an interval that spans a call can only use
+//   the callee-saved s1-s11 registers, others prefer t0-t4
+// - when no register is free, the interval that ends furthest
+//   away (weighted by loop depth) is spilled to a stack slot; t5
+//   and t6 are kept free for reloading spilled operands
+//
+#include <stdlib.h>
+#include <string.h>
+#include "regalloc.h"
+
+static const char *regNames[32] = {
+   "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+   "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+   "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+   "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+// allocatable registers: temps t0-t4 and saved s1-s11
+static const int tempRegs[] = { 5, 6, 7, 28, 29 };
+#define NUMTEMPREGS ((int)(sizeof(tempRegs)/sizeof(tempRegs[0])))
+static const int savedRegs[] = { 9, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27 };
+#define NUMSAVEDREGS ((int)(sizeof(savedRegs)/sizeof(savedRegs[0])))
+
+typedef struct
+{
+   int vreg;
+   int start, end;     // first and last instruction position
+   int crossesCall;    // value must survive a call
+   long weight;        // uses weighted by loop depth (spill cost)
+} LiveInterval;
+
+// Assembly name of a register
+const char* regName(int reg)
+{
+   if (reg < 0 || reg > 31)
+      return "??";
+   return regNames[reg];
+}
+
+// True for the callee-saved s1-s11 registers
+int isSavedReg(int reg)
+{
+   return reg == 9 || (reg >= 18 && reg <= 27);
+}
+
+// Bitset helpers for the liveness sets
+#define BITWORDS(n) (((n)+31)/32)
+#define TESTBIT(s,i) ((s)[(i)>>5] & (1u << ((i)&31)))
+#define SETBIT(s,i) ((s)[(i)>>5] |= (1u << ((i)&31)))
+#define CLRBIT(s,i) ((s)[(i)>>5] &= ~(1u << ((i)&31)))
+
+static int compareStart(const void* a, const void* b)
+{
+   const LiveInterval* x = (const LiveInterval*) a;
+   const LiveInterval* y = (const LiveInterval*) b;
+   if (x->start != y->start)
+      return x->start - y->start;
+   return x->vreg - y->vreg;
+}
+
+// Whether a call is at a position after from and before to
+// - callPos is in position order, so the first call after from is
+//   found by binary search
+static int callBetween(int* callPos, int numCalls, int from, int to)
+{
+   int lo = 0, hi = numCalls, mid;
+   while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (callPos[mid] <= from)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo < numCalls && callPos[lo] < to;
+}
+
+// Compute the live interval of every vreg
+// - returns an array indexed by vreg; unused vregs have start -1
+static LiveInterval* buildIntervals(IRFunc* func)
+{
+   int nv = func->numVRegs, nb = func->numBlocks;
+   int i, j, k, n, v, g, pos, changed, words, numGlobal = 0;
+   int uses[3];  // sources plus dst
+   int *blockStart, *blockEnd, *homeBlock, *globalIdx, *callPos;
+   int numCalls = 0, maxCalls = 16;
+   unsigned int *use, *def, *in, *out, *tmp;
+   long w;
+   IRBlock* b;
+   IRInstr* ins;
+   LiveInterval* iv = (LiveInterval*) malloc(nv*sizeof(LiveInterval));
+
+   blockStart = (int*) malloc(nb*sizeof(int));
+   blockEnd = (int*) malloc(nb*sizeof(int));
+   homeBlock = (int*) malloc(nv*sizeof(int));
+   globalIdx = (int*) malloc(nv*sizeof(int));
+   callPos = (int*) malloc(maxCalls*sizeof(int));
+   for (v=0; v < nv; v++) {
+      iv[v].vreg = v;
+      iv[v].start = iv[v].end = -1;
+      iv[v].crossesCall = 0;
+      iv[v].weight = 0;
+      homeBlock[v] = -1;
+      globalIdx[v] = -1;
+   }
+
+   // number the instructions, find block-local vs global vregs
+   pos = 0;
+   for (i=0; i < nb; i++) {
+      b = func->blocks[i];
+      blockStart[i] = pos;
+      for (j=0; j < b->numInstrs; j++, pos += 2) {
+         ins = &b->instrs[j];
+         if (ins->op == IR_CALL) {
+            if (numCalls == maxCalls) {
+               maxCalls *= 2;
+               callPos = (int*) realloc(callPos, maxCalls*sizeof(int));
+            }
+            callPos[numCalls++] = pos;
+         }
+         n = irUses(ins, uses);
+         if (ins->dst >= 0)
+            uses[n++] = ins->dst;
+         for (k=0; k < n; k++) {
+            v = uses[k];
+            if (homeBlock[v] == -1)
+               homeBlock[v] = i;
+            else if (homeBlock[v] != i && globalIdx[v] < 0)
+               globalIdx[v] = numGlobal++;
+         }
+      }
+      blockEnd[i] = pos;
+   }
+   // params are live on entry even if first used in the entry block
+   for (v=0; v < func->numParams && v < nv; v++)
+      if (globalIdx[v] < 0)
+         globalIdx[v] = numGlobal++;
+
+   // liveness (of global vregs only) by iterating to a fixed point
+   words = BITWORDS(numGlobal);
+   use = (unsigned int*) calloc((size_t) nb*words+1, sizeof(unsigned int));
+   def = (unsigned int*) calloc((size_t) nb*words+1, sizeof(unsigned int));
+   in = (unsigned int*) calloc((size_t) nb*words+1, sizeof(unsigned int));
+   out = (unsigned int*) calloc((size_t) nb*words+1, sizeof(unsigned int));
+   tmp = (unsigned int*) calloc(words+1, sizeof(unsigned int));
+   for (i=0; i < nb; i++) {
+      b = func->blocks[i];
+      for (j=0; j < b->numInstrs; j++) {
+         ins = &b->instrs[j];
+         n = irUses(ins, uses);
+         for (k=0; k < n; k++) {
+            g = globalIdx[uses[k]];
+            if (g >= 0 && !TESTBIT(def+i*words, g))
+               SETBIT(use+i*words, g);
+         }
+         if (ins->dst >= 0 && (g = globalIdx[ins->dst]) >= 0)
+            SETBIT(def+i*words, g);
+      }
+   }
+   do {
+      changed = 0;
+      for (i=nb-1; i >= 0; i--) {
+         b = func->blocks[i];
+         memset(tmp, 0, words*sizeof(unsigned int));
+         for (j=0; j < numSuccs(b); j++) {
+            k = blockSucc(b, j)->id;
+            for (n=0; n < words; n++)
+               tmp[n] |= in[k*words+n];
+         }
+         memcpy(out+i*words, tmp, words*sizeof(unsigned int));
+         for (n=0; n < words; n++) {
+            unsigned int x = use[i*words+n] | (tmp[n] & ~def[i*words+n]);
+            if (x != in[i*words+n]) {
+               in[i*words+n] = x;
+               changed = 1;
+            }
+         }
+      }
+   } while (changed);
+
+   // build intervals from the uses and defs, then stretch global
+   // vregs over the blocks they are live into or out of
+   for (i=0; i < nb; i++) {
+      b = func->blocks[i];
+      w = 1;
+      for (k=0; k < b->loopDepth && k < 6; k++)
+         w *= 8;
+      pos = blockStart[i];
+      for (j=0; j < b->numInstrs; j++, pos += 2) {
+         ins = &b->instrs[j];
+         n = irUses(ins, uses);
+         if (ins->dst >= 0)
+            uses[n++] = ins->dst;
+         for (k=0; k < n; k++) {
+            v = uses[k];
+            if (iv[v].start < 0 || pos < iv[v].start)
+               iv[v].start = pos;
+            if (pos+1 > iv[v].end)
+               iv[v].end = pos+1;
+            iv[v].weight += w;
+         }
+      }
+   }
+   for (v=0; v < nv; v++) {
+      if ((g = globalIdx[v]) < 0)
+         continue;
+      for (i=0; i < nb; i++) {
+         if (TESTBIT(in+i*words, g)) {
+            if (iv[v].start < 0 || blockStart[i] < iv[v].start)
+               iv[v].start = blockStart[i];
+            if (iv[v].end < blockStart[i])
+               iv[v].end = blockStart[i];
+         }
+         if (TESTBIT(out+i*words, g)) {
+            if (iv[v].start < 0 || blockEnd[i] < iv[v].start)
+               iv[v].start = blockEnd[i];
+            if (blockEnd[i] > iv[v].end)
+               iv[v].end = blockEnd[i];
+         }
+      }
+   }
+   // params arrive in registers before the first instruction
+   for (v=0; v < func->numParams && v < nv; v++) {
+      iv[v].start = 0;
+      if (iv[v].end < 0)
+         iv[v].end = 0;
+   }
+   // a param is live from before position 0, so a call that is the
+   // first instruction still crosses it
+   for (v=0; v < nv; v++)
+      if (iv[v].start >= 0)
+         iv[v].crossesCall = callBetween(callPos, numCalls,
+                                         v < func->numParams ? -1 : iv[v].start, iv[v].end);
+
+   free(blockStart); free(blockEnd); free(homeBlock); free(globalIdx);
+   free(callPos); free(use); free(def); free(in); free(out); free(tmp);
+   return iv;
+}
+
+// Assign a register or stack slot to every vreg of func
+RegAssignment* allocateRegisters(IRFunc* func)
+{
+   int nv = func->numVRegs;
+   int i, j, k, n, numActive = 0, victim, r;
+   unsigned int freeRegs = 0;
+   LiveInterval *iv, *sorted, **active, *cur;
+   RegAssignment* ra = (RegAssignment*) calloc(1, sizeof(RegAssignment));
+
+   ra->reg = (int*) malloc((nv+1)*sizeof(int));
+   ra->slot = (int*) malloc((nv+1)*sizeof(int));
+   for (i=0; i < nv; i++)
+      ra->reg[i] = ra->slot[i] = -1;
+
+   iv = buildIntervals(func);
+   sorted = (LiveInterval*) malloc((nv+1)*sizeof(LiveInterval));
+   for (i=0, n=0; i < nv; i++)
+      if (iv[i].start >= 0)
+         sorted[n++] = iv[i];
+   qsort(sorted, n, sizeof(LiveInterval), compareStart);
+   active = (LiveInterval**) malloc((NUMTEMPREGS+NUMSAVEDREGS+1)*sizeof(LiveInterval*));
+   for (i=0; i < NUMTEMPREGS; i++)
+      freeRegs |= 1u << tempRegs[i];
+   for (i=0; i < NUMSAVEDREGS; i++)
+      freeRegs |= 1u << savedRegs[i];
+
+   for (i=0; i < n; i++) {
+      cur = &sorted[i];
+      // expire intervals that ended before this one starts
+      for (j=0, k=0; j < numActive; j++) {
+         if (active[j]->end < cur->start)
+            freeRegs |= 1u << ra->reg[active[j]->vreg];
+         else
+            active[k++] = active[j];
+      }
+      numActive = k;
+      // pick a free register: a temp unless the value lives
+      // across a call, then a saved register
+      r = -1;
+      if (!cur->crossesCall)
+         for (j=0; j < NUMTEMPREGS && r < 0; j++)
+            if (freeRegs & (1u << tempRegs[j]))
+               r = tempRegs[j];
+      for (j=0; j < NUMSAVEDREGS && r < 0; j++)
+         if (freeRegs & (1u << savedRegs[j]))
+            r = savedRegs[j];
+      if (r < 0) {
+         // spill whichever usable interval is cheapest to keep in
+         // memory per unit of length, including this one
+         victim = -1;
+         for (j=0; j < numActive; j++) {
+            if (cur->crossesCall && !isSavedReg(ra->reg[active[j]->vreg]))
+               continue;
+            if (victim < 0 ||
+                active[j]->weight*(active[victim]->end - active[victim]->start + 1) <
+                active[victim]->weight*(active[j]->end - active[j]->start + 1))
+               victim = j;
+         }
+         if (victim >= 0 &&
+             active[victim]->weight*(cur->end - cur->start + 1) <
+             cur->weight*(active[victim]->end - active[victim]->start + 1)) {
+            r = ra->reg[active[victim]->vreg];
+            ra->reg[active[victim]->vreg] = -1;
+            ra->slot[active[victim]->vreg] = ra->numSlots++;
+            ra->numSpilled++;
+            active[victim] = active[--numActive];
+         } else {
+            ra->slot[cur->vreg] = ra->numSlots++;
+            ra->numSpilled++;
+            continue;
+         }
+      }
+      freeRegs &= ~(1u << r);
+      ra->reg[cur->vreg] = r;
+      if (isSavedReg(r))
+         ra->usedSaved |= 1u << r;
+      active[numActive++] = cur;
+   }
+
+   free(active);
+   free(sorted);
+   free(iv);
+   return ra;
+}
+
+void freeRegAssignment(RegAssignment* ra)
+{
+   if (!ra)
+      return;
+   free(ra->reg);
+   free(ra->slot);
+   free(ra);
+}
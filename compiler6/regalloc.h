@@ -0,0 +1,35 @@
+//
+// Register Allocation Interface
+// - register numbers are RISC-V x-register numbers (0-31)
+// - every vreg of an IRFunc (params, locals and temporaries alike)
+//   gets either a register or a stack slot, by linear scan over
+//   live intervals
+//
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "ir.h"
+
+#define REG_ZERO 0
+#define REG_RA   1
+#define REG_SP   2
+#define REG_FP   8
+#define REG_A0   10
+#define REG_T5   30  // scratch for spilled operands, never allocated
+#define REG_T6   31  // scratch for spilled operands, never allocated
+
+typedef struct
+{
+   int *reg;              // x register for each vreg, or -1 if spilled
+   int *slot;             // stack slot number for each spilled vreg, or -1
+   int numSlots;          // number of stack slots used
+   unsigned int usedSaved; // bit per s register that was handed out
+   int numSpilled;        // number of vregs spilled
+} RegAssignment;
+
+const char *regName(int reg);
+int isSavedReg(int reg);
+RegAssignment *allocateRegisters(IRFunc *func);
+void freeRegAssignment(RegAssignment *ra);
+
+#endif
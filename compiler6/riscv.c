@@ -0,0 +1,356 @@
+//
+// RISC-V Backend
+// - walks the blocks of an IRFunc in layout order and emits one
+//   or a few RISC-V instructions per IR instruction
+// - vregs are mapped to registers or stack slots by
+//   allocateRegisters() (see regalloc.c); a spilled operand is
+//   loaded into t5/t6 and a spilled result is stored right away
+// - frame layout (from fp, which equals sp after the prologue):
+//      0(fp) ra, 4(fp) old fp, then one word per spill slot,
+//      then the saved s registers
+// - a leaf function (no calls) and the program block do not save
+//   ra and fp; their slots are addressed from sp, starting at 0(sp),
+//   and a leaf that needs no slots does not touch sp at all
+// - the frame is sized from the slots actually used and rounded up
+//   to 16 bytes, as the psABI requires of sp; the psABI has no red
+//   zone, so nothing is ever stored below sp
+// - a frame size or slot offset too large for a 12-bit immediate
+//   is built in t6 first (li, then add)
+// - code goes into a machine code buffer first, so the peephole
+//   optimizer (peephole.c) can clean it up at -O1 and above
+// - at -O1 and above a call right before a return is a tail call:
+//   the frame is torn down first and the call becomes a "tail", so
+//   the callee returns straight to our caller; a function whose
+//   only calls are tail calls does not need to save ra either
+// - globals and callees are symbol ids in the IR; their names are
+//   looked up in the symbol table's info[] only here, as the
+//   machine instructions are made
+//
+#include <stdlib.h>
+#include "riscv.h"
+#include "compiler.h"
+#include "regalloc.h"
+#include "peephole.h"
+
+#define STACKALIGN 16  // psABI sp alignment
+#define MAXIMM 2047     // largest immediate of addi, lw and sw
+
+
+// backend state for the function being generated
+static THREADLOCAL IRFunc* curFunc;
+static THREADLOCAL RegAssignment* curRA;
+static THREADLOCAL int frameSize;
+static THREADLOCAL int saveRAFP;   // ra and fp are saved, slots are fp-relative
+static THREADLOCAL int frameReg;   // fp or sp, base register of the slots
+static THREADLOCAL MBuffer mbuf;
+
+static int slotOffset(int slot)
+{
+   return (saveRAFP ? 8 : 0) + 4*slot;
+}
+
+// Add imm to sp, through t6 if it does not fit in an addi
+static void adjustSP(int imm)
+{
+   if (imm >= -MAXIMM-1 && imm <= MAXIMM)
+      emitM(&mbuf, M_ADDI, REG_SP, REG_SP, -1, imm);
+   else {
+      emitM(&mbuf, M_LI, REG_T6, -1, -1, imm);
+      emitM(&mbuf, M_ADD, REG_SP, REG_SP, REG_T6, 0);
+   }
+}
+
+// Base register to address a slot from, with its offset in *off
+// - a slot past the reach of a 12-bit offset is addressed through
+//   t6, set to its address here
+static int slotBase(int slot, int* off)
+{
+   *off = slotOffset(slot);
+   if (*off <= MAXIMM)
+      return frameReg;
+   emitM(&mbuf, M_LI, REG_T6, -1, -1, *off);
+   emitM(&mbuf, M_ADD, REG_T6, REG_T6, frameReg, 0);
+   *off = 0;
+   return REG_T6;
+}
+
+static void loadSlot(int rd, int slot)
+{
+   int off, base = slotBase(slot, &off);
+   emitM(&mbuf, M_LW, rd, base, -1, off);
+}
+
+// (r is never t6, which may hold the address)
+static void storeSlot(int r, int slot)
+{
+   int off, base = slotBase(slot, &off);
+   emitM(&mbuf, M_SW, -1, r, base, off);
+}
+
+// True if the instruction at position pos of b is a tail call
+static int isTailCall(IRBlock* b, int pos)
+{
+   return optLevel > 0 && !curFunc->isProgram && b->instrs[pos].op == IR_CALL &&
+          pos+1 < b->numInstrs && b->instrs[pos+1].op == IR_RET;
+}
+
+// True if the function contains a call that returns to it
+static int hasCalls(IRFunc* func)
+{
+   int i, j;
+   for (i=0; i < func->numBlocks; i++)
+      for (j=0; j < func->blocks[i]->numInstrs; j++)
+         if (func->blocks[i]->instrs[j].op == IR_CALL && !isTailCall(func->blocks[i], j))
+            return 1;
+   return 0;
+}
+
+// Register holding source vreg v, loading it into scratch if spilled
+static int srcReg(int v, int scratch)
+{
+   if (v == ZEROVREG)
+      return REG_ZERO;
+   if (curRA->reg[v] >= 0)
+      return curRA->reg[v];
+   loadSlot(scratch, curRA->slot[v]);
+   return scratch;
+}
+
+// Register to compute destination vreg v into
+static int dstReg(int v)
+{
+   if (curRA->reg[v] >= 0)
+      return curRA->reg[v];
+   return REG_T5;
+}
+
+// Store a result computed into r if its vreg v is spilled
+static void finishDst(int v, int r)
+{
+   if (curRA->reg[v] < 0)
+      storeSlot(r, curRA->slot[v]);
+}
+
+// Branch instruction for a relational op, optionally negated
+static MOp branchOp(int relop, int negate)
+{
+   switch (relop) {
+    case '=': return negate ? M_BNE : M_BEQ;
+    case '!': return negate ? M_BEQ : M_BNE;
+    case '<': return negate ? M_BGE : M_BLT;
+    default:  return negate ? M_BLE : M_BGT;  // '>'
+   }
+}
+
+// Emit a branch (or, for M_B, a jump) to a block's label
+static void emitBranch(MOp op, int rs1, int rs2, IRBlock* target)
+{
+   emitM(&mbuf, op, -1, rs1, rs2, 0)->label = target->label;
+}
+
+// Emit the function prologue
+// - allocates the frame, saves ra/fp (unless this is a leaf) and
+//   the s registers this function uses, and moves the incoming
+//   params out of the argument registers
+static void genPrologue()
+{
+   int r, v, n = 0;
+   if (frameSize > 0)
+      adjustSP(-frameSize);
+   if (saveRAFP) {
+      emitM(&mbuf, M_SW, -1, REG_RA, REG_SP, 0);
+      emitM(&mbuf, M_SW, -1, REG_FP, REG_SP, 4);
+      emitM(&mbuf, M_MV, REG_FP, REG_SP, -1, 0);
+   }
+   for (r=0; r < 32; r++)
+      if (curRA->usedSaved & (1u << r))
+         storeSlot(r, curRA->numSlots+n++);
+   for (v=0; v < curFunc->numParams; v++) {
+      if (curRA->reg[v] >= 0)
+         emitM(&mbuf, M_MV, curRA->reg[v], REG_A0+v, -1, 0);
+      else if (curRA->slot[v] >= 0)
+         storeSlot(REG_A0+v, curRA->slot[v]);
+   }
+}
+
+// The assembly name of a global or function
+static const char* symName(SymId sym)
+{
+   return symbols->info[sym].name;
+}
+
+// Emit the function epilogue (or the exit call for the program)
+// - if tailCallee is set, the epilogue ends with a tail call to it
+//   instead of a return
+static void genEpilogue(SymId tailCallee)
+{
+   int r, n = 0;
+   if (curFunc->isProgram) {
+      emitM(&mbuf, M_LI, REG_A0, -1, -1, 0);
+      emitM(&mbuf, M_LI, REG_A0+7, -1, -1, 93);
+      emitM(&mbuf, M_ECALL, -1, -1, -1, 0);
+      return;
+   }
+   for (r=0; r < 32; r++)
+      if (curRA->usedSaved & (1u << r))
+         loadSlot(r, curRA->numSlots+n++);
+   if (saveRAFP) {
+      emitM(&mbuf, M_MV, REG_SP, REG_FP, -1, 0);
+      emitM(&mbuf, M_LW, REG_RA, REG_SP, -1, 0);
+      emitM(&mbuf, M_LW, REG_FP, REG_FP, -1, 4);
+   }
+   if (frameSize > 0)
+      adjustSP(frameSize);
+   if (tailCallee != NOSYMID)
+      emitM(&mbuf, M_TAIL, -1, -1, -1, 0)->sym = symName(tailCallee);
+   else
+      emitM(&mbuf, M_RET, -1, -1, -1, 0);
+}
+
+// Emit code for one IR instruction
+// - next is the block laid out after the current one (or NULL),
+//   so jumps to it can be left out
+static void genInstr(IRInstr* ins, IRBlock* next)
+{
+   int d, a, b;
+   switch (ins->op) {
+    case IR_LI:
+       d = dstReg(ins->dst);
+       emitM(&mbuf, M_LI, d, -1, -1, ins->imm);
+       finishDst(ins->dst, d);
+       break;
+    case IR_LA:
+       d = dstReg(ins->dst);
+       emitM(&mbuf, M_LA, d, -1, -1, 0)->sym = symName(ins->sym);
+       finishDst(ins->dst, d);
+       break;
+    case IR_LASTR:
+       d = dstReg(ins->dst);
+       emitM(&mbuf, M_LASTR, d, -1, -1, ins->imm);
+       finishDst(ins->dst, d);
+       break;
+    case IR_MOV:
+       a = srcReg(ins->src1, REG_T5);
+       d = dstReg(ins->dst);
+       if (d != a)
+          emitM(&mbuf, M_MV, d, a, -1, 0);
+       finishDst(ins->dst, d);
+       break;
+    case IR_ADD:
+    case IR_SUB:
+       a = srcReg(ins->src1, REG_T5);
+       b = srcReg(ins->src2, REG_T6);
+       d = dstReg(ins->dst);
+       emitM(&mbuf, ins->op == IR_ADD ? M_ADD : M_SUB, d, a, b, 0);
+       finishDst(ins->dst, d);
+       break;
+    case IR_ADDI:
+    case IR_SLLI:
+       a = srcReg(ins->src1, REG_T5);
+       d = dstReg(ins->dst);
+       emitM(&mbuf, ins->op == IR_ADDI ? M_ADDI : M_SLLI, d, a, -1, ins->imm);
+       finishDst(ins->dst, d);
+       break;
+    case IR_LOADG:
+       d = dstReg(ins->dst);
+       emitM(&mbuf, M_LWG, d, -1, -1, 0)->sym = symName(ins->sym);
+       finishDst(ins->dst, d);
+       break;
+    case IR_STOREG:
+       a = srcReg(ins->src1, REG_T5);
+       emitM(&mbuf, M_SWG, -1, a, -1, 0)->sym = symName(ins->sym);
+       break;
+    case IR_LOAD:
+       a = srcReg(ins->src1, REG_T5);
+       d = dstReg(ins->dst);
+       emitM(&mbuf, M_LW, d, a, -1, ins->imm);
+       finishDst(ins->dst, d);
+       break;
+    case IR_STORE:
+       a = srcReg(ins->src1, REG_T5);
+       b = srcReg(ins->src2, REG_T6);
+       emitM(&mbuf, M_SW, -1, a, b, ins->imm);
+       break;
+    case IR_GETRET:
+       d = dstReg(ins->dst);
+       emitM(&mbuf, M_MV, d, REG_A0, -1, 0);
+       finishDst(ins->dst, d);
+       break;
+    case IR_ARG:
+       if (ins->src1 >= 0 && curRA->reg[ins->src1] < 0)
+          loadSlot(REG_A0+ins->imm, curRA->slot[ins->src1]);
+       else
+          emitM(&mbuf, M_MV, REG_A0+ins->imm, srcReg(ins->src1, REG_T5), -1, 0);
+       break;
+    case IR_CALL:
+       emitM(&mbuf, M_JAL, -1, -1, -1, 0)->sym = symName(ins->sym);
+       break;
+    case IR_BR:
+       a = srcReg(ins->src1, REG_T5);
+       b = srcReg(ins->src2, REG_T6);
+       if (ins->target[0] == next) {
+          // fall into the true block, branch away when false
+          emitBranch(branchOp(ins->relop, 1), a, b, ins->target[1]);
+       } else {
+          emitBranch(branchOp(ins->relop, 0), a, b, ins->target[0]);
+          if (ins->target[1] != next)
+             emitBranch(M_B, -1, -1, ins->target[1]);
+       }
+       break;
+    case IR_JUMP:
+       if (ins->target[0] != next)
+          emitBranch(M_B, -1, -1, ins->target[0]);
+       break;
+    case IR_RET:
+       genEpilogue(NOSYMID);
+       break;
+   }
+}
+
+// Generate assembly for a whole IR function
+// - registers are allocated here, the IR itself is not changed
+void genRISCV(IRFunc* func, Output* out)
+{
+   int i, j, r, numSaved = 0;
+   IRBlock *b, *next;
+
+   curFunc = func;
+   curRA = allocateRegisters(func);
+   for (r=0; r < 32; r++)
+      if (curRA->usedSaved & (1u << r))
+         numSaved++;
+   if (func->isProgram) {
+      curRA->usedSaved = 0;  // the program exits, it restores nothing
+      numSaved = 0;
+   }
+   saveRAFP = !func->isProgram && hasCalls(func);
+   frameReg = saveRAFP ? REG_FP : REG_SP;
+   frameSize = slotOffset(curRA->numSlots + numSaved);
+   frameSize = (frameSize + STACKALIGN-1) & ~(STACKALIGN-1);
+
+   initMBuffer(&mbuf);
+   mbuf.func = func->name;
+   emitM(&mbuf, M_LABEL, -1, -1, -1, 0)->sym = func->name; // function name
+   genPrologue();
+   for (i=0; i < func->numBlocks; i++) {
+      b = func->blocks[i];
+      next = i+1 < func->numBlocks ? func->blocks[i+1] : NULL;
+      if (i > 0 && b->numPreds > 0)
+         emitM(&mbuf, M_LABEL, -1, -1, -1, 0)->label = b->label;
+      if (b->note)
+         emitM(&mbuf, M_COMMENT, -1, -1, -1, 0)->sym = b->note;
+      for (j=0; j < b->numInstrs; j++) {
+         if (isTailCall(b, j)) {
+            genEpilogue(b->instrs[j++].sym);  // the call and the return
+            continue;
+         }
+         genInstr(&b->instrs[j], next);
+      }
+   }
+   if (optLevel > 0)
+      peephole(&mbuf);
+   printMBuffer(&mbuf, out);
+   freeMBuffer(&mbuf);
+   freeRegAssignment(curRA);
+   curRA = NULL;
+}
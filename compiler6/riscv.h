@@ -0,0 +1,15 @@
+//
+// RISC-V Backend Interface
+// - selects RISC-V instructions for an IRFunc, after register
+//   allocation, and writes the assembly out
+//
+#ifndef RISCV_H
+#define RISCV_H
+
+#include <stdio.h>
+#include "ir.h"
+#include "output.h"
+
+void genRISCV(IRFunc *func, Output *out);
+
+#endif
@@ -0,0 +1,452 @@
+//
+// RISC-V Simulator for the Regression Tests
+// - runs the assembly that ptest writes, so "make test" can check
+//   what a program prints; build with "make rvsim"
+// - only the subset ptest emits is known: .data/.text, .word,
+//   .space, .string, .ascii and .align; li, la, mv, add, sub, addi,
+//   slli, lw/sw (also of a global by name), the branches, b, j, jal,
+//   tail, ret and ecall; anything else is an error
+// - ecall does the RARS services ptest uses: 1 prints an int, 4 a
+//   string, 5 reads an int from stdin, 10 and 93 exit
+// - the program starts at the "program" label; memory is MEMSIZE
+//   bytes, data at DATABASE and the stack at the top
+// - exit status is 0, or 2 for a bad input file or a runtime error
+//   (bad address, step limit), with a message on stderr
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#define MEMSIZE (1 << 22)
+#define DATABASE 0x1000
+#define MAXSTEPS 200000000L
+#define MAXLABELS 65536
+
+typedef enum
+{
+   OP_LI, OP_LA, OP_MV, OP_ADD, OP_SUB, OP_ADDI, OP_SLLI, OP_LW, OP_SW,
+   OP_LWG, OP_SWG, OP_BEQ, OP_BNE, OP_BLT, OP_BGT, OP_BGE, OP_BLE,
+   OP_B, OP_JAL, OP_TAIL, OP_RET, OP_ECALL
+} Op;
+
+typedef struct
+{
+   Op op;
+   int rd, rs1, rs2;
+   int32_t imm;
+   char* label;          // symbol operand, resolved into imm
+   int line;
+} Instr;
+
+typedef struct
+{
+   char* name;
+   int isText;
+   int32_t value;        // data address or instruction index
+} Label;
+
+static uint8_t* mem;
+static int32_t dataEnd = DATABASE;
+static Instr* instrs;
+static int numInstrs, maxInstrs;
+static Label labels[MAXLABELS];
+static int numLabels;
+static int lineNum;
+
+static const char* regNames[32] = {
+   "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "fp", "s1",
+   "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+   "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11",
+   "t3", "t4", "t5", "t6"
+};
+
+static void fail(const char* msg, const char* what)
+{
+   fprintf(stderr, "rvsim: line %d: %s%s%s\n", lineNum, msg, what ? ": " : "", what ? what : "");
+   exit(2);
+}
+
+static int regNum(const char* s)
+{
+   int i;
+   if (strcmp(s, "s0") == 0)
+      return 8;
+   if (s[0] == 'x' && isdigit((unsigned char) s[1]))
+      return atoi(s+1) & 31;
+   for (i=0; i < 32; i++)
+      if (strcmp(s, regNames[i]) == 0)
+         return i;
+   fail("unknown register", s);
+   return 0;
+}
+
+static int32_t number(const char* s)
+{
+   char* end;
+   long v = strtol(s, &end, 0);
+   if (*s == '\0' || *end != '\0')
+      fail("bad number", s);
+   return (int32_t) v;
+}
+
+static void addLabel(char* name, int isText, int32_t value)
+{
+   if (numLabels == MAXLABELS)
+      fail("too many labels", NULL);
+   labels[numLabels].name = strdup(name);
+   labels[numLabels].isText = isText;
+   labels[numLabels++].value = value;
+}
+
+static Label* findLabel(const char* name)
+{
+   int i;
+   for (i=0; i < numLabels; i++)
+      if (strcmp(labels[i].name, name) == 0)
+         return &labels[i];
+   return NULL;
+}
+
+static void dataBytes(const void* p, int n)
+{
+   if (dataEnd + n > MEMSIZE/2)
+      fail("data section too large", NULL);
+   memcpy(mem + dataEnd, p, n);
+   dataEnd += n;
+}
+
+// Put a quoted string with C escapes in the data section
+static void dataString(char* s, int terminate)
+{
+   char c;
+   if (*s++ != '"')
+      fail("string expected", NULL);
+   for (; *s && *s != '"'; s++) {
+      c = *s;
+      if (c == '\\') {
+         switch (*++s) {
+          case 'n': c = '\n'; break;
+          case 't': c = '\t'; break;
+          case '0': c = '\0'; break;
+          case '\0': fail("bad string", NULL); break;
+          default: c = *s; break;
+         }
+      }
+      dataBytes(&c, 1);
+   }
+   if (terminate)
+      dataBytes("", 1);
+}
+
+// Split the operands of an instruction at commas
+static int operands(char* s, char** args, int max)
+{
+   int n = 0;
+   char* end;
+   while (*s && n < max) {
+      while (isspace((unsigned char) *s))
+         s++;
+      args[n++] = s;
+      s = strchr(s, ',');
+      end = s ? s : args[n-1] + strlen(args[n-1]);
+      while (end > args[n-1] && isspace((unsigned char) end[-1]))
+         end--;
+      if (s)
+         s++;
+      *end = '\0';
+      if (!s)
+         break;
+   }
+   return n;
+}
+
+static Instr* newInstr(Op op)
+{
+   Instr* ins;
+   if (numInstrs == maxInstrs) {
+      maxInstrs = maxInstrs ? 2*maxInstrs : 1024;
+      instrs = (Instr*) realloc(instrs, maxInstrs * sizeof(Instr));
+   }
+   ins = &instrs[numInstrs++];
+   memset(ins, 0, sizeof(Instr));
+   ins->op = op;
+   ins->line = lineNum;
+   return ins;
+}
+
+// Parse "off(reg)" into ins
+static int memOperand(char* s, Instr* ins)
+{
+   char* paren = strchr(s, '(');
+   char* close;
+   if (!paren)
+      return 0;
+   close = strchr(paren, ')');
+   if (!close)
+      fail("bad address", s);
+   *paren = *close = '\0';
+   ins->imm = *s ? number(s) : 0;
+   ins->rs1 = regNum(paren+1);
+   return 1;
+}
+
+static void parseInstr(char* op, char* rest)
+{
+   static const char* branches[] = { "beq", "bne", "blt", "bgt", "bge", "ble" };
+   char* a[4];
+   int n = operands(rest, a, 4), i;
+   Instr* ins;
+
+   for (i=0; i < 6; i++)
+      if (strcmp(op, branches[i]) == 0 && n == 3) {
+         ins = newInstr((Op) (OP_BEQ + i));
+         ins->rs1 = regNum(a[0]);
+         ins->rs2 = regNum(a[1]);
+         ins->label = strdup(a[2]);
+         return;
+      }
+   if (strcmp(op, "li") == 0 && n == 2) {
+      ins = newInstr(OP_LI);
+      ins->rd = regNum(a[0]);
+      ins->imm = number(a[1]);
+   } else if (strcmp(op, "la") == 0 && n == 2) {
+      ins = newInstr(OP_LA);
+      ins->rd = regNum(a[0]);
+      ins->label = strdup(a[1]);
+   } else if (strcmp(op, "mv") == 0 && n == 2) {
+      ins = newInstr(OP_MV);
+      ins->rd = regNum(a[0]);
+      ins->rs1 = regNum(a[1]);
+   } else if ((strcmp(op, "add") == 0 || strcmp(op, "sub") == 0) && n == 3) {
+      ins = newInstr(op[0] == 'a' ? OP_ADD : OP_SUB);
+      ins->rd = regNum(a[0]);
+      ins->rs1 = regNum(a[1]);
+      ins->rs2 = regNum(a[2]);
+   } else if ((strcmp(op, "addi") == 0 || strcmp(op, "slli") == 0) && n == 3) {
+      ins = newInstr(op[0] == 'a' ? OP_ADDI : OP_SLLI);
+      ins->rd = regNum(a[0]);
+      ins->rs1 = regNum(a[1]);
+      ins->imm = number(a[2]);
+   } else if (strcmp(op, "lw") == 0 && n == 2) {
+      ins = newInstr(OP_LW);
+      ins->rd = regNum(a[0]);
+      if (!memOperand(a[1], ins)) {
+         ins->op = OP_LWG;
+         ins->label = strdup(a[1]);
+      }
+   } else if (strcmp(op, "sw") == 0 && (n == 2 || n == 3)) {
+      ins = newInstr(OP_SW);
+      ins->rs2 = regNum(a[0]);
+      if (n == 3) {
+         ins->op = OP_SWG;  // "sw rs, sym, rt": rt is a scratch register
+         ins->label = strdup(a[1]);
+      } else if (!memOperand(a[1], ins))
+         fail("bad store", a[1]);
+   } else if ((strcmp(op, "b") == 0 || strcmp(op, "j") == 0) && n == 1) {
+      newInstr(OP_B)->label = strdup(a[0]);
+   } else if (strcmp(op, "jal") == 0 && n == 1) {
+      newInstr(OP_JAL)->label = strdup(a[0]);
+   } else if (strcmp(op, "tail") == 0 && n == 1) {
+      newInstr(OP_TAIL)->label = strdup(a[0]);
+   } else if (strcmp(op, "ret") == 0 && n == 0) {
+      newInstr(OP_RET);
+   } else if (strcmp(op, "ecall") == 0 && n == 0) {
+      newInstr(OP_ECALL);
+   } else
+      fail("unknown instruction", op);
+}
+
+// Drop a "#" comment that is not inside a string
+static void stripComment(char* s)
+{
+   int quoted = 0;
+   for (; *s; s++) {
+      if (quoted && *s == '\\' && s[1])
+         s++;  // an escaped character, maybe a quote
+      else if (*s == '"')
+         quoted = !quoted;
+      else if (*s == '#' && !quoted) {
+         *s = '\0';
+         return;
+      }
+   }
+}
+
+static void parseLine(char* s, int* inData)
+{
+   char *colon, *op, *rest;
+   int align;
+
+   stripComment(s);
+   for (;;) {
+      while (isspace((unsigned char) *s))
+         s++;
+      colon = s;
+      while (isalnum((unsigned char) *colon) || *colon == '_' || *colon == '.' || *colon == '$')
+         colon++;
+      if (colon == s || *colon != ':')
+         break;
+      *colon = '\0';
+      addLabel(s, !*inData, *inData ? dataEnd : numInstrs);
+      s = colon + 1;
+   }
+   if (!*s)
+      return;
+   op = s;
+   while (*s && !isspace((unsigned char) *s))
+      s++;
+   if (*s)
+      *s++ = '\0';
+   while (isspace((unsigned char) *s))
+      s++;
+   rest = s;
+   s = rest + strlen(rest);
+   while (s > rest && isspace((unsigned char) s[-1]))
+      *--s = '\0';
+
+   if (op[0] != '.')
+      parseInstr(op, rest);
+   else if (strcmp(op, ".data") == 0)
+      *inData = 1;
+   else if (strcmp(op, ".text") == 0)
+      *inData = 0;
+   else if (strcmp(op, ".word") == 0) {
+      int32_t v = number(rest);
+      dataBytes(&v, 4);
+   } else if (strcmp(op, ".space") == 0) {
+      dataEnd += number(rest);
+      if (dataEnd > MEMSIZE/2)
+         fail("data section too large", NULL);
+   } else if (strcmp(op, ".string") == 0 || strcmp(op, ".asciz") == 0)
+      dataString(rest, 1);
+   else if (strcmp(op, ".ascii") == 0)
+      dataString(rest, 0);
+   else if (strcmp(op, ".align") == 0) {
+      align = 1 << number(rest);
+      if (*inData)
+         dataEnd = (dataEnd + align-1) & ~(align-1);
+   } else if (strcmp(op, ".globl") != 0)
+      fail("unknown directive", op);
+}
+
+static uint32_t* word(int32_t addr, Instr* ins)
+{
+   if (addr < 0 || addr > MEMSIZE-4 || (addr & 3)) {
+      lineNum = ins->line;
+      fail("bad memory address", NULL);
+   }
+   return (uint32_t*) (mem + addr);
+}
+
+// Run the program; returns its exit status
+static int run()
+{
+   int32_t r[32];
+   Label* start = findLabel("program");
+   Instr* ins;
+   long steps = 0;
+   int pc, c;
+   int32_t a, b;
+   char* s;
+
+   if (!start || !start->isText)
+      fail("no program label", NULL);
+   memset(r, 0, sizeof(r));
+   r[2] = MEMSIZE - 16;  // sp
+   r[1] = -1;            // ra: returning from program ends the run
+   pc = start->value;
+   while (pc >= 0 && pc < numInstrs) {
+      if (++steps > MAXSTEPS) {
+         fprintf(stderr, "rvsim: step limit reached\n");
+         return 2;
+      }
+      ins = &instrs[pc++];
+      a = r[ins->rs1];
+      b = r[ins->rs2];
+      switch (ins->op) {
+       case OP_LI:   r[ins->rd] = ins->imm; break;
+       case OP_LA:   r[ins->rd] = ins->imm; break;
+       case OP_MV:   r[ins->rd] = a; break;
+       case OP_ADD:  r[ins->rd] = (int32_t) ((uint32_t) a + (uint32_t) b); break;
+       case OP_SUB:  r[ins->rd] = (int32_t) ((uint32_t) a - (uint32_t) b); break;
+       case OP_ADDI: r[ins->rd] = (int32_t) ((uint32_t) a + (uint32_t) ins->imm); break;
+       case OP_SLLI: r[ins->rd] = (int32_t) ((uint32_t) a << (ins->imm & 31)); break;
+       case OP_LW:   r[ins->rd] = (int32_t) *word(a + ins->imm, ins); break;
+       case OP_LWG:  r[ins->rd] = (int32_t) *word(ins->imm, ins); break;
+       case OP_SW:   *word(a + ins->imm, ins) = (uint32_t) b; break;
+       case OP_SWG:  *word(ins->imm, ins) = (uint32_t) b; break;
+       case OP_BEQ:  if (a == b) pc = ins->imm; break;
+       case OP_BNE:  if (a != b) pc = ins->imm; break;
+       case OP_BLT:  if (a < b) pc = ins->imm; break;
+       case OP_BGT:  if (a > b) pc = ins->imm; break;
+       case OP_BGE:  if (a >= b) pc = ins->imm; break;
+       case OP_BLE:  if (a <= b) pc = ins->imm; break;
+       case OP_B:    pc = ins->imm; break;
+       case OP_JAL:  r[1] = pc; pc = ins->imm; break;
+       case OP_TAIL: pc = ins->imm; break;
+       case OP_RET:  pc = r[1]; break;
+       case OP_ECALL:
+          switch (r[17]) {  // a7
+           case 1:
+              printf("%d", r[10]);
+              break;
+           case 4:
+              for (s = (char*) mem + r[10]; r[10] >= 0 && s < (char*) mem + MEMSIZE && *s; s++)
+                 putchar(*s);
+              break;
+           case 5:
+              if (scanf("%d", &c) != 1)
+                 c = 0;
+              r[10] = c;
+              break;
+           case 10:
+           case 93:
+              return 0;
+           default:
+              lineNum = ins->line;
+              fail("unknown ecall", NULL);
+          }
+          break;
+      }
+      r[0] = 0;
+   }
+   return 0;
+}
+
+int main(int argc, char** argv)
+{
+   char line[65536];
+   FILE* in;
+   Label* l;
+   int i, inData = 0, stat;
+
+   if (argc != 2) {
+      fprintf(stderr, "usage: rvsim file.s\n");
+      return 2;
+   }
+   in = fopen(argv[1], "r");
+   if (!in) {
+      fprintf(stderr, "rvsim: cannot open %s\n", argv[1]);
+      return 2;
+   }
+   mem = (uint8_t*) calloc(MEMSIZE, 1);
+   while (fgets(line, sizeof(line), in)) {
+      lineNum++;
+      parseLine(line, &inData);
+   }
+   fclose(in);
+   for (i=0; i < numInstrs; i++) {
+      if (!instrs[i].label)
+         continue;
+      lineNum = instrs[i].line;
+      l = findLabel(instrs[i].label);
+      if (!l)
+         fail("undefined label", instrs[i].label);
+      instrs[i].imm = l->value;
+   }
+   stat = run();
+   fflush(stdout);
+   return stat;
+}
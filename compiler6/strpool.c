@@ -0,0 +1,264 @@
+//
+// String Constant Pool
+// - see strpool.h for the interface
+// - literals are interned, so a hash table of string pointers
+//   (open addressing, linear probing) finds the entry of a string
+//   that was seen before; the entry array and the table both grow
+//   as needed, so there is no limit on the number of literals
+// - suffix sharing: a string that ends another one is not stored
+//   by itself; the longer string is split with .ascii at the point
+//   where the shorter one starts, and the shorter one's label goes
+//   there ("done\n" and "\n" take 7 bytes instead of 9); strings
+//   are only split between escape sequences, never inside one
+// - the strings a string ends are found by looking its suffixes up
+//   in a hash table of the live strings, not by comparing pairs
+//
+#include <stdlib.h>
+#include <string.h>
+#include "strpool.h"
+#include "compiler.h"
+#include "deadcode.h"
+
+#define INITIALPOOLSLOTS 64  // must be a power of two
+
+static THREADLOCAL char** strings = NULL;  // by label number
+static THREADLOCAL int numStrings = 0, maxStrings = 0;
+static THREADLOCAL int* slots = NULL;       // entry numbers, -1 if empty
+static THREADLOCAL unsigned int numSlots = 0;
+static THREADLOCAL int numLiterals = 0;     // literals added, with repeats
+static THREADLOCAL int numShared = 0;       // strings emitted inside another
+
+static unsigned int ptrHash(char* p)
+{
+   unsigned long h = (unsigned long) p;
+   return (unsigned int) (h ^ (h >> 7) ^ (h >> 17));
+}
+
+// Double the hash table and reinsert every entry
+static void growSlots()
+{
+   unsigned int i, j;
+   numSlots = numSlots ? numSlots*2 : INITIALPOOLSLOTS;
+   free(slots);
+   slots = (int*) malloc(numSlots*sizeof(int));
+   for (i=0; i < numSlots; i++)
+      slots[i] = -1;
+   for (i=0; i < (unsigned int) numStrings; i++) {
+      for (j = ptrHash(strings[i]) & (numSlots-1); slots[j] >= 0; j = (j+1) & (numSlots-1))
+         ;
+      slots[j] = i;
+   }
+}
+
+// Add a string literal (as written, with its quotes) to the pool
+// - returns the label number of the string, the same number for
+//   every literal with the same contents
+int addString(char* str)
+{
+   unsigned int i;
+   numLiterals++;
+   if (4*(numStrings+1) > 3*(int) numSlots)  // grow at 3/4 full
+      growSlots();
+   for (i = ptrHash(str) & (numSlots-1); slots[i] >= 0; i = (i+1) & (numSlots-1))
+      if (strings[slots[i]] == str)  // interned
+         return slots[i];
+   if (numStrings == maxStrings) {
+      maxStrings = maxStrings ? maxStrings*2 : 64;
+      strings = (char**) realloc(strings, maxStrings*sizeof(char*));
+   }
+   strings[numStrings] = str;
+   slots[i] = numStrings;
+   return numStrings++;
+}
+
+int numPoolStrings()
+{
+   return numStrings;
+}
+
+// Emit ".SC<num>:   " and then the directive dir
+static void emitLabel(Output* out, int num, const char* dir)
+{
+   emitStr(out, ".SC");
+   emitInt(out, num);
+   emitStr(out, ":   ");
+   emitStr(out, dir);
+}
+
+// Live strings by contents, for the suffix lookups
+typedef struct
+{
+   int *len;              // body length of each string, without quotes
+   int *table;            // string numbers by body hash, -1 if empty
+   unsigned int mask;
+   unsigned long *hash;   // suffix hashes of the string being scanned
+   int maxLen;
+} SuffixIndex;
+
+static const char* body(int i)
+{
+   return strings[i] + 1;  // past the opening quote
+}
+
+// Hash the suffixes of a string body, hash[p] being the hash of
+// the suffix at p, so each is one step from the next
+static void hashSuffixes(SuffixIndex* si, const char* a, int la)
+{
+   int p;
+   si->hash[la] = 0;
+   for (p = la-1; p >= 0; p--)
+      si->hash[p] = si->hash[p+1] * 1000003UL + (unsigned char) a[p];
+}
+
+// Table slot to start probing at for hash h
+// - the suffix hash keeps little entropy in its low bits when
+//   strings differ only near the front, so it is mixed first
+static unsigned int bodySlot(SuffixIndex* si, unsigned long h)
+{
+   h ^= h >> 31;
+   h *= 0x9e3779b97f4a7c15UL;
+   return (unsigned int) (h >> 32) & si->mask;
+}
+
+// The live string whose body is the la bytes at a, with hash h, or -1
+static int findBody(SuffixIndex* si, const char* a, int la, unsigned long h)
+{
+   unsigned int i;
+   int s;
+   for (i = bodySlot(si, h); (s = si->table[i]) >= 0; i = (i+1) & si->mask)
+      if (si->len[s] == la && memcmp(body(s), a, la) == 0)
+         return s;
+   return -1;
+}
+
+// Put the live strings that end string i in found[], longest first,
+// and return how many there are
+// - only suffixes that start between escape sequences count
+static int findSuffixes(SuffixIndex* si, int i, int* found)
+{
+   const char* a = body(i);
+   int p, s, la = si->len[i], n = 0;
+   hashSuffixes(si, a, la);
+   for (p=0; p <= la; p++) {
+      if (p > 0 && (s = findBody(si, a + p, la - p, si->hash[p])) >= 0)
+         found[n++] = s;
+      if (p < la && a[p] == '\\')
+         p++;  // skip the escaped char
+   }
+   return n;
+}
+
+// Emit the .data entries of the live strings, in label order
+// - with shareSuffixes, strings that end another live string are
+//   emitted inside it (see the top of this file)
+// - the live strings are hashed by contents, and every suffix of a
+//   string that starts between escape sequences is looked up, so
+//   the work is linear in the total length rather than quadratic in
+//   the number of strings
+void emitStringPool(Output* out, int shareSuffixes)
+{
+   int i, j, k, n, la, pos, *order;
+   char* done = (char*) calloc(numStrings+1, 1);
+   char* inside = (char*) calloc(numStrings+1, 1);  // ends another live string
+   const char* a;
+   SuffixIndex si;
+
+   si.len = (int*) malloc((numStrings+1)*sizeof(int));
+   si.maxLen = 0;
+   for (i=0; i < numStrings; i++) {
+      si.len[i] = (int) strlen(strings[i]) - 2;  // without the quotes
+      if (si.len[i] > si.maxLen)
+         si.maxLen = si.len[i];
+      if (!isLiveString(i))
+         done[i] = 1;
+   }
+   order = (int*) malloc((si.maxLen+1)*sizeof(int));
+   si.hash = (unsigned long*) malloc((si.maxLen+1)*sizeof(unsigned long));
+   for (si.mask = 15; si.mask < 2*(unsigned int) numStrings; si.mask = 2*si.mask + 1)
+      ;
+   si.table = (int*) malloc((si.mask+1)*sizeof(int));
+   for (i=0; i <= (int) si.mask; i++)
+      si.table[i] = -1;
+   if (shareSuffixes) {
+      for (i=0; i < numStrings; i++) {
+         if (done[i])
+            continue;
+         hashSuffixes(&si, body(i), si.len[i]);
+         for (j = bodySlot(&si, si.hash[0]); si.table[j] >= 0; j = (j+1) & si.mask)
+            ;
+         si.table[j] = i;
+      }
+      for (i=0; i < numStrings; i++) {
+         if (done[i])
+            continue;
+         n = findSuffixes(&si, i, order);
+         for (k=0; k < n; k++)
+            inside[order[k]] = 1;
+      }
+   }
+
+   for (i=0; i < numStrings; i++) {
+      if (done[i])
+         continue;
+      a = body(i);
+      la = si.len[i];
+      n = 0;
+      if (shareSuffixes) {
+         // leave this string to a longer live one it ends, if any
+         if (inside[i])
+            continue;
+         // its live suffixes not emitted yet, longest first
+         n = findSuffixes(&si, i, order);
+         for (j=0, k=0; j < n; j++)
+            if (!done[order[j]])
+               order[k++] = order[j];
+         n = k;
+      }
+      done[i] = 1;
+      if (n == 0) {
+         emitLabel(out, i, ".string ");
+         emitStr(out, strings[i]);
+         emitChar(out, '\n');
+         continue;
+      }
+      emitLabel(out, i, ".ascii \"");
+      emitChars(out, a, la - si.len[order[0]]);
+      emitStr(out, "\"\n");
+      for (k=0; k < n; k++) {
+         pos = la - si.len[order[k]];
+         done[order[k]] = 1;
+         numShared++;
+         if (k+1 < n) {
+            emitLabel(out, order[k], ".ascii \"");
+            emitChars(out, a + pos, si.len[order[k]] - si.len[order[k+1]]);
+            emitStr(out, "\"\n");
+         } else {
+            emitLabel(out, order[k], ".string \"");
+            emitStr(out, a + pos);  // the closing quote is still there
+            emitChar(out, '\n');
+         }
+      }
+   }
+   free(done);
+   free(inside);
+   free(order);
+   free(si.len);
+   free(si.table);
+   free(si.hash);
+}
+
+void freeStringPool()
+{
+   free(strings);
+   free(slots);
+   strings = NULL;
+   slots = NULL;
+   numStrings = maxStrings = 0;
+   numSlots = 0;
+}
+
+void printStringPoolStats(FILE *out)
+{
+   fprintf(out, "strings: %d literals, %d distinct, %d shared as suffixes\n",
+           numLiterals, numStrings, numShared);
+}
@@ -0,0 +1,21 @@
+//
+// String Constant Pool Interface
+// - holds the string literals of the program, one entry (and one
+//   .SC<n> label) per distinct string; entries are numbered in the
+//   order the strings are first referenced
+// - literals are kept as written in the source, quotes and escape
+//   sequences included, and must be interned (see intern.h)
+//
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stdio.h>
+#include "output.h"
+
+int addString(char *str);
+int numPoolStrings();
+void emitStringPool(Output *out, int shareSuffixes);
+void freeStringPool();
+void printStringPoolStats(FILE *out);
+
+#endif
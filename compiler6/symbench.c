@@ -0,0 +1,88 @@
+//
+// Symbol table microbenchmark
+// - times addSymbol(), findSymbol() and delScopeLevel() at a few
+//   table sizes; build with "make symbench"
+// - half of the symbols are globals (scope 0); the other half are
+//   added as locals (scope 1) in "functions" of FUNCSIZE symbols
+//   each, and every function's scope is popped with delScopeLevel()
+//   just like the parser does at the end of a function
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "symtable.h"
+#include "intern.h"
+
+#define FUNCSIZE 16
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char* what, int n, double secs)
+{
+   printf("   %-14s %9d ops %8.3f ms %8.2f Mops/s\n", what, n,
+          secs*1e3, n / secs / 1e6);
+}
+
+static void bench(int n)
+{
+   int i, j, found = 0, globals = n/2;
+   char buf[32];
+   char** names = (char**) malloc(n * sizeof(char*));
+   SymbolTable* table = newSymbolTable();
+   double t, tadd = 0, tfind = 0, tdel = 0;
+
+   // intern outside of the timed sections
+   for (i=0; i < n; i++) {
+      snprintf(buf, sizeof(buf), "v%d", i);
+      names[i] = internString(buf);
+   }
+   printf("%d symbols:\n", n);
+
+   t = now();
+   for (i=0; i < globals; i++)
+      addSymbol(table, names[i], 0, T_INT, 0, 0, V_GLOBAL);
+   tadd += now() - t;
+   t = now();
+   for (i=0; i < globals; i++)
+      found += findSymbol(table, names[i]) != NULL;
+   tfind += now() - t;
+
+   for (i=globals; i < n; i += FUNCSIZE) {
+      int end = i + FUNCSIZE < n ? i + FUNCSIZE : n;
+      t = now();
+      for (j=i; j < end; j++)
+         addSymbol(table, names[j], 1, T_INT, 0, j-i, V_LOCAL);
+      tadd += now() - t;
+      t = now();
+      for (j=i; j < end; j++)
+         found += findSymbol(table, names[j]) != NULL;
+      tfind += now() - t;
+      t = now();
+      delScopeLevel(table, 1);
+      tdel += now() - t;
+   }
+
+   report("addSymbol", n, tadd);
+   report("findSymbol", n, tfind);
+   report("delScopeLevel", (n - globals + FUNCSIZE-1) / FUNCSIZE, tdel);
+   if (found != n)
+      printf("   ERROR: found %d of %d symbols\n", found, n);
+
+   freeAllSymbols(table);
+   free(table);
+   free(names);
+}
+
+int main(void)
+{
+   bench(1000);
+   bench(100000);
+   bench(1000000);
+   freeInternTable();
+   return 0;
+}
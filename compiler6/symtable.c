@@ -1,108 +1,297 @@
 //
 // Symbol Table Module
-// - the symbol table is implemented as a hash table that uses
-//   chaining (linked lists) to resolve collisions. Thus, each
-//   table entry is a pointer to a linked list of symbols that 
-//   hashed to that entry (index value).
+// - the symbol table is an open addressing hash table (linear
+//   probing) keyed by symbol name; each slot points to the 
+//   innermost symbol with that name, and that symbol's "next"
+//   pointer is the outer symbol it shadows (if any)
+// - the table doubles in size when it gets 3/4 full
+// - each scope level also keeps its own list of symbols (the
+//   scope stack), so removing a scope only touches the symbols
+//   that were declared in it
+// - symbol names are interned strings (see intern.h), so names
+//   are hashed and compared by pointer and are never copied or
+//   freed here
+// - every symbol added also gets the next id and an info[] entry;
+//   functions get theirs from functionId(), on first use, through
+//   a second table of ids keyed the same way
 //
 #include <stdlib.h>
 #include <string.h>
 #include "symtable.h"
+#include "intern.h"
 
-// odd and especially prime values are best for hash tables
-#define TABLESIZE 97
+// initial number of slots (must be a power of two)
+#define INITIALSIZE 128
 
-// Table hash function
-// - just adds up all chars in the string and then 
-//   mods by table size to get 0 to (size-1) index value
-static int hash(char *str)
+// initial number of scope levels
+#define INITIALSCOPES 4
+
+// initial number of ids (info[] entries)
+#define INITIALIDS 64
+
+// Hash an interned name by its address
+static unsigned int nameHash(char* name)
 {
-   int h = 0;
-   int i;
-   for (i=0; i < strlen(str); i++)
-      h += str[i];
-   h = h % TABLESIZE;
-   return h;
+   unsigned long long v = (unsigned long long) (size_t) name;
+   return (unsigned int) ((v * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Find the slot index for a name
+// - returns the slot holding the name, or the empty slot where
+//   it would be inserted
+static unsigned int findSlot(SymbolTable* table, char* name, unsigned int hash)
+{
+   unsigned int mask = table->numSlots - 1;
+   unsigned int i = hash & mask;
+   while (table->slots[i] && table->slots[i]->name != name)
+      i = (i+1) & mask;
+   return i;
+}
+
+// Double the size of the table and reinsert all names
+static int growSymbolTable(SymbolTable* table)
+{
+   unsigned int i, j, mask, oldNum = table->numSlots;
+   Symbol** oldSlots = table->slots;
+   Symbol** newSlots = (Symbol**) calloc(oldNum*2, sizeof(Symbol*));
+   if (!newSlots)
+      return -1;
+   mask = oldNum*2 - 1;
+   for (i=0; i < oldNum; i++) {
+      if (!oldSlots[i])
+         continue;
+      j = oldSlots[i]->hash & mask;
+      while (newSlots[j])
+         j = (j+1) & mask;
+      newSlots[j] = oldSlots[i];
+   }
+   table->slots = newSlots;
+   table->numSlots = oldNum*2;
+   free(oldSlots);
+   return 0;
+}
+
+// Empty slot i, shifting later entries of its probe run backwards
+// so that lookups never stop early (no tombstones are needed)
+static void clearSlot(SymbolTable* table, unsigned int i)
+{
+   unsigned int mask = table->numSlots - 1;
+   unsigned int j = i, home;
+   table->slots[i] = 0;
+   for (;;) {
+      j = (j+1) & mask;
+      if (!table->slots[j])
+         break;
+      home = table->slots[j]->hash & mask;
+      // move entry j into the hole at i if its home slot is not
+      // cyclically within (i, j]
+      if ((j > i && (home <= i || home > j)) ||
+          (j < i && (home <= i && home > j))) {
+         table->slots[i] = table->slots[j];
+         table->slots[j] = 0;
+         i = j;
+      }
+   }
+   table->numNames--;
 }
 
 // Create a new symbol table and return pointer to it
-// - each table entry will be a pointer to a linked list
-//   of symbols that hashed to that entry; a NULL entry
-//   means no symbols have yet hashed to that entry
-Symbol** newSymbolTable()
+// - every slot starts out NULL (no symbol with that name)
+SymbolTable* newSymbolTable()
 {
-   int i;
-   Symbol** table; 
-   table = (Symbol**) malloc(sizeof(Symbol*)*TABLESIZE);
-   for (i=0; i < TABLESIZE; i++)
-      table[i] = 0;
+   SymbolTable* table = (SymbolTable*) malloc(sizeof(SymbolTable));
+   if (!table)
+      return NULL;
+   table->slots = (Symbol**) calloc(INITIALSIZE, sizeof(Symbol*));
+   table->scopes = (Symbol**) calloc(INITIALSCOPES, sizeof(Symbol*));
+   table->info = (SymInfo*) calloc(INITIALIDS, sizeof(SymInfo));
+   if (!table->slots || !table->scopes || !table->info) {
+      free(table->slots);
+      free(table->scopes);
+      free(table->info);
+      free(table);
+      return NULL;
+   }
+   table->numSlots = INITIALSIZE;
+   table->numNames = 0;
+   table->numScopes = INITIALSCOPES;
+   table->numIds = 1;  // NOSYMID
+   table->maxIds = INITIALIDS;
+   table->funcSlots = NULL;
+   table->numFuncSlots = table->numFuncs = 0;
+   table->numLookups = 0;
    return table;
 }
 
+// Hand out the next id, with its info[] entry
+// - for symbols that are not looked up by name, such as the
+//   locals made by the inliner; addSymbol() and functionId() use it
+//   for theirs
+// - returns the id, or NOSYMID on failure
+SymId addSymbolId(SymbolTable* table, char* name, DataType type,
+                  unsigned int size, int offset, VariableKind varKind)
+{
+   SymInfo* info;
+   if (table->numIds == table->maxIds) {
+      info = (SymInfo*) realloc(table->info, 2*table->maxIds*sizeof(SymInfo));
+      if (!info)
+         return NOSYMID;
+      table->info = info;
+      table->maxIds *= 2;
+   }
+   info = &table->info[table->numIds];
+   info->name = name;
+   info->type = type;
+   info->varKind = varKind;
+   info->size = size;
+   info->offset = offset;
+   return table->numIds++;
+}
+
 // Add a new symbol to the given symbol table
-// - name is the symbol name string (must strdup() it in here to store)
+// - name is the symbol name string; it must be an interned string
+//   (see intern.h), so it is stored as is and not copied
 // - scopeLevel is the scoping level of the symbol (0 is global)
 // - type is its data type 
-// - this function must hash the symbol name to find the correct
-//   table entry to put it on; each table entry is a pointer to a linked
-//   list of symbols that hash to that index; symbols must be added to
-//   the head of the list
-// - this function must allocate a new Symbol structure, it must 
-//   strdup() the name to save its own copy, and must set all structure
-//   fields appropiately
-// - return 0 on success, any other on failure (generally, negative)
-int addSymbol(Symbol** table, char* name, int scopeLevel, DataType type,
+// - if the name already exists, the new symbol shadows the old
+//   one until its scope level is deleted
+// - the symbol is also pushed on the list for its scope level
+// - return the new symbol's id (positive) on success, negative on
+//   failure
+int addSymbol(SymbolTable* table, char* name, int scopeLevel, DataType type,
               unsigned int size, int offset, VariableKind varKind)
 {
-   int index = hash(name);
-   
-   // Allocate memory for the new symbol
-   Symbol* newSymbol = (Symbol*) malloc(sizeof(Symbol));
+   unsigned int hash = nameHash(name);
+   unsigned int index;
+   Symbol* newSymbol;
+   SymId id;
+
+   if (scopeLevel < 0)
+      return -1;
+   // make room in the scope stack
+   if (scopeLevel >= table->numScopes) {
+      int n = table->numScopes;
+      while (n <= scopeLevel)
+         n *= 2;
+      Symbol** scopes = (Symbol**) realloc(table->scopes, n*sizeof(Symbol*));
+      if (!scopes)
+         return -1;
+      memset(scopes + table->numScopes, 0, (n - table->numScopes)*sizeof(Symbol*));
+      table->scopes = scopes;
+      table->numScopes = n;
+   }
+   // keep the table at most 3/4 full
+   if ((table->numNames+1)*4 > table->numSlots*3 && growSymbolTable(table) < 0)
+      return -1;
+
+   // Allocate memory for the new symbol, and its id
+   newSymbol = (Symbol*) malloc(sizeof(Symbol));
    if (!newSymbol) {
       return -1; // Memory allocation failure
    }
-   
-   // Duplicate the name to store its own copy
-   newSymbol->name = strdup(name);
-   if (!newSymbol->name) {
+   id = addSymbolId(table, name, type, size, offset, varKind);
+   if (id == NOSYMID) {
       free(newSymbol);
-      return -1; // Memory allocation failure
+      return -1;
    }
    
-   // Initialize the fields
+   // Initialize the fields (name is interned, table does not own it)
+   newSymbol->name = name;
+   newSymbol->hash = hash;
    newSymbol->scopeLevel = scopeLevel;
    newSymbol->type = type;
    newSymbol->size = size;
    newSymbol->offset = offset;
-   newSymbol->next = table[index]; // Link to the current list head
    newSymbol->varKind = varKind;
+   newSymbol->id = id;
    
-   // Insert the new symbol at the head of the list
-   table[index] = newSymbol;
+   // Insert the new symbol, shadowing any symbol with the same name
+   index = findSlot(table, name, hash);
+   newSymbol->next = table->slots[index];
+   if (!table->slots[index])
+      table->numNames++;
+   table->slots[index] = newSymbol;
+
+   // and push it on its scope level list
+   newSymbol->scopeNext = table->scopes[scopeLevel];
+   table->scopes[scopeLevel] = newSymbol;
    
-   return 0; // Success
+   return id; // Success
 }
 
 // Lookup a symbol name to see if it is in the symbol table
-// - returns a pointer to the symbol record, or NULL if not found
-// - it should return the first symbol record that exists with the
-//   given name; there is no need to look further once you find one
-// - pseudocode: hash the name to get table index, then look through
-//               linked list to see if the name exists as a symbol
-Symbol* findSymbol(Symbol** table, char* name)
+// - returns a pointer to the innermost symbol record with that
+//   name, or NULL if not found
+// - name must be interned, so names are compared by pointer
+Symbol* findSymbol(SymbolTable* table, char* name)
+{
+   table->numLookups++;
+   return table->slots[findSlot(table, name, nameHash(name))];
+}
+
+// Get the id of the function with the given name
+// - the first use of a name, a call or the definition, adds it, so
+//   a call before the definition gets the same id
+// - returns NOSYMID only if memory runs out
+SymId functionId(SymbolTable* table, char* name)
 {
-   int index = hash(name);
-   Symbol* current = table[index];
+   unsigned int i, j, mask, n;
+   SymId* slots;
 
-   // Traverse the linked list
-   while (current) {
-      if (strcmp(current->name, name) == 0) {
-         return current; // Found the symbol
+   table->numLookups++;
+   if ((table->numFuncs+1)*4 > table->numFuncSlots*3) {
+      n = table->numFuncSlots ? table->numFuncSlots*2 : INITIALSIZE;
+      slots = (SymId*) calloc(n, sizeof(SymId));
+      if (!slots)
+         return NOSYMID;
+      for (i=0; i < table->numFuncSlots; i++) {
+         if (table->funcSlots[i] == NOSYMID)
+            continue;
+         j = nameHash(table->info[table->funcSlots[i]].name) & (n-1);
+         while (slots[j] != NOSYMID)
+            j = (j+1) & (n-1);
+         slots[j] = table->funcSlots[i];
       }
-      current = current->next; // Move to the next symbol
+      free(table->funcSlots);
+      table->funcSlots = slots;
+      table->numFuncSlots = n;
    }
+   mask = table->numFuncSlots - 1;
+   for (i = nameHash(name) & mask; table->funcSlots[i] != NOSYMID; i = (i+1) & mask)
+      if (table->info[table->funcSlots[i]].name == name)
+         return table->funcSlots[i];
+   table->funcSlots[i] = addSymbolId(table, name, T_INT, 0, 0, V_FUNCTION);
+   if (table->funcSlots[i] != NOSYMID)
+      table->numFuncs++;
+   return table->funcSlots[i];
+}
 
-   return NULL; // Symbol not found
+// Drop the ids handed out since mark, except the functions'
+// - for streaming: once a function is generated, the ids of its
+//   params and locals are not used again, so info[] need not grow
+//   with the number of functions; function ids among them (calls to
+//   functions not seen before, the definition itself) are moved
+//   down to the first free ids, and the function map follows them
+// - nothing may still hold the dropped ids or the old ids of the
+//   moved functions
+void releaseSymbolIds(SymbolTable* table, SymId mark)
+{
+   unsigned int i, mask = table->numFuncSlots - 1;
+   SymId id, to = mark;
+
+   for (id = mark; id < table->numIds; id++) {
+      if (table->info[id].varKind != V_FUNCTION)
+         continue;
+      if (id != to) {
+         for (i = nameHash(table->info[id].name) & mask; table->funcSlots[i] != id;
+              i = (i+1) & mask)
+            ;
+         table->funcSlots[i] = to;
+         table->info[to] = table->info[id];
+      }
+      to++;
+   }
+   table->numIds = to;
 }
 
 // Iterator over entire symbol table
@@ -110,109 +299,94 @@ Symbol* findSymbol(Symbol** table, char* name)
 // - caller must initialize iter.index to be -1 before first call
 // - caller then calls this function until it returns NULL, meaning end 
 //   of all symbols; each return value is a pointer to a symbol in the table
+// - shadowed symbols are returned right after the symbol shadowing them
 // - parameter scopeLevel is not currently used (just pass a 0 in)
-Symbol* iterSymbolTable(Symbol** table, int scopeLevel, SymbolTableIter* iter)
+Symbol* iterSymbolTable(SymbolTable* table, int scopeLevel, SymbolTableIter* iter)
 {
    Symbol* cur;
    if (iter->index == -1) {
       // start at index 0
       iter->index = 0;
-      cur = table[iter->index];
+      cur = table->slots[iter->index];
    } else {
       // start where we left off
       cur = iter->lastsym->next;
    }
    // if we have another symbol already, use it (loop will be skipped)
    // otherwise, search for next index that has symbols (is not empty)
-   while (!cur && iter->index < TABLESIZE-1) {
+   while (!cur && iter->index < (int) table->numSlots-1) {
       iter->index++;
-      cur = table[iter->index];
+      cur = table->slots[iter->index];
    }
    // update iterator position and return current symbol
    iter->lastsym = cur;
    return cur;
 }
 
-// Walk the table and the lists and free all symbol names
-// and symbol structs
-// - does not free the table (array) itself
+// Free all symbol structs and the table's internal arrays
+// - does not free the table (struct) itself
 //  - caller should probably free the table after this!
-// - zeroing pointers in next and table elements makes memory
-//   a bit safe, cannot accidentally follow and old pointer
-void freeAllSymbols(Symbol** table)
+// - symbol names are interned and are not freed here
+void freeAllSymbols(SymbolTable* table)
 {
    int i;
    Symbol *cur, *stmp;
-   for (i=0; i < TABLESIZE; i++) {
-      cur = table[i];
+   for (i=0; i < table->numScopes; i++) {
+      cur = table->scopes[i];
       while (cur) {
          stmp = cur;
-         cur = cur->next;
-         stmp->next = 0; // safety
-         free(stmp->name);
+         cur = cur->scopeNext;
          free(stmp);
       }
-      table[i] = 0; // safety
    }
+   free(table->slots);
+   free(table->scopes);
+   free(table->info);
+   free(table->funcSlots);
+   table->slots = 0; // safety
+   table->scopes = 0;
+   table->info = 0;
+   table->funcSlots = 0;
+   table->numSlots = 0;
+   table->numNames = 0;
+   table->numScopes = 0;
+   table->numIds = table->maxIds = 0;
+   table->numFuncSlots = table->numFuncs = 0;
 }
 
 // Deletes all symbols that are at a given scope level and above
-// - both the symbol string and the structure
-// - relinks the linked list so that nothing is lost
-int delScopeLevel(Symbol** table, int scopeLevel)
+// - pops each scope list; only the symbols declared at those
+//   levels are touched, the rest of the table is not scanned
+// - a popped symbol's slot gets back the symbol it shadowed
+int delScopeLevel(SymbolTable* table, int scopeLevel)
 {
-   int i;
-   Symbol *prev=0, *cur=0, *t;
-   for (i=0; i < TABLESIZE; i++) {
-      prev = 0;
-      cur = table[i];
+   int level;
+   unsigned int index;
+   Symbol *cur, *t;
+   if (scopeLevel < 0)
+      scopeLevel = 0;
+   for (level = table->numScopes-1; level >= scopeLevel; level--) {
+      cur = table->scopes[level];
       while (cur) {
-         if (cur->scopeLevel >= scopeLevel) {
-            t = cur;
-            if (prev)
-               prev->next = cur->next;
-            else
-               table[i] = cur->next;
-            cur = cur->next;
-            free(t->name);
-            t->name = 0; // safety
-            t->next = 0; // safety
-            free(t);
-         } else {
-            prev = cur;
-            cur = cur->next;
-         }
+         t = cur;
+         cur = cur->scopeNext;
+         index = findSlot(table, t->name, t->hash);
+         if (table->slots[index] != t) {
+            // shadowed by a symbol at the same or a higher level;
+            // just unlink it
+            Symbol* s = table->slots[index];
+            while (s->next != t)
+               s = s->next;
+            s->next = t->next;
+         } else if (t->next)
+            table->slots[index] = t->next;
+         else
+            clearSlot(table, index);
+         t->next = 0; // safety
+         t->scopeNext = 0;
+         free(t);
       }
+      table->scopes[level] = 0;
    }
    return 0;
 }
-
-/*** NOT USED SO REMOVED WITHOUT DELETING CODE
-// Delete a specific symbol at a specific scope level
-// from the symbol table
-int delSymbol(Symbol** table, char* name, int scopeLevel)
-{
-   int i;
-   Symbol *prev=0, *cur=0;
-   i = hash(name);
-   cur = table[i];
-   while (cur) {
-      if (!strcmp(cur->name, name) &&
-          cur->scopeLevel == scopeLevel)
-         break;
-      prev = cur;
-      cur = cur->next;
-   }
-   if (!cur)
-      return 1;
-   if (prev)
-      prev->next = cur->next;
-   else
-      table[i] = cur->next;
-   free(cur->name);
-   cur->name = 0;
-   cur->next = 0;
-   free(cur);
-   return 0;
-}
-***/
\ No newline at end of file
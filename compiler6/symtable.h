@@ -1,5 +1,13 @@
 //
 // Symbol Table Module Interface
+// - besides the scoped name lookup the parser needs, the table
+//   hands every symbol it ever holds a dense id (SymId), with its
+//   kind, type, size and offset kept in a side table (info[]) that
+//   outlives the symbol's scope; the AST and the IR carry ids, so
+//   the phases after the parser index info[] instead of looking
+//   names up
+// - functions are not scoped and have a map of their own, so a call
+//   can get its function's id before the function is defined
 //
 #ifndef SYMTABLE_H
 #define SYMTABLE_H
@@ -16,9 +24,23 @@ typedef enum
    V_GLOBAL,
    V_PARAM,
    V_LOCAL,
-   V_GLARRAY
+   V_GLARRAY,
+   V_FUNCTION
 } VariableKind;
 
+typedef int SymId;
+
+#define NOSYMID 0  // id 0 is never handed out
+
+typedef struct
+{
+   char *name;           // interned; only for printing and labels
+   DataType type;
+   VariableKind varKind;
+   unsigned int size;    // 0 if simple var, N if array
+   int offset;           // var number of a param or local
+} SymInfo;
+
 typedef struct symbol_s
 {
    int scopeLevel; // 0 for globals, 1 for params and locals
@@ -26,26 +48,43 @@ typedef struct symbol_s
    VariableKind varKind; // not used yet...
    unsigned int size;    // 0 if simple var, N if array (N is num elems)
    int offset;           // stack offset for local vars and params
-   char *name;
-   struct symbol_s *next;
+   SymId id;             // its entry in the table's info[]
+   char *name;           // interned string (see intern.h)
+   unsigned int hash;    // hash of name (pointer), kept for rehashing
+   struct symbol_s *next;      // symbol with the same name that this shadows
+   struct symbol_s *scopeNext; // previous symbol added at the same scope level
 } Symbol;
 
+typedef struct
+{
+   Symbol **slots;         // open addressing table, innermost symbol per name
+   unsigned int numSlots;  // always a power of two
+   unsigned int numNames;  // number of non-empty slots
+   Symbol **scopes;        // scope stack: list of symbols for each level
+   int numScopes;          // number of entries allocated in scopes[]
+   SymInfo *info;          // side table by id, info[0] unused
+   int numIds, maxIds;
+   SymId *funcSlots;       // open addressing table of function ids
+   unsigned int numFuncSlots, numFuncs;
+   unsigned long numLookups;  // findSymbol() and functionId() calls
+} SymbolTable;
+
 typedef struct
 {
    int index;
    Symbol *lastsym;
 } SymbolTableIter;
 
-Symbol **newSymbolTable();
-int addSymbol(Symbol **table, char *name, int scopeLevel, DataType type,
+SymbolTable *newSymbolTable();
+int addSymbol(SymbolTable *table, char *name, int scopeLevel, DataType type,
               unsigned int size, int offset, VariableKind varkind);
-Symbol *findSymbol(Symbol **table, char *name);
-Symbol *iterSymbolTable(Symbol **table, int scopeLevel, SymbolTableIter *iter);
-void freeAllSymbols(Symbol **table);
-int delScopeLevel(Symbol **table, int scopeLevel);
-/*
-NOT USED
-int delSymbol(Symbol** table, char* name, int scopeLevel);
-*/
-
-#endif
\ No newline at end of file
+Symbol *findSymbol(SymbolTable *table, char *name);
+SymId addSymbolId(SymbolTable *table, char *name, DataType type,
+                  unsigned int size, int offset, VariableKind varkind);
+SymId functionId(SymbolTable *table, char *name);
+void releaseSymbolIds(SymbolTable *table, SymId mark);
+Symbol *iterSymbolTable(SymbolTable *table, int scopeLevel, SymbolTableIter *iter);
+void freeAllSymbols(SymbolTable *table);
+int delScopeLevel(SymbolTable *table, int scopeLevel);
+
+#endif
@@ -0,0 +1,126 @@
+//
+// Tail Call Optimization
+// - a call is a tail call when the block it is in ends right after
+//   it, with a return or a jump through jump-only blocks to a block
+//   that only returns; the jump is replaced by a return of its own,
+//   so the call and the return end up next to each other; the
+//   program block is never changed, since it exits instead
+// - a tail call of the function to itself, with one arg per param,
+//   becomes a loop: the args are copied into the params (through
+//   fresh temps, since an arg may read a param that is assigned
+//   before it) and the call and return become a jump back to the
+//   top of the body; the entry block gets a new block in front of
+//   it, so the loop header is not the entry and the loop pass can
+//   give it a preheader
+// - other tail calls are left in the IR; the backend sees a call
+//   followed by a return and emits the epilogue and a "tail"
+//   instead (see riscv.c), so the callee reuses the caller's frame
+// - a J function has no return statement, but the caller can read
+//   a0 after it with "returnvalue" (see inline.c), so a0 at every
+//   return must stay as it was; a0 only changes at calls (args and
+//   results, it is never allocated), so a "tail" returns exactly
+//   the a0 its callee leaves; a loop iteration starts with a0 set
+//   to the first arg, as the recursive call did, and so returns
+//   the same a0 as the innermost call of the recursion would
+//
+#include <stdlib.h>
+#include "passes.h"
+
+// True if the block does nothing but return
+static int isReturnBlock(IRBlock* b)
+{
+   return b->numInstrs == 1 && b->instrs[0].op == IR_RET;
+}
+
+// Follow a block's jump through blocks that only jump on, and
+// return the block reached if all it does is return, else NULL
+static IRBlock* returnTarget(IRBlock* b)
+{
+   int hops = 0;
+   IRInstr* term = blockTerminator(b);
+   if (!term || term->op != IR_JUMP)
+      return NULL;
+   b = term->target[0];
+   while (b->numInstrs == 1 && b->instrs[0].op == IR_JUMP && hops++ < 16)
+      b = b->instrs[0].target[0];
+   return isReturnBlock(b) ? b : NULL;
+}
+
+// Turn the self tail call ending block b into a jump to top
+// - the call is the instruction before b's return, and its args
+//   are the numParams instructions before it
+static void makeLoop(IRFunc* func, IRBlock* b, IRBlock* top)
+{
+   int i, first, call = b->numInstrs-2;
+   int* temps = (int*) malloc((func->numParams+1)*sizeof(int));
+   IRInstr* ins;
+
+   first = call - func->numParams;
+   for (i=0; i < func->numParams; i++) {
+      ins = &b->instrs[first+i];
+      temps[ins->imm] = newVReg(func);
+      ins->op = IR_MOV;
+      ins->dst = temps[ins->imm];
+      ins->imm = 0;
+   }
+   removeIR(b, b->numInstrs-1);  // ret
+   removeIR(b, b->numInstrs-1);  // call
+   for (i=0; i < func->numParams; i++)
+      emitIR(b, IR_MOV, i, temps[i], NOVREG, 0);
+   if (func->numParams > 0)
+      emitIR(b, IR_ARG, NOVREG, 0, NOVREG, 0);  // a0, as the call would have
+   emitIR(b, IR_JUMP, NOVREG, NOVREG, NOVREG, 0)->target[0] = top;
+   free(temps);
+}
+
+// True if the call at position pos of b passes exactly the function's
+// params, as the args right before it
+static int isSelfCall(IRFunc* func, IRBlock* b, int pos)
+{
+   int i;
+   IRInstr* call = &b->instrs[pos];
+   if (call->op != IR_CALL || call->sym != func->sym || call->imm != func->numParams ||
+       pos < func->numParams)
+      return 0;
+   for (i=0; i < func->numParams; i++)
+      if (b->instrs[pos-func->numParams+i].op != IR_ARG)
+         return 0;
+   return 1;
+}
+
+// Tail call pass
+// - returns the number of tail calls found
+int tailCalls(IRFunc* func)
+{
+   int i, n, changes = 0;
+   IRBlock *b, *top = NULL;
+   IRInstr* term;
+
+   if (func->isProgram)
+      return 0;  // the program exits instead of returning
+   for (i=0; i < func->numBlocks; i++) {
+      b = func->blocks[i];
+      n = b->numInstrs;
+      if (n < 2 || b->instrs[n-2].op != IR_CALL)
+         continue;
+      term = &b->instrs[n-1];
+      if (term->op == IR_JUMP && returnTarget(b)) {
+         term->op = IR_RET;
+         term->target[0] = NULL;
+      }
+      if (term->op != IR_RET)
+         continue;
+      changes++;
+      if (!isSelfCall(func, b, n-2))
+         continue;
+      if (!top) {
+         top = func->blocks[0];
+         emitIR(insertIRBlock(func, 0), IR_JUMP, NOVREG, NOVREG, NOVREG, 0)->target[0] = top;
+         i++;  // b moved down one
+      }
+      makeLoop(func, b, top);
+   }
+   if (changes > 0)
+      removeUnreachableBlocks(func);
+   return changes;
+}
@@ -1,9 +1,9 @@
-
 #include <stdio.h>
 #include <string.h>
 #include "symtable.h"
+#include "intern.h"
 
-Symbol** table;
+SymbolTable* table;
 
 int main(int argc, char** argv)
 {
@@ -13,7 +13,7 @@ table = newSymbolTable();
 for (i=1; i<argc; i++) {
 printf("argv[%d] == (%s)\n", i, argv[i]);
 // add symbol to table, do this in variable declaration action
-addSymbol(table, argv[i], 0, T_INT, 0, 0);
+addSymbol(table, internString(argv[i]), 0, T_INT, 0, 0, V_GLOBAL);
 }
 // iterate through table, do this to declare variables in assembly code
 Symbol* symbol;
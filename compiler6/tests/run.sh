@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Regression tests, run by "make test"
+# - every tests/NAME.j is compiled by ptest and run on rvsim, with
+#   NAME.in (if there is one) as its input, and what it prints must
+#   be NAME.out, at -O0, -O1 and -O2 and with -fstream
+# - with -fcodegen-threads=4 the assembly must be byte-identical to
+#   the one-thread compile
+# - a second compile with the same -fcache-dir must take every
+#   function from the cache and write the same assembly
+# - prints one line per failure and exits with 1 if there was any
+#
+cd "$(dirname "$0")" || exit 1
+PTEST=../ptest
+RVSIM=../rvsim
+CACHE=cache.tmp
+fail=0
+
+# run NAME.s and compare what it prints with NAME.out
+check() {
+   name=$1; what=$2
+   if [ -f $name.in ]; then
+      $RVSIM $name.s < $name.in > $name.run
+   else
+      $RVSIM $name.s < /dev/null > $name.run
+   fi
+   if ! cmp -s $name.run $name.out; then
+      echo "FAIL: $name $what: wrong output"
+      fail=1
+   fi
+}
+
+for j in *.j; do
+   name=${j%.j}
+   for opt in -O0 -O1 -O2; do
+      if $PTEST $opt $j; then
+         check $name "$opt"
+      else
+         echo "FAIL: $name $opt: ptest failed"
+         fail=1
+      fi
+   done
+   cp $name.s $name.one.s  # the -O2 code, from one thread
+
+   if ! $PTEST -O2 -fcodegen-threads=4 $j || ! cmp -s $name.s $name.one.s; then
+      echo "FAIL: $name -fcodegen-threads=4: assembly differs"
+      fail=1
+   fi
+
+   if $PTEST -O2 -fstream $j; then
+      check $name "-fstream"
+   else
+      echo "FAIL: $name -fstream: ptest failed"
+      fail=1
+   fi
+
+   rm -rf $CACHE
+   $PTEST -O2 -fcache-dir=$CACHE $j 2> /dev/null
+   if ! $PTEST -O2 -fcache-dir=$CACHE $j 2> $name.err ||
+      ! grep -q " 0 misses" $name.err || ! cmp -s $name.s $name.one.s; then
+      echo "FAIL: $name -fcache-dir: second compile missed or differs"
+      fail=1
+   fi
+   rm -f $name.s $name.one.s $name.run $name.err
+done
+rm -rf $CACHE
+[ $fail = 0 ] && echo "all tests passed"
+exit $fail
@@ -0,0 +1,42 @@
+//
+// Trace Event Ring Buffer
+// - see trace.h for the interface
+// - recording is a store into the next slot and an increment; the
+//   count is only reset between compiles, so its low bits give the
+//   next slot and it also tells how many events were dropped
+//
+#include "trace.h"
+#include "compiler.h"
+
+static THREADLOCAL TraceEvent ring[TRACERINGSIZE];
+static THREADLOCAL unsigned long numEvents = 0;
+
+void traceEvent(const char* what, int line, unsigned int start, unsigned int len)
+{
+   TraceEvent* e = &ring[numEvents++ & (TRACERINGSIZE-1)];
+   e->what = what;
+   e->line = line;
+   e->start = start;
+   e->len = len;
+}
+
+// Forget the events recorded so far, at the start of a compile
+void resetTrace()
+{
+   numEvents = 0;
+}
+
+// Print the events still in the ring, oldest first
+void dumpTrace(FILE* out)
+{
+   unsigned long i, first;
+   TraceEvent* e;
+   if (numEvents == 0)
+      return;
+   first = numEvents > TRACERINGSIZE ? numEvents - TRACERINGSIZE : 0;
+   fprintf(out, "trace: %lu events, last %lu:\n", numEvents, numEvents - first);
+   for (i=first; i < numEvents; i++) {
+      e = &ring[i & (TRACERINGSIZE-1)];
+      fprintf(out, "   %6d  %-12s  @%u+%u\n", e->line, e->what, e->start, e->len);
+   }
+}
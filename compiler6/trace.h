@@ -0,0 +1,31 @@
+//
+// Trace Event Ring Buffer Interface
+// - instrumented code records structured events (what happened,
+//   source line, byte span in the input) into a fixed ring buffer;
+//   only the last TRACERINGSIZE events are kept, and nothing is
+//   printed until dumpTrace() is called
+// - the scanner records one event per token, but only when it is
+//   built with -DSCANTRACE ("make ptrace"); in a normal build its
+//   TRACETOKEN() calls expand to nothing, so lexing pays no check
+//   at all for tracing
+//
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+#define TRACERINGSIZE 4096  // must be a power of two
+
+typedef struct
+{
+   const char *what;     // event name, for tokens the token name
+   int line;             // source line
+   unsigned int start;   // byte offset of the span in the input
+   unsigned int len;     // length of the span
+} TraceEvent;
+
+void traceEvent(const char *what, int line, unsigned int start, unsigned int len);
+void resetTrace();
+void dumpTrace(FILE *out);
+
+#endif
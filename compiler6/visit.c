@@ -0,0 +1,92 @@
+//
+// Iterative AST Visitor
+// - see visit.h for the interface
+// - a stack frame is a node being visited, its depth, and the
+//   phase it is at; the top frame is the node whose visit function
+//   is called next, so finishing a node either replaces its frame
+//   with its next sibling or pops it
+//
+#include <stdlib.h>
+#include "visit.h"
+
+#define INITIALVISITSTACK 64
+
+typedef struct
+{
+   ASTNode *node;
+   int depth;
+   int phase;
+} VisitFrame;
+
+// Walk list and everything under it with visit
+// - depth is passed on to visit for the nodes of list, and is one
+//   more for each level of children
+// - returns 0, VISITSTOP if visit stopped the walk, or -1 if the
+//   stack could not be grown
+int visitAST(ASTNode* list, int depth, ASTVisitFunc visit, void* arg)
+{
+   VisitFrame* stack;
+   VisitFrame* f;
+   ASTNode* child;
+   int sp = 0, max = INITIALVISITSTACK, k;
+
+   if (!list)
+      return 0;
+   stack = (VisitFrame*) malloc(max * sizeof(VisitFrame));
+   if (!stack)
+      return -1;
+   stack[sp].node = list;
+   stack[sp].depth = depth;
+   stack[sp++].phase = 0;
+   while (sp > 0) {
+      f = &stack[sp-1];
+      k = visit(f->node, f->phase++, f->depth, arg);
+      if (k == VISITSTOP) {
+         free(stack);
+         return VISITSTOP;
+      }
+      if (k == VISITDONE) {
+         if (f->node->next) {
+            f->node = f->node->next;  // siblings are a loop, not a push
+            f->phase = 0;
+         } else
+            sp--;
+         continue;
+      }
+      child = f->node->child[k];
+      if (!child)
+         continue;
+      if (sp == max) {
+         max *= 2;
+         f = (VisitFrame*) realloc(stack, max * sizeof(VisitFrame));
+         if (!f) {
+            free(stack);
+            return -1;
+         }
+         stack = f;
+      }
+      stack[sp].node = child;
+      stack[sp].depth = stack[sp-1].depth + 1;
+      stack[sp++].phase = 0;
+   }
+   free(stack);
+   return 0;
+}
+
+// Visit every child slot in order, counting the nodes
+static int countVisit(ASTNode* node, int phase, int depth, void* arg)
+{
+   (void) node;
+   (void) depth;
+   if (phase == 0)
+      (*(int*) arg)++;
+   return phase < ASTNUMCHILDREN ? phase : VISITDONE;
+}
+
+// Count the nodes of a list and everything under it
+int countASTNodes(ASTNode* list)
+{
+   int n = 0;
+   visitAST(list, 0, countVisit, &n);
+   return n;
+}
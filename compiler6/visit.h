@@ -0,0 +1,29 @@
+//
+// Iterative AST Visitor Interface
+// - visitAST() walks an AST list without recursion: the nodes still
+//   to be finished are kept on a heap-allocated work stack, and
+//   sibling lists are followed in a loop, so neither a long
+//   statement list nor deep nesting uses C stack
+// - the visit function is called for a node once per phase, with
+//   phase 0, 1, 2, ...; each time it does its work for that point
+//   (before, between, or after children) and returns the child slot
+//   to walk next, or VISITDONE when the node is finished
+// - a child slot that is empty is simply skipped, and the node's
+//   next phase follows; after VISITDONE the walk moves on to the
+//   node's next sibling at the same depth
+// - returning VISITSTOP ends the whole walk
+//
+#ifndef VISIT_H
+#define VISIT_H
+
+#include "astree.h"
+
+#define VISITDONE (-1)
+#define VISITSTOP (-2)
+
+typedef int (*ASTVisitFunc)(ASTNode *node, int phase, int depth, void *arg);
+
+int visitAST(ASTNode *list, int depth, ASTVisitFunc visit, void *arg);
+int countASTNodes(ASTNode *list);
+
+#endif